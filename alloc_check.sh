@@ -0,0 +1,87 @@
+#!/bin/bash
+#
+# Allocation check for pfind.
+#
+# Searches two trees with the same directories, the second with twice as
+# many files in each, under mcount.so, which counts malloc(), calloc()
+# and realloc() calls. Anything allocated per entry shows up as extra
+# allocations in the second search; per-directory and start-up
+# allocations cancel out. Each engine option set below is checked, with
+# a few expressions, and the check fails if any search allocates more
+# than SLACK times extra.
+#
+# With --threads, a worker makes its own few allocations (path buffers,
+# a directory arena) when it first gets work, and how many workers get
+# any varies from run to run: a search that needs no stat() may be over
+# before some have stolen a task. So each worker but one may add up to
+# WORKER_SLACK more; that is still far below one per entry.
+#
+# usage: ./alloc_check.sh [dirs [files]]
+#
+
+DIRS=${1:-20}
+FILES=${2:-500}
+SLACK=2
+WORKER_SLACK=8
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=${ALLOC_DIR:-/tmp/pfind-alloc.$$}
+
+ENGINES=("" "--threads 4")
+EXPRS=("" "-name *.c" "-type f -size -1k" "-unique")
+
+#-------------------------------------
+#    build program and shim
+#-------------------------------------
+make -s -C "$HERE" pfind mcount.so || exit 1
+
+# make tree $1 with DIRS directories (nested 4 deep) of $2 files each
+make_tree()
+{
+	local d i j
+
+	for ((i = 0; i < DIRS; i++))
+	do
+		d=$1/d$((i % 4))/d$i/sub
+		mkdir -p "$d"
+		for ((j = 0; j < $2; j++))
+		do
+			: > "$d/f$j.$((j % 3 == 0 ? 0 : j)).c"
+		done
+	done
+}
+
+# print the allocation count of searching tree $1 with options $2
+allocs()
+{
+	LD_PRELOAD=$HERE/mcount.so "$HERE/pfind" "$1" $2 2>&1 >/dev/null |
+		sed -n 's/^mcount: \([0-9]*\) allocations$/\1/p'
+}
+
+mkdir -p "$WORK" || exit 1
+make_tree "$WORK/small" "$FILES"
+make_tree "$WORK/large" $((2 * FILES))
+
+failures=0
+for engine in "${ENGINES[@]}"
+do
+	for expr in "${EXPRS[@]}"
+	do
+		set -f
+		small=$(allocs "$WORK/small" "$engine $expr")
+		large=$(allocs "$WORK/large" "$engine $expr")
+		set +f
+		extra=$((large - small))
+		printf "%-16s %-20s %8d %8d %+6d\n" "${engine:-plain}" "${expr:-(none)}" \
+			"$small" "$large" "$extra"
+		workers=$(sed -n 's/.*--threads \([0-9]*\).*/\1/p' <<< "$engine")
+		slack=$((SLACK + WORKER_SLACK * (${workers:-1} - 1)))
+		if ((extra > slack || extra < -slack)); then
+			echo "alloc_check.sh: allocations grow with entries: $engine $expr"
+			failures=$((failures + 1))
+		fi
+	done
+done
+
+rm -rf "$WORK"
+echo "alloc_check.sh: $failures failures, $((DIRS * FILES)) more entries in the large tree"
+exit $((failures > 0))
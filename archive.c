@@ -0,0 +1,459 @@
+/*
+ * ==========================
+ *   FILE: ./archive.c
+ * ==========================
+ * Purpose: List the members of zip and tar archives without extracting
+ *		them, so the walker can match them like directory entries.
+ *
+ * Outline: archive_scan() reads an archive's index once and calls back
+ *		for every member with a struct member describing it. Nothing but
+ *		the index is read:
+ *
+ *		zip -- the file is mmap()ed and the central directory at the end is
+ *			   walked, including zip64 records and size extras.
+ *		tar -- 512-byte headers are read with pread(), and each member's
+ *			   data is skipped over. ustar prefixes, GNU long names ('L')
+ *			   and pax "path=" records are understood. Compressed tarballs
+ *			   cannot be skipped through and are not searched.
+ *
+ *		Member paths are normalized: a leading "./" or '/' and a trailing
+ *		'/' are removed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define TAR_BLOCK		512
+#define ZIP_EOCD		0x06054b50		//end of central directory
+#define ZIP_EOCD64		0x06064b50		//zip64 end of central directory
+#define ZIP_LOC64		0x07064b50		//zip64 end of central dir locator
+#define ZIP_CENTRAL		0x02014b50		//central directory file header
+#define ZIP_EOCD_SIZE	22
+#define ZIP_CDH_SIZE	46
+#define ZIP_MAX_COMMENT	65535
+
+static int scan_zip(int, off_t, archive_visit, void *);
+static int scan_tar(int, archive_visit, void *);
+static unsigned get16(unsigned char *);
+static unsigned long get32(unsigned char *);
+static unsigned long long get64(unsigned char *);
+static long long tar_number(char *, int);
+static time_t dos_time(unsigned, unsigned);
+static int visit(char *, size_t, mode_t, long long, time_t,
+					archive_visit, void *);
+
+/*
+ *	archive_type()
+ *	Purpose: tell from its name whether a file is an archive we can read
+ *	 Return: ARCHIVE_ZIP, ARCHIVE_TAR, or ARCHIVE_NONE
+ */
+int archive_type(char *name)
+{
+	static char *zips[] = { ".zip", ".jar", ".war", ".ear", ".apk", ".whl",
+							NULL };
+	size_t len = strlen(name);
+	int i;
+
+	for (i = 0; zips[i] != NULL; i++)
+		if (len > 4 && strcmp(name + len - strlen(zips[i]), zips[i]) == 0)
+			return ARCHIVE_ZIP;
+
+	if (len > 4 && strcmp(name + len - 4, ".tar") == 0)
+		return ARCHIVE_TAR;
+
+	return ARCHIVE_NONE;
+}
+
+/*
+ *	archive_scan()
+ *	Purpose: call "fn" for every member of the archive at "path"
+ *	  Input: path, the archive
+ *			 kind, ARCHIVE_ZIP or ARCHIVE_TAR, from archive_type()
+ *			 fn, called with each member and "arg"
+ *	 Return: 0, or -1 with errno set. A damaged or unrecognized archive
+ *			 sets errno to EINVAL; members found before the damage have
+ *			 already been passed to "fn".
+ */
+int archive_scan(char *path, int kind, archive_visit fn, void *arg)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	int rv, err;
+
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &info) == -1)
+		rv = -1;
+	else if (kind == ARCHIVE_ZIP)
+		rv = scan_zip(fd, info.st_size, fn, arg);
+	else
+		rv = scan_tar(fd, fn, arg);
+
+	err = errno;
+	close(fd);
+	errno = err;
+	return rv;
+}
+
+/*
+ *	scan_zip()
+ *	Purpose: walk the central directory of a zip archive
+ *	 Method: find the end of central directory record by scanning back
+ *			 from the end over a possible comment, follow the zip64
+ *			 locator if the counts overflowed, then read every central
+ *			 directory header in turn.
+ */
+static int scan_zip(int fd, off_t size, archive_visit fn, void *arg)
+{
+	unsigned char *map, *p, *end, *eocd = NULL, *x;
+	unsigned long long count, offset, n, usize;
+	unsigned namelen, extralen, commentlen, id, len;
+	mode_t mode;
+	int rv = 0;
+
+	if (size < ZIP_EOCD_SIZE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	end = map + size;
+
+	for (p = end - ZIP_EOCD_SIZE; p >= map
+			&& p >= end - ZIP_EOCD_SIZE - ZIP_MAX_COMMENT; p--)
+	{
+		if (get32(p) == ZIP_EOCD)
+		{
+			eocd = p;
+			break;
+		}
+	}
+	if (eocd == NULL)
+	{
+		munmap(map, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	count = get16(eocd + 10);
+	offset = get32(eocd + 16);
+	p = eocd - 20;
+	if ((count == 0xffff || offset == 0xffffffff) && p >= map
+			&& get32(p) == ZIP_LOC64 && get64(p + 8) + 56 <= (size_t) size
+			&& get32(map + get64(p + 8)) == ZIP_EOCD64)
+	{
+		count = get64(map + get64(p + 8) + 32);
+		offset = get64(map + get64(p + 8) + 48);
+	}
+
+	for (p = map + offset, n = 0; n < count && rv == 0; n++)
+	{
+		if (offset > (size_t) size || p + ZIP_CDH_SIZE > end
+				|| get32(p) != ZIP_CENTRAL)
+		{
+			errno = EINVAL;
+			rv = -1;
+			break;
+		}
+		namelen = get16(p + 28);
+		extralen = get16(p + 30);
+		commentlen = get16(p + 32);
+		if (p + ZIP_CDH_SIZE + namelen + extralen + commentlen > end)
+		{
+			errno = EINVAL;
+			rv = -1;
+			break;
+		}
+
+		//sizes that overflowed 32 bits are in the zip64 extra field
+		usize = get32(p + 24);
+		for (x = p + ZIP_CDH_SIZE + namelen;
+			 x + 4 <= p + ZIP_CDH_SIZE + namelen + extralen; x += 4 + len)
+		{
+			id = get16(x);
+			len = get16(x + 2);
+			//a field running past the extras is damaged
+			if (x + 4 + len > p + ZIP_CDH_SIZE + namelen + extralen)
+			{
+				errno = EINVAL;
+				rv = -1;
+				break;
+			}
+			if (id == 0x0001 && usize == 0xffffffff && len >= 8)
+				usize = get64(x + 4);
+		}
+		if (rv == -1)
+			break;
+
+		//Unix hosts keep the mode in the high half of the attributes
+		mode = p[5] == 3 ? get32(p + 38) >> 16 : 0;
+		if ((mode & S_IFMT) == 0)
+			mode = p[ZIP_CDH_SIZE + namelen - 1] == '/' ? S_IFDIR | 0755
+													  : S_IFREG | 0644;
+
+		rv = visit((char *) p + ZIP_CDH_SIZE, namelen, mode, usize,
+				   dos_time(get16(p + 14), get16(p + 12)), fn, arg);
+		p += ZIP_CDH_SIZE + namelen + extralen + commentlen;
+	}
+
+	munmap(map, size);
+	return rv;
+}
+
+/*
+ *	scan_tar()
+ *	Purpose: walk the headers of a tar archive, skipping member data
+ *	 Method: each header is checksummed; a zero block, or the end of the
+ *			 file, ends the archive. 'L' and 'x' headers carry the name of
+ *			 the member after them, read into a buffer that is reused for
+ *			 the whole archive.
+ */
+static int scan_tar(int fd, archive_visit fn, void *arg)
+{
+	char block[TAR_BLOCK];
+	char *longname = NULL, *rec, *recend, *name;
+	size_t longsize = 0;					//bytes allocated for longname
+	int have_long = NO;						//longname names the next member
+	long long size, sum, want;
+	off_t off = 0;
+	mode_t mode;
+	size_t len;
+	ssize_t got = 0;
+	int i, found, rv = 0;
+
+	while (rv == 0 && (got = pread(fd, block, TAR_BLOCK, off)) == TAR_BLOCK)
+	{
+		for (i = 0, sum = 0; i < TAR_BLOCK; i++)
+			sum += (i >= 148 && i < 156) ? ' ' : (unsigned char) block[i];
+		if (sum == 8 * ' ')						//zero block, end of archive
+			break;
+		if ((want = tar_number(block + 148, 8)) != sum
+				|| (size = tar_number(block + 124, 12)) < 0)
+		{
+			errno = EINVAL;
+			rv = -1;
+			break;
+		}
+		off += TAR_BLOCK;
+
+		if (block[156] == 'L' || block[156] == 'x')		//name for next member
+		{
+			if ((size_t) size + 1 > longsize)
+			{
+				free(longname);
+				longsize = size + 1;
+				if ((longname = malloc(longsize)) == NULL)
+				{
+					errno = ENOMEM;
+					rv = -1;
+					break;
+				}
+			}
+			if (pread(fd, longname, size, off) != size)
+			{
+				errno = EINVAL;
+				rv = -1;
+				break;
+			}
+			longname[size] = '\0';
+			have_long = YES;
+
+			//pax records are "LEN path=VALUE\n"; keep only the path
+			for (rec = longname, found = NO; block[156] == 'x' && !found
+					&& rec < longname + size; rec = recend)
+			{
+				recend = rec + strtol(rec, &name, 10);
+				if (recend <= rec || recend > longname + size)
+					break;
+				if (strncmp(name, " path=", 6) == 0)
+				{
+					//" path=" and the newline, or the record is damaged
+					if (recend - name < 7 || recend[-1] != '\n')
+					{
+						errno = EINVAL;
+						rv = -1;
+						break;
+					}
+					len = recend - name - 7;
+					memmove(longname, name + 6, len);
+					longname[len] = '\0';
+					found = YES;
+				}
+			}
+			if (rv == -1)
+				break;
+			if (block[156] == 'x' && !found)
+				have_long = NO;					//pax header without a path
+		}
+		else if (block[156] != 'g' && block[156] != 'K')
+		{
+			switch (block[156]) {
+				case '2': mode = S_IFLNK; break;
+				case '3': mode = S_IFCHR; break;
+				case '4': mode = S_IFBLK; break;
+				case '5': mode = S_IFDIR; break;
+				case '6': mode = S_IFIFO; break;
+				default:  mode = S_IFREG; break;
+			}
+			mode |= tar_number(block + 100, 8) & 07777;
+
+			if (have_long)
+				rv = visit(longname, strlen(longname), mode, size,
+						   tar_number(block + 136, 12), fn, arg);
+			else
+			{
+				char full[155 + 1 + 100 + 1];	//ustar prefix "/" name
+
+				if (strncmp(block + 257, "ustar", 5) == 0 && block[345])
+					snprintf(full, sizeof full, "%.155s/%.100s",
+							 block + 345, block);
+				else
+					snprintf(full, sizeof full, "%.100s", block);
+				rv = visit(full, strlen(full), mode, size,
+						   tar_number(block + 136, 12), fn, arg);
+			}
+			have_long = NO;
+		}
+
+		//links, devices and directories have no data, whatever size says
+		if (block[156] == '1' || block[156] == '2' || block[156] == '3'
+				|| block[156] == '4' || block[156] == '5' || block[156] == '6')
+			size = 0;
+		off += (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+	}
+
+	free(longname);
+	if (rv == 0 && got > 0 && got < TAR_BLOCK)		//truncated header
+	{
+		errno = EINVAL;
+		rv = -1;
+	}
+	return rv;
+}
+
+/*
+ * visit()
+ * Purpose: normalize a member path of "len" bytes and pass it on to "fn"
+ *  Return: what "fn" returns
+ *    Note: the copy is made on the stack unless the path is very long
+ */
+static int visit(char *path, size_t len, mode_t mode, long long size,
+					time_t mtime, archive_visit fn, void *arg)
+{
+	struct member m;
+	char small[PATH_MAX];
+	char *copy = len < sizeof small ? small : malloc(len + 1);
+	char *p;
+	int rv;
+
+	if (copy == NULL)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(copy, path, len);
+	copy[len] = '\0';
+
+	for (p = copy; strncmp(p, "./", 2) == 0 || *p == '/'; )
+		p += *p == '/' ? 1 : 2;
+	len = strlen(p);
+	while (len > 0 && p[len - 1] == '/')
+		p[--len] = '\0';
+
+	if (len == 0)								//the archive's "." entry
+	{
+		if (copy != small)
+			free(copy);
+		return 0;
+	}
+
+	m.path = p;
+	m.name = strrchr(p, '/') ? strrchr(p, '/') + 1 : p;
+	m.mode = mode;
+	m.size = size;
+	m.mtime = mtime;
+	rv = fn(&m, arg);
+
+	if (copy != small)
+		free(copy);
+	return rv;
+}
+
+/* little-endian fields of zip records */
+static unsigned get16(unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned long get32(unsigned char *p)
+{
+	return get16(p) | (unsigned long) get16(p + 2) << 16;
+}
+
+static unsigned long long get64(unsigned char *p)
+{
+	return get32(p) | (unsigned long long) get32(p + 4) << 32;
+}
+
+/*
+ * tar_number()
+ * Purpose: decode a tar numeric field: octal digits, or base-256 when the
+ *			high bit of the first byte is set (GNU, for large values)
+ *  Return: the value, or -1 if it is negative in base-256
+ */
+static long long tar_number(char *field, int len)
+{
+	unsigned char *p = (unsigned char *) field;
+	long long n = 0;
+	int i;
+
+	if (p[0] & 0x80)
+	{
+		if (p[0] & 0x40)
+			return -1;
+		n = p[0] & 0x3f;
+		for (i = 1; i < len; i++)
+			n = n << 8 | p[i];
+		return n;
+	}
+
+	for (i = 0; i < len && (p[i] == ' ' || p[i] == '\0'); i++)
+		;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		n = n * 8 + (p[i] - '0');
+	return n;
+}
+
+/*
+ * dos_time()
+ * Purpose: convert a zip (MS-DOS) date and time, in local time
+ */
+static time_t dos_time(unsigned date, unsigned tm)
+{
+	struct tm t;
+
+	memset(&t, 0, sizeof t);
+	t.tm_year = (date >> 9) + 80;
+	t.tm_mon = ((date >> 5) & 0x0f) - 1;
+	t.tm_mday = date & 0x1f;
+	t.tm_hour = tm >> 11;
+	t.tm_min = (tm >> 5) & 0x3f;
+	t.tm_sec = (tm & 0x1f) * 2;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
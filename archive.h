@@ -0,0 +1,33 @@
+/*
+ * ==========================
+ *   FILE: ./archive.h
+ * ==========================
+ * Purpose: Listing the members of zip and tar archives, see archive.c.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/* CONSTANTS */
+#define ARCHIVE_NONE	0
+#define ARCHIVE_ZIP		1
+#define ARCHIVE_TAR		2
+
+struct member {
+	char *path;					//path inside the archive, normalized
+	char *name;					//last component of "path"
+	mode_t mode;				//file type and permissions
+	long long size;				//uncompressed size
+	time_t mtime;
+};
+
+//called for each member; a non-zero return stops the scan with that value
+typedef int (*archive_visit)(struct member *, void *);
+
+int archive_type(char *);
+int archive_scan(char *, int, archive_visit, void *);
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * ==========================
+ *   FILE: ./backend.c
+ * ==========================
+ * Purpose: The default filesystem backend, a thin layer over the POSIX
+ *		directory calls. See backend.h for the interface.
+ *
+ * Data structures: opendir() reads the whole directory with dir_read()
+ *		(dirread.c) and closes it again, so a search holds no directory
+ *		open while it works through the entries. readdir() hands out the
+ *		entries a batch at a time, the names pointing straight into the
+ *		arena they were read into. Closed directories are kept on a
+ *		per-thread list and reused by the next opendir(), so that the
+ *		arenas are allocated once per level of the search rather than
+ *		once per directory. The list is capped at SPARE_MAX, for when
+ *		directories are opened on one thread and closed on another, as
+ *		the --async helpers do.
+ *
+ * Inode order: on ext4 with dir_index, and other hashed directories, the
+ *		entries come in hash order, which is unrelated to where their
+ *		inodes are. stat()ing a large directory in that order reads the
+ *		inode table at random, a block for nearly every entry, when the
+ *		inodes are not cached. Sorted by inode number, neighbouring
+ *		entries share inode table blocks and the reads go forward. So a
+ *		large directory is handed out in inode order, which the walker
+ *		then stat()s and descends in, when sorting is likely to pay:
+ *
+ *			count >= SORT_MIN and slow_share >= SLOW_SHARE and
+ *			slow_share * (slow_ns - fast_ns) >= SORT_LEVEL_NS * log2(count)
+ *
+ *		fast_ns is the lowest lstat() latency seen, what a cached inode
+ *		costs on this system. A call taking COLD_FACTOR times that is
+ *		slow, most likely a read from disk; slow_share is the recent
+ *		share of slow calls, and slow_ns their recent latency. The second
+ *		test tells a cold cache from the odd preempted call; the third
+ *		weighs what the slow calls add per entry against the cost of the
+ *		sort. Every SAMPLE_EVERY-th call is timed, in directories left in
+ *		directory order (sorted ones would flatter the figures and switch
+ *		sorting off again). On a warm cache nothing is sorted; on a cold
+ *		one, all but the smallest directories are. --inode-order always
+ *		or never overrides the rule.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "backend.h"
+#include "dirread.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define SORT_MIN		256				//fewest entries ever sorted
+#define SORT_LEVEL_NS	100				//stat latency worth a sort, per
+										//doubling of the directory size
+#define COLD_FACTOR		4				//slowdown that means a disk read
+#define SLOW_SHARE		0.25			//of calls slow, for a cold cache
+#define SAMPLE_EVERY	16				//lstat() calls per timed one
+#define SPARE_MAX		64				//closed directories kept per thread
+
+struct posix_dir {
+	struct dirlist list;				//all the entries
+	int pos;							//next entry to hand out
+	int err;							//errno dir_read() failed with, or 0
+	int sorted;							//YES if in inode order
+	struct posix_dir *next;				//on the spare list, when closed
+};
+
+static void *posix_opendir(char *);
+static int posix_readdir(void *, struct batch *);
+static int posix_stat(void *, int, char *, struct stat *);
+static void posix_closedir(void *);
+static int want_sorted(int);
+static int by_inode(const void *, const void *);
+static long now_ns();
+
+struct backend posix_backend = {
+	posix_opendir, posix_readdir, posix_stat, posix_closedir
+};
+
+static __thread struct posix_dir *spare;	//closed, ready for reuse
+static __thread int nspare;
+
+static int inode_order = INODE_AUTO;		//--inode-order
+static long sorted_dirs;					//directories sorted, all threads
+static __thread long fast_ns;				//lowest lstat() latency, or 0
+static __thread long slow_ns;				//recent latency of slow ones
+static __thread double slow_share;			//recent share of slow ones
+static __thread unsigned stat_calls;
+
+//the flags opendir(3) uses; O_NONBLOCK so that a FIFO can never block
+static void *posix_opendir(char *path)
+{
+	struct posix_dir *pd;
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd == -1)
+		return NULL;
+
+	if ((pd = spare) != NULL)
+	{
+		spare = pd->next;
+		nspare--;
+	}
+	else if ((pd = calloc(1, sizeof *pd)) == NULL)
+	{
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pd->err = dir_read(fd, &pd->list) == -1 ? errno : 0;
+	pd->pos = 0;
+	close(fd);
+
+	pd->sorted = want_sorted(pd->list.count);
+	if (pd->sorted)
+	{
+		qsort(pd->list.ent, pd->list.count, sizeof *pd->list.ent, by_inode);
+		__atomic_add_fetch(&sorted_dirs, 1, __ATOMIC_RELAXED);
+	}
+	return pd;
+}
+
+//an error part way is reported once the entries before it are used up
+static int posix_readdir(void *dir, struct batch *b)
+{
+	struct posix_dir *pd = dir;
+	struct dentry *e = pd->list.ent + pd->pos;
+
+	for (b->count = 0; b->count < BATCH_MAX && pd->pos < pd->list.count;
+			b->count++, pd->pos++, e++)
+	{
+		b->name[b->count] = e->name;
+		b->type[b->count] = e->type;
+	}
+	if (b->count == 0 && pd->err)
+	{
+		errno = pd->err;
+		pd->err = 0;
+		return -1;
+	}
+	return b->count;
+}
+
+//the walker always passes the full path, so lstat() serves both cases
+static int posix_stat(void *dir, int i, char *path, struct stat *info)
+{
+	struct posix_dir *pd = dir;
+	long start, took;
+	int rv, slow;
+
+	(void) i;
+	if ((pd && pd->sorted) || ++stat_calls % SAMPLE_EVERY != 0)
+		return lstat(path, info);
+
+	start = now_ns();
+	rv = lstat(path, info);
+	took = now_ns() - start;
+	if (fast_ns == 0 || took < fast_ns)
+		fast_ns = took;
+
+	//moving averages
+	slow = took >= COLD_FACTOR * fast_ns;
+	slow_share += (slow - slow_share) / 16;
+	if (slow)
+		slow_ns += (took - slow_ns) / 8;
+	return rv;
+}
+
+/*
+ * posix_inode_order()
+ * Purpose: choose when directories are handed out in inode order
+ *   Input: mode, INODE_AUTO (large ones, while stat() is slow),
+ *			INODE_ALWAYS or INODE_NEVER
+ */
+void posix_inode_order(int mode)
+{
+	inode_order = mode;
+}
+
+/*
+ * posix_sorted_dirs()
+ * Return: how many directories have been put in inode order so far
+ */
+long posix_sorted_dirs()
+{
+	return __atomic_load_n(&sorted_dirs, __ATOMIC_RELAXED);
+}
+
+/*
+ * posix_release()
+ * Purpose: free the directories the calling thread keeps for reuse, as
+ *			a thread must before it exits
+ */
+void posix_release()
+{
+	struct posix_dir *pd;
+
+	while ((pd = spare) != NULL)
+	{
+		spare = pd->next;
+		dir_free(&pd->list);
+		free(pd);
+	}
+	nspare = 0;
+}
+
+static void posix_closedir(void *dir)
+{
+	struct posix_dir *pd = dir;
+
+	if (nspare == SPARE_MAX)
+	{
+		dir_free(&pd->list);
+		free(pd);
+		return;
+	}
+	pd->next = spare;
+	spare = pd;
+	nspare++;
+}
+
+/*
+ * want_sorted()
+ * Return: YES if a directory of "count" entries should be put in inode
+ *		   order, by --inode-order or the rule at the top of this file
+ */
+static int want_sorted(int count)
+{
+	int log2;
+
+	if (inode_order != INODE_AUTO)
+		return inode_order == INODE_ALWAYS;
+	if (count < SORT_MIN)
+		return NO;
+
+	for (log2 = 0; count > 1; count /= 2)
+		log2++;
+	return slow_share >= SLOW_SHARE
+			&& slow_share * (slow_ns - fast_ns) >= SORT_LEVEL_NS * log2;
+}
+
+//qsort() comparison of two struct dentry by inode number
+static int by_inode(const void *a, const void *b)
+{
+	unsigned long x = ((const struct dentry *) a)->ino;
+	unsigned long y = ((const struct dentry *) b)->ino;
+
+	return (x > y) - (x < y);
+}
+
+static long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
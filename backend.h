@@ -0,0 +1,82 @@
+/*
+ * ==========================
+ *   FILE: ./backend.h
+ * ==========================
+ * Purpose: The filesystem operations pfind's walker is built on.
+ *
+ * Outline: searchdir() and process_dir() never call opendir(), readdir()
+ *		or lstat() directly; they go through the struct backend that is
+ *		currently selected:
+ *
+ *			posix_backend		(backend.c) the real filesystem, the default
+ *			record_backend()	(trace.c) records calls made through another
+ *			replay_backend()	(trace.c) answers from a recorded trace
+ *			mem_backend()		(memfs.c) a tree of struct mnode in memory
+ *			synthetic_backend()	(memfs.c) a generated tree, for benchmarks
+ *
+ *		Directory handles are opaque to the walker. readdir() fills a batch
+ *		with the next entries of the directory; the names stay valid until
+ *		the next readdir() or closedir() on that handle. stat() is asked
+ *		about entry "i" of the batch last read from "dir", or, when "dir"
+ *		is NULL, about "path" itself: the starting path, or an entry of a
+ *		batch handed to another worker (a chunk, see pfind.c) after its
+ *		directory has moved on. The full path of the entry is always
+ *		passed too, for backends that want it.
+ *		Failures return NULL/-1 with errno set, like the calls they replace.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <sys/stat.h>
+
+/* CONSTANTS */
+#define BATCH_MAX	128					//entries returned per readdir()
+
+//posix_inode_order() modes
+#define INODE_AUTO		0				//large directories, while stat() is slow
+#define INODE_ALWAYS	1
+#define INODE_NEVER		2
+
+struct batch {
+	int count;
+	char *name[BATCH_MAX];
+	unsigned char type[BATCH_MAX];		//DT_* if known, else DT_UNKNOWN
+};
+
+struct backend {
+	void *(*opendir)(char *path);
+	int   (*readdir)(void *dir, struct batch *b);	//count, 0 at end, -1
+	int   (*stat)(void *dir, int i, char *path, struct stat *info);
+	void  (*closedir)(void *dir);
+};
+
+/* a node of an in-memory tree, see memfs.c */
+struct mnode {
+	char *name;
+	struct stat info;
+	int stat_err;						//errno for stat(), or 0
+	long stat_ns;						//latency to simulate for stat()
+	int opened;							//YES if it may be opendir()ed
+	int dir_err;						//errno for opendir(), or 0
+	long dir_ns;						//latency to simulate for opendir()
+	struct mnode *parent, *child, *last, *next;
+};
+
+/* backend.c */
+extern struct backend posix_backend;
+void posix_inode_order(int);
+long posix_sorted_dirs();
+void posix_release();
+
+/* trace.c */
+struct backend *record_backend(struct backend *, char *, char *, int);
+int record_finish();
+struct backend *replay_backend(char *, double);
+
+/* memfs.c */
+struct mnode *mem_node(struct mnode *, char *);
+struct backend *mem_backend(struct mnode *, double);
+struct backend *synthetic_backend(char *, char *);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * ==========================
+ *   FILE: ./dirread.c
+ * ==========================
+ * Purpose: Read all the entries of a directory at once, into memory that
+ *		is reused from one directory to the next.
+ *
+ * Outline: dir_read() is given an open directory and calls getdents64()
+ *		on it until the end, each time into the free end of one arena,
+ *		so the kernel's records land back to back with no copying. Only
+ *		then is the index built: a struct dentry per record, with its
+ *		inode, type, and the name and its length, pointing into the arena.
+ *
+ *		The arena starts at ARENA_INIT bytes and doubles whenever less
+ *		than READ_MIN is free, so a directory of n entries costs O(log n)
+ *		allocations the first time and, once a struct dirlist has grown
+ *		that far, none afterwards. The caller owns the struct dirlist and
+ *		decides how long to keep it; backend.c keeps one per open
+ *		directory and reuses it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "dirread.h"
+
+/* CONSTANTS */
+#define ARENA_INIT	(64 * 1024)			//first arena size
+#define READ_MIN	(32 * 1024)			//smallest getdents64() buffer used
+#define ENT_INIT	256					//first index size
+
+//as the kernel writes it; glibc only declares struct dirent64 with
+//_GNU_SOURCE, and its getdents64() wrapper is recent
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static int index_records(struct dirlist *);
+
+/*
+ *	dir_read()
+ *	Purpose: read every entry of a directory into "dl"
+ *	  Input: fd, the directory, open for reading at its start
+ *			 dl, zeroed before its first use, or as a previous call left it
+ *	 Return: the number of entries, or -1 with errno set. After a read
+ *			 error, dl->count entries, those read before it, are valid.
+ *	   Note: The entries stay valid until the next dir_read() or
+ *			 dir_free() on "dl"; "fd" may be closed straight away.
+ */
+int dir_read(int fd, struct dirlist *dl)
+{
+	char *bigger;
+	long n;
+	int err = 0;
+
+	dl->used = 0;
+	dl->count = 0;
+	for (;;)
+	{
+		if (dl->size - dl->used < READ_MIN)
+		{
+			bigger = realloc(dl->arena, dl->size ? 2 * dl->size : ARENA_INIT);
+			if (bigger == NULL)
+			{
+				err = ENOMEM;
+				break;
+			}
+			dl->arena = bigger;
+			dl->size = dl->size ? 2 * dl->size : ARENA_INIT;
+		}
+
+		n = syscall(SYS_getdents64, fd, dl->arena + dl->used,
+					dl->size - dl->used);
+		if (n == 0)
+			break;
+		if (n == -1)
+		{
+			err = errno;
+			break;
+		}
+		dl->used += n;
+	}
+
+	if (index_records(dl) == -1)
+		err = ENOMEM;
+	if (err)
+	{
+		errno = err;
+		return -1;
+	}
+	return dl->count;
+}
+
+/*
+ * dir_free()
+ * Purpose: release the memory of "dl", leaving it as if zeroed
+ */
+void dir_free(struct dirlist *dl)
+{
+	free(dl->arena);
+	free(dl->ent);
+	memset(dl, 0, sizeof *dl);
+}
+
+/*
+ * index_records()
+ * Purpose: build dl->ent from the records in the arena
+ *  Return: 0, or -1 if there is no memory for the index
+ *	  Note: The arena does not move once reading is done, so the name
+ *			pointers are only taken here. The records are counted first,
+ *			so that the index grows at most once, straight to a power of
+ *			two big enough.
+ */
+static int index_records(struct dirlist *dl)
+{
+	struct linux_dirent64 *de;
+	struct dentry *bigger, *e;
+	size_t off;
+	int n, room;
+
+	for (n = 0, off = 0; off < dl->used; n++)
+		off += ((struct linux_dirent64 *) (dl->arena + off))->d_reclen;
+
+	if (n > dl->room)
+	{
+		for (room = dl->room ? dl->room : ENT_INIT; room < n; )
+			room *= 2;
+		if ((bigger = realloc(dl->ent, room * sizeof *bigger)) == NULL)
+			return -1;
+		dl->ent = bigger;
+		dl->room = room;
+	}
+
+	for (off = 0; off < dl->used; off += de->d_reclen)
+	{
+		de = (struct linux_dirent64 *) (dl->arena + off);
+		e = &dl->ent[dl->count++];
+		e->ino = de->d_ino;
+		e->name = de->d_name;
+		e->len = strlen(de->d_name);
+		e->type = de->d_type;
+	}
+	return 0;
+}
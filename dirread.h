@@ -0,0 +1,32 @@
+/*
+ * ==========================
+ *   FILE: ./dirread.h
+ * ==========================
+ * Purpose: Read a whole directory into one arena, see dirread.c.
+ */
+
+#ifndef DIRREAD_H
+#define DIRREAD_H
+
+//one entry; "name" points into the arena and is NUL-terminated
+struct dentry {
+	unsigned long ino;
+	char *name;
+	unsigned short len;				//strlen(name)
+	unsigned char type;				//DT_*, or DT_UNKNOWN
+};
+
+//the entries of a directory, kept from one dir_read() to the next
+struct dirlist {
+	char *arena;					//getdents64 records, back to back
+	size_t size;					//bytes allocated to "arena"
+	size_t used;					//bytes of records in it
+	struct dentry *ent;				//"count" entries, in directory order
+	int count;
+	int room;						//entries allocated to "ent"
+};
+
+int dir_read(int, struct dirlist *);
+void dir_free(struct dirlist *);
+
+#endif
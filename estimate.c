@@ -0,0 +1,341 @@
+/*
+ * ==========================
+ *   FILE: ./estimate.c
+ * ==========================
+ * Purpose: Estimate how many entries a search would match, and their
+ *		total size, from random probes of the tree instead of a walk of
+ *		all of it, for --estimate: a rough answer, with its error, in a
+ *		small part of the time.
+ *
+ * Outline: a probe is Knuth's random descent. It starts at the starting
+ *		path with a weight of 1 and goes down one random subdirectory at a
+ *		time until there is none, dividing the weight by the chance of the
+ *		one it chose; every directory on the way adds its own matches
+ *		times the weight. That sum is an unbiased estimate of the matches
+ *		in the whole tree: a directory reached with chance 1/w counts w
+ *		times. Bytes are estimated the same way.
+ *
+ *		Knuth chose among subdirectories evenly. Here the chance of each
+ *		is in proportion to its fanout as the caller sees it before
+ *		listing it (pfind gives 1 + its subdirectories, from its link
+ *		count), so that probes go more often where more of the tree is,
+ *		and the estimates of a probe vary less. Each directory keeps a
+ *		Fenwick tree of the fanouts to choose by.
+ *
+ *		A subtree listed to the end is known exactly, and adds its totals
+ *		with no error: a probe chooses only among the subdirectories not
+ *		yet known, and adds those known to the directory's own matches.
+ *		The estimate stays unbiased, and its spread shrinks as the tree
+ *		is listed, so that the probes through a small subtree soon cost
+ *		and vary nothing.
+ *
+ *		estimate() runs probes until the 95% confidence interval of the
+ *		mean of both estimates is within "precision" percent of it, after
+ *		PROBES_MIN at least, or the probe limit is reached. The interval
+ *		comes from the spread the probes show, so a tree where a few
+ *		narrow paths lead to most of the files may need many probes
+ *		before that spread is seen.
+ *
+ * Listings: each directory is listed once, by the caller's function,
+ *		which hands its matches to est_match() and its subdirectories to
+ *		est_subdir(); what it held is kept in a tree of struct est_node,
+ *		so that the many probes through the top of the tree read it only
+ *		once. Once the starting path is itself known to the end, the
+ *		answer is exact.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "estimate.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define PROBES_MIN	30				//before the interval is trusted
+#define Z_95		1.96			//normal quantile, for 95%
+#define SUBS_MIN	8				//first size of a subdirectory array
+
+//a directory, what it held once listed
+struct est_node {
+	char *path;
+	int listed;						//NO until it is
+	long long matches;				//entries in it that match
+	long long bytes;				//their size
+	int nsubs, room;				//its subdirectories
+	struct est_node *subs;
+	struct est_node *parent;
+	int index;						//in its parent's "subs"
+	long long fanout;				//its weight for choosing, at least 1
+	long long *fenwick;				//of the fanouts of "subs" not known to
+	long long open_fanout;			//the end, and their sum and number
+	int nopen;
+	long long known_matches;		//in subdirectories known to the end
+	long long known_bytes;
+};
+
+//a running mean and sum of squared deviations, by Welford's method
+struct moments {
+	double mean, sq;
+};
+
+static void add(struct moments *, double, long);
+static double error(struct moments *, long);
+static int listed(struct est_node *);
+static void known(struct est_node *);
+static struct est_node *choose(struct est_node *, double *);
+static void free_node(struct est_node *);
+static unsigned long long next_random();
+
+/* FILE-SCOPE VARIABLES */
+static struct est_node *listing;		//being listed, for est_*()
+static unsigned long long seed;
+
+/*
+ *	estimate()
+ *	Purpose: estimate the matches below "root", and their bytes
+ *	  Input: list, called as list(path, arg) to list a directory, handing
+ *			 what it finds to est_match() and est_subdir()
+ *			 precision, the error wanted, in percent of the estimate
+ *			 max_probes, the probes to give up after
+ *			 r, where to put the estimates
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+int estimate(char *root, void (*list)(char *, void *), void *arg,
+				double precision, long max_probes, struct est_result *r)
+{
+	struct est_node top, *node;
+	struct moments m = { 0, 0 }, b = { 0, 0 };
+	double weight, matches, bytes;
+
+	memset(r, 0, sizeof *r);
+	memset(&top, 0, sizeof top);
+	if ((top.path = strdup(root)) == NULL)
+		return -1;
+	seed = ((unsigned long long) time(NULL) << 20 ^ getpid()) | 1;
+
+	while (r->probes < max_probes)
+	{
+		node = &top;
+		weight = 1;
+		matches = bytes = 0;
+		for (;;)
+		{
+			if (! node->listed)
+			{
+				listing = node;
+				list(node->path, arg);
+				listing = NULL;
+				r->dirs++;
+				if (listed(node) == -1)
+				{
+					free_node(&top);
+					return -1;
+				}
+			}
+			matches += weight * (node->matches + node->known_matches);
+			bytes += weight * (node->bytes + node->known_bytes);
+			if (node->nopen == 0)
+				break;
+			node = choose(node, &weight);
+		}
+		r->probes++;
+		add(&m, matches, r->probes);
+		add(&b, bytes, r->probes);
+
+		if (top.nopen == 0)
+		{
+			r->exact = YES;
+			break;
+		}
+		if (r->probes >= PROBES_MIN
+				&& error(&m, r->probes) <= precision / 100 * m.mean
+				&& error(&b, r->probes) <= precision / 100 * b.mean)
+			break;
+	}
+
+	if (r->exact)
+	{
+		r->matches = top.matches + top.known_matches;
+		r->bytes = top.bytes + top.known_bytes;
+	}
+	else
+	{
+		r->matches = m.mean;
+		r->matches_error = error(&m, r->probes);
+		r->bytes = b.mean;
+		r->bytes_error = error(&b, r->probes);
+	}
+	free_node(&top);
+	return 0;
+}
+
+/*
+ * est_match()
+ * Purpose: count a match of "bytes" in the directory being listed
+ */
+void est_match(long long bytes)
+{
+	listing->matches++;
+	listing->bytes += bytes;
+}
+
+/*
+ *	est_subdir()
+ *	Purpose: add "path" to the subdirectories of the one being listed, to
+ *			 be chosen in proportion to "fanout", at least 1
+ *	 Return: 0, or -1 with errno set if there is no memory; it is then
+ *			 left out of the estimate
+ */
+int est_subdir(char *path, long long fanout)
+{
+	struct est_node *subs, *sub;
+	int room;
+
+	if (listing->nsubs == listing->room)
+	{
+		room = listing->room ? 2 * listing->room : SUBS_MIN;
+		if ((subs = realloc(listing->subs, room * sizeof *subs)) == NULL)
+			return -1;
+		listing->subs = subs;
+		listing->room = room;
+	}
+	sub = &listing->subs[listing->nsubs];
+	memset(sub, 0, sizeof *sub);
+	if ((sub->path = strdup(path)) == NULL)
+		return -1;
+	sub->fanout = fanout < 1 ? 1 : fanout;
+	listing->nsubs++;
+	return 0;
+}
+
+/*
+ *	listed()
+ *	Purpose: set up "node" once it has been listed: its subdirectories
+ *			 are all open, and if it has none it is known to the end
+ *	 Return: 0, or -1 with errno set if there is no memory
+ *	   Note: Its subdirectories have their final place only now, after
+ *			 est_subdir() has stopped growing the array.
+ */
+static int listed(struct est_node *node)
+{
+	long long *f;
+	int i, j;
+
+	node->listed = YES;
+	if (node->nsubs > 0 && (node->fenwick = calloc(node->nsubs + 1,
+										sizeof *node->fenwick)) == NULL)
+		return -1;
+	for (f = node->fenwick, i = 1; i <= node->nsubs; i++)
+	{
+		node->subs[i - 1].parent = node;
+		node->subs[i - 1].index = i - 1;
+		node->open_fanout += node->subs[i - 1].fanout;
+		f[i] += node->subs[i - 1].fanout;
+		if ((j = i + (i & -i)) <= node->nsubs)
+			f[j] += f[i];
+	}
+	node->nopen = node->nsubs;
+	if (node->nopen == 0)
+		known(node);
+	return 0;
+}
+
+/*
+ * known()
+ * Purpose: "node" is known to the end: add its totals to its parent's, and
+ *			take it out of the parent's choice, and so on up for each parent
+ *			that is then known to the end too
+ */
+static void known(struct est_node *node)
+{
+	struct est_node *up;
+	int i;
+
+	for (; (up = node->parent) != NULL; node = up)
+	{
+		up->known_matches += node->matches + node->known_matches;
+		up->known_bytes += node->bytes + node->known_bytes;
+		for (i = node->index + 1; i <= up->nsubs; i += i & -i)
+			up->fenwick[i] -= node->fanout;
+		up->open_fanout -= node->fanout;
+		if (--up->nopen > 0)
+			break;
+	}
+}
+
+/*
+ * choose()
+ * Return: a subdirectory of "node" not known to the end, at random, in
+ *		   proportion to its fanout; "*weight" is divided by its chance
+ */
+static struct est_node *choose(struct est_node *node, double *weight)
+{
+	long long r = next_random() % node->open_fanout;
+	int i = 0, step;
+
+	//the first index whose running sum of fanouts passes "r"
+	for (step = 1; 2 * step <= node->nsubs; step *= 2)
+		;
+	for (; step > 0; step /= 2)
+		if (i + step <= node->nsubs && node->fenwick[i + step] <= r)
+		{
+			i += step;
+			r -= node->fenwick[i];
+		}
+	*weight *= (double) node->open_fanout / node->subs[i].fanout;
+	return &node->subs[i];
+}
+
+/*
+ * add()
+ * Purpose: add the "n"th value "x" to "m"
+ */
+static void add(struct moments *m, double x, long n)
+{
+	double d = x - m->mean;
+
+	m->mean += d / n;
+	m->sq += d * (x - m->mean);
+}
+
+/*
+ * error()
+ * Return: the half width of the 95% confidence interval of the mean of
+ *		   the "n" values in "m"
+ */
+static double error(struct moments *m, long n)
+{
+	if (n < 2)
+		return 0;
+	return Z_95 * sqrt(m->sq / (n - 1) / n);
+}
+
+/*
+ * free_node()
+ * Purpose: release what "node" and all below it hold
+ */
+static void free_node(struct est_node *node)
+{
+	int i;
+
+	for (i = 0; i < node->nsubs; i++)
+		free_node(&node->subs[i]);
+	free(node->subs);
+	free(node->fenwick);
+	free(node->path);
+}
+
+/*
+ * next_random()
+ * Return: the next of a xorshift64* sequence, for choosing subdirectories
+ */
+static unsigned long long next_random()
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return (seed * 0x2545F4914F6CDD1DULL) >> 11;
+}
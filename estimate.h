@@ -0,0 +1,26 @@
+/*
+ * ==========================
+ *   FILE: ./estimate.h
+ * ==========================
+ * Purpose: Estimates of what a search would match, from random probes of
+ *		the tree, for --estimate, see estimate.c.
+ */
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+//what estimate() found
+struct est_result {
+	long probes;
+	long dirs;						//directories listed
+	int exact;						//YES if all were, so no error
+	double matches, matches_error;	//the error, a 95% interval's half
+	double bytes, bytes_error;
+};
+
+int estimate(char *, void (*)(char *, void *), void *, double, long,
+				struct est_result *);
+void est_match(long long);
+int est_subdir(char *, long long);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * ==========================
+ *   FILE: ./fstype.c
+ * ==========================
+ * Purpose: Tell, by device number, what kind of filesystem a file is on,
+ *		for -fstype, --skip-pseudo and --local-only, and for the link
+ *		count rule of process_dir().
+ *
+ * Outline: a filesystem type is the name the kernel gives it in
+ *		/proc/self/mountinfo ("ext4", "proc", "nfs4", ...). fs_mounts()
+ *		reads that table once, a device number and type per mount, so
+ *		that crossing into a mounted filesystem costs a table lookup and
+ *		nothing is opened on it. A device not in the table (a btrfs
+ *		subvolume, or no /proc at all) is asked with statfs(), and its
+ *		magic number named from MAGICS. Either way the answer is kept in
+ *		a small per-thread cache by device, so that the same few devices
+ *		are looked up without a lock.
+ *
+ *		fs_class() sorts types into local, pseudo (PSEUDO_FS, the kernel's
+ *		own views, whose trees are large, useless to a search, and slow
+ *		or blocking to read) and remote (REMOTE_FS, including the FUSE
+ *		filesystems known to be network ones).
+ *
+ * Link counts: on the classic Unix filesystems a directory has 2 links
+ *		plus one per subdirectory (its ".." entry), which tells a search
+ *		when it has seen every subdirectory and the rest are leaves.
+ *		Others break the rule: btrfs counts 1, overlayfs and network and
+ *		FUSE filesystems count whatever their source does. So
+ *		fs_nlink_counts() trusts only the types in NLINK_FS. ext4 also
+ *		sets 1 on a directory with too many subdirectories to count;
+ *		callers treat a count under 2 as unknown.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/vfs.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "fstype.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define FS_CACHE	8				//devices each thread remembers
+#define MOUNTINFO	"/proc/self/mountinfo"
+
+//types that keep directory link counts
+#define NLINK_FS	"ext2", "ext3", "ext4", "xfs", "tmpfs", "ramfs", "jfs", \
+					"reiserfs"
+
+//types the kernel makes up
+#define PSEUDO_FS	"proc", "sysfs", "devtmpfs", "devpts", "cgroup", \
+					"cgroup2", "debugfs", "tracefs", "securityfs", "pstore", \
+					"bpf", "mqueue", "configfs", "efivarfs", "nsfs", \
+					"autofs", "binfmt_misc", "fusectl", "hugetlbfs", \
+					"rpc_pipefs", "selinuxfs"
+
+//types over the network
+#define REMOTE_FS	"nfs", "nfs4", "cifs", "smb3", "smbfs", "afs", "ceph", \
+					"9p", "glusterfs", "lustre", "coda", "ncpfs", \
+					"fuse.sshfs", "fuse.rclone", "fuse.s3fs", \
+					"fuse.glusterfs"
+
+//statfs() magic numbers, for devices not in the mount table; ext2, ext3
+//and ext4 share one
+#define MAGICS	{ 0xEF53, "ext4" }, { 0x58465342, "xfs" }, \
+				{ 0x9123683E, "btrfs" }, { 0x01021994, "tmpfs" }, \
+				{ 0x858458F6, "ramfs" }, { 0x3153464A, "jfs" }, \
+				{ 0x52654973, "reiserfs" }, { 0x794C7630, "overlay" }, \
+				{ 0x73717368, "squashfs" }, { 0x4D44, "vfat" }, \
+				{ 0x9660, "iso9660" }, { 0x65735546, "fuse" }, \
+				{ 0x9FA0, "proc" }, { 0x62656572, "sysfs" }, \
+				{ 0x1CD1, "devpts" }, { 0x27E0EB, "cgroup" }, \
+				{ 0x63677270, "cgroup2" }, { 0x64626720, "debugfs" }, \
+				{ 0x74726163, "tracefs" }, { 0x73636673, "securityfs" }, \
+				{ 0x6165676C, "pstore" }, { 0xCAFE4A11, "bpf" }, \
+				{ 0x19800202, "mqueue" }, { 0x62656570, "configfs" }, \
+				{ 0xDE5E81E4, "efivarfs" }, { 0x6E736673, "nsfs" }, \
+				{ 0x0187, "autofs" }, { 0x42494E4D, "binfmt_misc" }, \
+				{ 0x958458F6, "hugetlbfs" }, { 0x6969, "nfs" }, \
+				{ 0xFF534D42, "cifs" }, { 0xFE534D42, "smb3" }
+
+//what is known of the filesystem on one device
+struct fs_info {
+	dev_t dev;
+	char *type;						//its name, or "unknown"
+	int class;						//FS_*
+	int nlink;						//YES if it keeps link counts
+};
+
+//a line of the mount table
+struct mount {
+	dev_t dev;
+	char *type;
+};
+
+static struct fs_info *lookup(char *, dev_t);
+static char *magic_type(char *, dev_t);
+static int listed(char *, char **);
+
+/* FILE-SCOPE VARIABLES */
+static struct mount *mounts;		//from fs_mounts(), read only after
+static int nmounts;
+
+static __thread struct fs_info seen[FS_CACHE];
+static __thread int nseen;			//lookups that missed, all told
+
+/*
+ *	fs_mounts()
+ *	Purpose: read the mount table, so that the type of a mounted device
+ *			 is known without asking the filesystem
+ *	 Return: 0, or -1 with errno set if it cannot be read; types are
+ *			 then found with statfs() alone
+ *	   Note: Call before any thread looks a type up. Once the table is
+ *			 read, later calls do nothing.
+ */
+int fs_mounts()
+{
+	FILE *fp;
+	char *line = NULL, *sep, type[256];
+	size_t size = 0;
+	unsigned major, minor;
+	struct mount *m;
+	int room = 0;
+
+	if (mounts)
+		return 0;
+	if ((fp = fopen(MOUNTINFO, "r")) == NULL)
+		return -1;
+
+	//"36 35 98:0 /root /mnt rw,noatime master:1 - ext4 /dev/sda1 rw"
+	while (getline(&line, &size, fp) != -1)
+	{
+		if (sscanf(line, "%*d %*d %u:%u", &major, &minor) != 2
+				|| (sep = strstr(line, " - ")) == NULL
+				|| sscanf(sep + 3, "%255s", type) != 1)
+			continue;
+		if (nmounts == room)
+		{
+			room = room ? 2 * room : 64;
+			if ((m = realloc(mounts, room * sizeof *m)) == NULL)
+				break;
+			mounts = m;
+		}
+		if ((mounts[nmounts].type = strdup(type)) == NULL)
+			break;
+		mounts[nmounts++].dev = makedev(major, minor);
+	}
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * fs_type()
+ * Return: the type of the filesystem on device "dev", which holds
+ *		   "path", or "unknown"
+ */
+char *fs_type(char *path, dev_t dev)
+{
+	return lookup(path, dev)->type;
+}
+
+/*
+ * fs_class()
+ * Return: FS_LOCAL, FS_PSEUDO or FS_REMOTE for the filesystem on device
+ *		   "dev", which holds "path"
+ */
+int fs_class(char *path, dev_t dev)
+{
+	return lookup(path, dev)->class;
+}
+
+/*
+ * fs_nlink_counts()
+ * Return: YES if the filesystem on device "dev", which holds "path",
+ *		   keeps a directory's link count at 2 + its subdirectories
+ */
+int fs_nlink_counts(char *path, dev_t dev)
+{
+	return lookup(path, dev)->nlink;
+}
+
+/*
+ * fs_free()
+ * Purpose: release the mount table; no thread may be looking types up
+ */
+void fs_free()
+{
+	while (nmounts > 0)
+		free(mounts[--nmounts].type);
+	free(mounts);
+	mounts = NULL;
+}
+
+/*
+ * lookup()
+ * Return: what is known of the filesystem on device "dev", from this
+ *		   thread's cache, or else the mount table, or else statfs() of
+ *		   "path"; a new entry takes the place of the oldest
+ */
+static struct fs_info *lookup(char *path, dev_t dev)
+{
+	static char *nlink_fs[] = { NLINK_FS, NULL };
+	static char *pseudo_fs[] = { PSEUDO_FS, NULL };
+	static char *remote_fs[] = { REMOTE_FS, NULL };
+	struct fs_info *fi;
+	int i;
+
+	for (i = 0; i < nseen && i < FS_CACHE; i++)
+		if (seen[i].dev == dev)
+			return &seen[i];
+
+	fi = &seen[nseen++ % FS_CACHE];
+	fi->dev = dev;
+	fi->type = NULL;
+	for (i = 0; i < nmounts && fi->type == NULL; i++)
+		if (mounts[i].dev == dev)
+			fi->type = mounts[i].type;
+	if (fi->type == NULL)
+		fi->type = magic_type(path, dev);
+
+	fi->class = listed(fi->type, pseudo_fs) ? FS_PSEUDO
+				: listed(fi->type, remote_fs) ? FS_REMOTE : FS_LOCAL;
+	fi->nlink = listed(fi->type, nlink_fs);
+	return fi;
+}
+
+/*
+ *	magic_type()
+ *	 Return: the type of the filesystem on device "dev", which holds
+ *			 "path", by the statfs() magic number, or "unknown"
+ *	 Method: statfs() follows a symbolic link to its target's filesystem.
+ *			 A link lstat()ed on "dev" is on its directory's filesystem
+ *			 instead, so that directory is asked; a link followed with
+ *			 -follow, its target on "dev", is asked as it is.
+ */
+static char *magic_type(char *path, dev_t dev)
+{
+	static const struct { long magic; char *type; } magics[] = { MAGICS };
+	struct statfs sf;
+	struct stat st;
+	char *dir = NULL, *slash;
+	size_t i;
+	int rv;
+
+	if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode) && st.st_dev == dev)
+	{
+		slash = strrchr(path, '/');
+		dir = slash == NULL ? strdup(".") : slash == path ? strdup("/")
+				: strndup(path, slash - path);
+		if (dir == NULL)
+			return "unknown";					//no memory
+	}
+	rv = statfs(dir ? dir : path, &sf);
+	free(dir);
+
+	if (rv == 0)
+		for (i = 0; i < sizeof magics / sizeof *magics; i++)
+			if ((long) sf.f_type == magics[i].magic)
+				return magics[i].type;
+	return "unknown";
+}
+
+/*
+ * listed()
+ * Return: YES if "type" is in the NULL-ended "list"
+ */
+static int listed(char *type, char **list)
+{
+	for (; *list; list++)
+		if (strcmp(type, *list) == 0)
+			return YES;
+	return NO;
+}
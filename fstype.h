@@ -0,0 +1,24 @@
+/*
+ * ==========================
+ *   FILE: ./fstype.h
+ * ==========================
+ * Purpose: What kind of filesystem a device holds, see fstype.c.
+ */
+
+#ifndef FSTYPE_H
+#define FSTYPE_H
+
+#include <sys/types.h>
+
+/* CONSTANTS */
+#define FS_LOCAL	0				//an ordinary local filesystem
+#define FS_PSEUDO	1				//made up by the kernel: proc, sysfs...
+#define FS_REMOTE	2				//over the network: nfs, cifs...
+
+int fs_mounts();
+char *fs_type(char *, dev_t);
+int fs_class(char *, dev_t);
+int fs_nlink_counts(char *, dev_t);
+void fs_free();
+
+#endif
@@ -0,0 +1,371 @@
+#!/bin/bash
+#
+# Differential test script for pfind.
+#
+# Builds random directory trees (odd names, unreadable directories,
+# symlink loops, fifos, sockets and device files where permitted, tar
+# archives with damaged pax headers) and
+# random -name/-type/-size/-hidden expressions, then compares:
+#
+#	1) the reference walker (./pfind with no engine options) to GNU find
+#	2) every engine listed in ENGINES to the reference walker
+#	3) the expression as one line of a --queries file, searched for in
+#	   one walk with a second random expression, to the reference walker
+#	4) the expression as the second job of a --batch run, after a job
+#	   with the second expression, to the reference walker
+#	5) --top 5 of the expression to the five largest files GNU find
+#	   prints for it, ties going to the path that sorts first
+#	6) --group-by depth of the expression to find's count at each depth
+#	7) --estimate, which on trees this small soon lists every directory
+#	   and is exact, to find's count and total size
+#	8) the expression searched for in an --index of the tree, built with
+#	   random engine options, to the reference walker
+#	9) the paths in an --updatedb database of the tree, written with
+#	   random engine options, to all find finds
+#	10) the expression searched for, with random engine options, in a
+#	   --replay of a --record trace of the tree, to the reference walker
+#	11) the expression searched for with --archives, less the members
+#	   found, to the reference walker, so that no damaged archive stops
+#	   or crashes the search
+#
+# Output is compared as sorted lines, since walk order is not part of
+# the contract. pfind matches -name with FNM_PERIOD (see Plan), so the
+# find command line excludes dot-names unless the pattern starts with '.'.
+#
+# On a mismatch the tree is copied aside and shrunk one entry at a time
+# while the mismatch persists, and the minimized tree and command lines
+# are printed as a reproducer.
+#
+# usage: ./fuzz.sh [rounds [seed]]
+#
+
+ROUNDS=${1:-50}
+SEED=${2:-$$}
+PFIND=$(cd "$(dirname "$0")" && pwd)/pfind
+WORK=${FUZZ_DIR:-/tmp/pfind-fuzz.$$}
+
+# extra engine option sets, each compared against the reference walker
+ENGINES=(
+	"--threads 4"
+	"--threads 3 --numa"
+	"--threads 3 --schedule largest"
+	"--threads 2 --schedule shallow"
+	"--inode-order always"
+	"--async 16"
+)
+QENGINES=("" "${ENGINES[@]}")			# for the --queries walk
+
+# name fragments, chosen to exercise globbing, quoting and FNM_PERIOD
+NAMES=(a b foo bar .hidden .x "x y" "sp ace" "*" "?" "[ab]" "\\" "-dash"
+	   "a.c" "b.h" "Makefile" "é" "tab	x" "..." ".a.b" "longname_$(printf 'x%.0s' {1..120})")
+PATS=("*" "a" "*.c" ".*" "?" "[ab]*" "*o*" "\\*" "[!a]*" "*x*" "..." "f?o")
+TYPES=(f d l p s b c)
+SIZES=(0 +0 -1 1 +1 -1k 2c +3c 1w)
+
+#-------------------------------------
+#    build program
+#-------------------------------------
+make -s -C "$(dirname "$0")" pfind || exit 1
+
+RANDOM=$SEED
+echo "fuzz.sh: seed $SEED, $ROUNDS rounds, work dir $WORK"
+
+#-------------------------------------
+#    helpers
+#-------------------------------------
+
+# pick a random element of the named array
+pick()
+{
+	local -n arr=$1
+	echo "${arr[RANDOM % ${#arr[@]}]}"
+}
+
+# populate directory $1 with random entries, $2 levels deep
+make_tree()
+{
+	local dir=$1 depth=$2 i n name
+
+	n=$((RANDOM % 7))
+	for ((i = 0; i < n; i++))
+	do
+		name=$(pick NAMES)$((RANDOM % 3))
+		case $((RANDOM % 10)) in
+			0|1|2)	if ((depth > 0)); then
+						mkdir "$dir/$name" 2>/dev/null && make_tree "$dir/$name" $((depth - 1))
+					fi ;;
+			3)		ln -s . "$dir/$name" 2>/dev/null ;;			# loop
+			4)		ln -s "nowhere$i" "$dir/$name" 2>/dev/null ;;	# dangling
+			5)		mkfifo "$dir/$name" 2>/dev/null ;;
+			6)		python3 -c "import socket,sys; socket.socket(socket.AF_UNIX).bind(sys.argv[1])" \
+						"$dir/$name" 2>/dev/null ;;
+			7)		mknod "$dir/$name" c 1 3 2>/dev/null ;;
+			8)		[ -e "$dir/$name.tar" ] || bad_tar "$dir/$name.tar" ;;
+			*)		[ -e "$dir/$name" ] || head -c $((RANDOM % 1100)) /dev/zero > "$dir/$name" ;;
+		esac
+	done
+
+	# occasionally make a directory unreadable
+	if ((depth < 2 && RANDOM % 8 == 0)); then
+		chmod 000 "$dir"
+	fi
+}
+
+# write a tar archive to $1 whose pax header has a "path" record of a
+# random length, often one that does not fit the record, for --archives
+bad_tar()
+{
+	python3 - "$1" $RANDOM <<'EOF'
+import random, sys
+random.seed(int(sys.argv[2]))
+def header(name, kind, size):
+	b = bytearray(512)
+	b[0:len(name)] = name.encode()
+	b[100:108] = b'0000644\0'
+	b[124:136] = b'%011o\0' % size
+	b[136:148] = b'00000000000\0'
+	b[156] = ord(kind)
+	b[257:263] = b'ustar\0'
+	b[148:156] = b' ' * 8
+	b[148:156] = b'%06o\0 ' % sum(b)
+	return bytes(b)
+value = b'member'
+length = random.choice([1, 3, 7, 8, 9, len(value) + 10, 200])
+record = b'%d path=' % length + value + random.choice([b'\n', b''])
+data = header('pax', 'x', len(record)) + record.ljust(512, b'\0')
+data += header('member', '0', 0) + bytes(1024)
+open(sys.argv[1], 'wb').write(data)
+EOF
+}
+
+# build a random expression into EXPR, and its find equivalent into FIND_EXPR
+make_expr()
+{
+	EXPR=()
+	FIND_EXPR=()
+	if ((RANDOM % 2)); then
+		EXPR+=(-name "$(pick PATS)")
+		FIND_EXPR+=("${EXPR[@]}")
+		[ "${EXPR[1]:0:1}" = . ] || FIND_EXPR+=(! -name '.*')
+	fi
+	if ((RANDOM % 3 == 0)); then
+		EXPR+=(-type "$(pick TYPES)")
+		FIND_EXPR+=("${EXPR[@]: -2}")
+	fi
+	if ((RANDOM % 4 == 0)); then
+		EXPR+=(-size "$(pick SIZES)")
+		FIND_EXPR+=("${EXPR[@]: -2}")
+	fi
+	case $((RANDOM % 6)) in
+		0)	EXPR+=(-hidden); FIND_EXPR+=(-name '.?*') ;;
+		1)	EXPR+=(-no-hidden); FIND_EXPR+=(! -path '*/.*') ;;
+	esac
+}
+
+# print what --queries finds for the expression "$@" as its first line,
+# while the same walk, with engine options QENGINE, finds OTHER as its
+# second
+queried()
+{
+	printf '%s -fprint %s\n' "${*@Q}" "$WORK/q1.out" \
+		"${OTHER[*]@Q}" "$WORK/q2.out" > "$WORK/queries"
+	"$PFIND" . --queries "$WORK/queries" $QENGINE
+	cat "$WORK/q1.out"
+}
+
+# print the answer of --batch, with engine options QENGINE, to a job with
+# the expression "$@", asked after a job with OTHER
+batched()
+{
+	printf '. %s\n' "${OTHER[*]@Q}" "${*@Q}" |
+		"$PFIND" --batch $QENGINE | awk '/^$/ { n++; next } n == 1'
+}
+
+# print the five largest files find finds for the expression "$@", as
+# pfind --top 5 does
+largest()
+{
+	find . "$@" -printf '%s %p\n' | LC_ALL=C sort -k1,1nr -k2 | head -5
+}
+
+# print "DEPTH COUNT" for what find finds for the expression "$@"
+depths()
+{
+	find . "$@" -printf '%d\n' | sort -n | uniq -c | awk '{ print $2, $1 }'
+}
+
+# print "DEPTH COUNT" from pfind --group-by depth, with engine options
+# QENGINE, for the expression "$@"
+grouped()
+{
+	"$PFIND" . "$@" --group-by depth $QENGINE | awk 'NR > 1 { print $1, $2 }'
+}
+
+# print what find finds for the expression "$@" as pfind --estimate prints
+# an exact answer
+totals()
+{
+	find . "$@" -printf '%s\n' |
+		awk '{ n++; b += $1 } END { printf "matches: %d (exact)\nbytes: %d (exact)\n", n, b }'
+}
+
+# print the estimates of pfind --estimate for the expression "$@"
+estimated()
+{
+	"$PFIND" . "$@" --estimate 0.01 | head -2
+}
+
+# print what --index finds for the expression "$@" in an index of the
+# tree built with engine options QENGINE
+indexed()
+{
+	"$PFIND" . --index-build "$WORK/index" $QENGINE &&
+		"$PFIND" . "$@" --index "$WORK/index"
+}
+
+# print what --replay, with engine options QENGINE, finds for the
+# expression "$@" in a trace of the tree recorded by a search with no
+# predicates (--record takes no engine options)
+replayed()
+{
+	"$PFIND" . --record "$WORK/trace" > /dev/null &&
+		"$PFIND" . "$@" --replay "$WORK/trace" $QENGINE
+}
+
+# print what pfind, with engine options QENGINE, finds for the expression
+# "$@" with --archives, less the archive members, and whether it crashed
+archived()
+{
+	"$PFIND" . "$@" --archives $QENGINE > "$WORK/archived"
+	local rc=$?
+	grep -v '!/' "$WORK/archived"
+	((rc < 128)) || echo "pfind died: exit $rc"
+}
+
+# print the paths of an --updatedb database of the tree, written with
+# engine options QENGINE, as locate would, but relative to the tree
+located()
+{
+	"$PFIND" "$PWD" --updatedb "$WORK/locate.db" $QENGINE || return
+	od -An -v -tu1 "$WORK/locate.db" | LC_ALL=C awk -v root="$PWD" '
+		{ for (i = 1; i <= NF; i++) b[n++] = $i }
+		function string() {
+			s = ""
+			while (b[at]) s = s sprintf("%c", b[at++])
+			at++
+			return s
+		}
+		END {
+			at = 16
+			string()									# the root
+			at += b[8] * 2^24 + b[9] * 2^16 + b[10] * 2^8 + b[11]
+			while (at < n) {
+				at += 16								# its time
+				dir = "." substr(string(), length(root) + 1)
+				while (b[at++] != 2)
+					print dir "/" string()
+			}
+		}'
+}
+
+# run "$@" inside tree $TREE, sorted stdout to file $OUT
+run_in()
+{
+	(cd "$TREE" && "$@" 2>/dev/null) | LC_ALL=C sort > "$OUT"
+}
+
+# compare command line A (reference) with B on tree $1; 0 if they agree
+agree()
+{
+	TREE=$1 OUT=$WORK/a.out run_in "${A[@]}"
+	TREE=$1 OUT=$WORK/b.out run_in "${B[@]}"
+	cmp -s "$WORK/a.out" "$WORK/b.out"
+}
+
+# shrink the tree at $1 while A and B still disagree, then report it
+minimize()
+{
+	local tree=$1 p changed=1
+
+	chmod -R u+rwx "$tree" 2>/dev/null
+	while ((changed))
+	do
+		changed=0
+		while IFS= read -r -d '' p
+		do
+			[ "$p" = "$tree" ] && continue
+			[ -e "$p" ] || [ -L "$p" ] || continue
+			mv "$p" "$WORK/held" 2>/dev/null || continue
+			if agree "$tree"; then
+				mv "$WORK/held" "$p"			# needed for the mismatch
+			else
+				rm -rf "$WORK/held"; changed=1
+			fi
+		done < <(find "$tree" -depth -print0)
+	done
+
+	echo "---- reproducer (tree kept in $tree) ----"
+	echo "reference: ${A[*]}"
+	echo "candidate: ${B[*]}"
+	[ "${B[0]}" = queried ] && echo "queries ($QENGINE):" && cat "$WORK/queries"
+	[ "${B[0]}" = batched ] && echo "first job ($QENGINE): . ${OTHER[*]@Q}"
+	[ "${B[0]}" = indexed ] && echo "index built with: $QENGINE"
+	[ "${B[0]}" = located ] && echo "database written with: $QENGINE"
+	[ "${B[0]}" = replayed ] && echo "trace replayed with: $QENGINE"
+	[ "${B[0]}" = archived ] && echo "archives searched with: $QENGINE"
+	(cd "$tree" && find . -printf '%y %m %p\n' | LC_ALL=C sort)
+	agree "$tree"
+	diff "$WORK/a.out" "$WORK/b.out"
+}
+
+#-------------------------------------
+#    main loop
+#-------------------------------------
+mkdir -p "$WORK" || exit 1
+failures=0
+
+for ((round = 0; round < ROUNDS; round++))
+do
+	tree=$WORK/tree
+	rm -rf "$tree"; mkdir "$tree"
+	make_tree "$tree" 3
+	make_expr
+	OTHER=("${EXPR[@]}")
+	make_expr
+	QENGINE=$(pick QENGINES)
+
+	pairs=("find . ${FIND_EXPR[*]@Q}|$PFIND . ${EXPR[*]@Q}")
+	for engine in "${ENGINES[@]}"
+	do
+		pairs+=("$PFIND . ${EXPR[*]@Q}|$PFIND . ${EXPR[*]@Q} $engine")
+	done
+	pairs+=("$PFIND . ${EXPR[*]@Q}|queried ${EXPR[*]@Q}")
+	pairs+=("$PFIND . ${EXPR[*]@Q}|batched ${EXPR[*]@Q}")
+	pairs+=("largest ${FIND_EXPR[*]@Q}|$PFIND . ${EXPR[*]@Q} --top 5 $QENGINE")
+	pairs+=("depths ${FIND_EXPR[*]@Q}|grouped ${EXPR[*]@Q}")
+	pairs+=("totals ${FIND_EXPR[*]@Q}|estimated ${EXPR[*]@Q}")
+	pairs+=("$PFIND . ${EXPR[*]@Q}|indexed ${EXPR[*]@Q}")
+	pairs+=("find . -mindepth 1|located")
+	pairs+=("$PFIND . ${EXPR[*]@Q}|replayed ${EXPR[*]@Q}")
+	pairs+=("$PFIND . ${EXPR[*]@Q}|archived ${EXPR[*]@Q}")
+
+	for pair in "${pairs[@]}"
+	do
+		eval "A=(${pair%%|*})"
+		eval "B=(${pair#*|})"
+		if ! agree "$tree"; then
+			failures=$((failures + 1))
+			echo "round $round: mismatch"
+			keep=$WORK/fail.$round
+			cp -a "$tree" "$keep"
+			minimize "$keep"
+		fi
+	done
+
+	chmod -R u+rwx "$tree" 2>/dev/null
+done
+
+rm -rf "$WORK/tree" "$WORK/a.out" "$WORK/b.out" "$WORK/queries" "$WORK"/q?.out
+echo "fuzz.sh: $failures mismatches in $ROUNDS rounds"
+[ $failures -eq 0 ] && rm -rf "$WORK"
+exit $((failures > 0))
@@ -0,0 +1,494 @@
+/*
+ * ==========================
+ *   FILE: ./group.c
+ * ==========================
+ * Purpose: Totals of the matches by a key, for --group-by KEY and
+ *		--agg LIST, so that "how much, by owner" is answered by the
+ *		search itself and no listing is piped out to be stat()ed again.
+ *
+ * Outline: group_key() and group_aggs() settle, once, what a group is
+ *		and what is totalled for it:
+ *
+ *		ext		-- the name's extension, after its last '.', none for a
+ *				   name with no '.' but a leading one
+ *		owner	-- the owner's user ID, printed as the user name
+ *		depth	-- levels below the starting path, 0 for it
+ *		age		-- how long ago it was modified, in the buckets of AGES,
+ *				   from when group_start() was last called
+ *
+ *		and a column per --agg item: count, or sum, min, max or avg of
+ *		size, blocks (bytes of disk used), mtime or atime.
+ *
+ *		Each thread adds its matches to its own group_table, an open-
+ *		addressed hash table of rows, so there is no lock per match; the
+ *		only allocation is a new group. group_merge() adds one table's
+ *		rows into another at the end, and group_print() prints a table
+ *		of them, one row per group, in order of the key.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pwd.h>
+#include "group.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define ROWS_MIN	64				//first size of a table
+#define CELL_SIZE	64				//bytes of a printed cell, at most
+#define DAY			86400L
+
+#define KEY_EXT		0
+#define KEY_OWNER	1
+#define KEY_DEPTH	2
+#define KEY_AGE		3
+
+#define AGG_COUNT	0
+#define AGG_SUM		1
+#define AGG_MIN		2
+#define AGG_MAX		3
+#define AGG_AVG		4
+
+//age buckets, by seconds since modified: less than each limit
+#define AGES	{ DAY, "<1d" }, { 7 * DAY, "1d-7d" }, \
+				{ 30 * DAY, "7d-30d" }, { 365 * DAY, "30d-1y" }, \
+				{ LONG_MAX, ">1y" }
+
+static struct group_row *find(struct group_table *, char *, long long);
+static struct group_row *insert(struct group_table *, char *, long long);
+static int grow(struct group_table *);
+static void combine(struct group_row *, int, long long);
+static long long field_value(int, struct stat *);
+static int head_cell(char *, int);
+static int row_cell(char *, struct group_row *, int);
+static int by_key(const void *, const void *);
+
+/* FILE-SCOPE VARIABLES */
+static const char *key_names[] = { "ext", "owner", "depth", "age", NULL };
+static const char *agg_names[] = { "count", "sum", "min", "max", "avg", NULL };
+static const char *field_names[] = { "size", "blocks", "mtime", "atime",
+										NULL };
+static const struct { long limit; char *name; } ages[] = { AGES };
+
+static int key = KEY_EXT;			//from group_key()
+static int naggs = 1;				//from group_aggs(), or count alone
+static int agg_op[GROUP_AGGS] = { AGG_COUNT };
+static int agg_field[GROUP_AGGS];	//an index into field_names
+static time_t now;					//from group_start(), for the age
+
+/*
+ * group_key()
+ * Purpose: group by "name": ext, owner, depth or age
+ *  Return: 0, or -1 if there is no such key
+ */
+int group_key(char *name)
+{
+	int i;
+
+	for (i = 0; key_names[i]; i++)
+		if (strcmp(name, key_names[i]) == 0)
+		{
+			key = i;
+			return 0;
+		}
+	return -1;
+}
+
+/*
+ *	group_aggs()
+ *	Purpose: total "list" for each group, a comma separated list of
+ *			 "count" and "OP(FIELD)", OP one of sum, min, max and avg and
+ *			 FIELD one of size, blocks, mtime and atime
+ *	 Return: 0, or -1 if the list is not valid; without a call a group
+ *			 has its count alone
+ */
+int group_aggs(char *list)
+{
+	char op[8], field[8];
+	int len, i, j;
+
+	for (naggs = 0; *list; naggs++)
+	{
+		len = 0;
+		if (naggs == GROUP_AGGS
+				|| sscanf(list, "%7[a-z]%n", op, &len) != 1)
+			return -1;
+		list += len;
+		field[0] = '\0';
+		if (*list == '(')
+		{
+			len = 0;
+			if (sscanf(list, "(%7[a-z])%n", field, &len) != 1 || len == 0)
+				return -1;
+			list += len;
+		}
+
+		for (i = 0; agg_names[i] && strcmp(op, agg_names[i]) != 0; i++)
+			;
+		for (j = 0; field_names[j] && strcmp(field, field_names[j]) != 0;
+				j++)
+			;
+		if (agg_names[i] == NULL || (i == AGG_COUNT) != (field[0] == '\0')
+				|| (i != AGG_COUNT && field_names[j] == NULL))
+			return -1;
+		agg_op[naggs] = i;
+		agg_field[naggs] = j;
+
+		if (*list == ',' && list[1] != '\0')
+			list++;
+		else if (*list != '\0')
+			return -1;
+	}
+	return naggs > 0 ? 0 : -1;
+}
+
+/*
+ * group_needs_stat()
+ * Return: YES if grouping needs more of a match than its name, depth and
+ *		   type: a key of owner or age, or a column other than count
+ */
+int group_needs_stat()
+{
+	int i;
+
+	if (key == KEY_OWNER || key == KEY_AGE)
+		return YES;
+	for (i = 0; i < naggs; i++)
+		if (agg_op[i] != AGG_COUNT)
+			return YES;
+	return NO;
+}
+
+/*
+ * group_start()
+ * Purpose: take the time the ages of the next search are counted from
+ */
+void group_start()
+{
+	now = time(NULL);
+}
+
+/*
+ *	group_add()
+ *	Purpose: add a match to its group in table "t"
+ *	  Input: name, its last component, for the extension
+ *			 depth, its levels below the starting path
+ *			 info, its stat
+ *	 Return: 0, or -1 with errno set if there is no memory for a new
+ *			 group; the match is then left out
+ */
+int group_add(struct group_table *t, char *name, int depth,
+				struct stat *info)
+{
+	struct group_row *row;
+	char *ext = NULL;
+	long long k = 0;
+	int i;
+
+	if (key == KEY_EXT)
+	{
+		ext = strrchr(name, '.');
+		ext = ext && ext != name ? ext + 1 : "";
+	}
+	else if (key == KEY_OWNER)
+		k = info->st_uid;
+	else if (key == KEY_DEPTH)
+		k = depth;
+	else
+		for (; ages[k].limit != LONG_MAX
+				&& now - info->st_mtime >= ages[k].limit; k++)
+			;
+
+	if ((row = insert(t, ext, k)) == NULL)
+		return -1;
+	row->count++;
+	for (i = 0; i < naggs; i++)
+		if (agg_op[i] != AGG_COUNT)
+			combine(row, i, field_value(agg_field[i], info));
+	return 0;
+}
+
+/*
+ *	group_merge()
+ *	Purpose: add the groups of "from" into "into", and empty "from"
+ *	 Return: 0, or -1 with errno set if there is no memory; the groups
+ *			 that could not be added are left out
+ */
+int group_merge(struct group_table *into, struct group_table *from)
+{
+	struct group_row *row, *r;
+	int i, j, rv = 0;
+
+	for (i = 0; i < from->size; i++)
+	{
+		r = &from->rows[i];
+		if (! r->used)
+			continue;
+		if ((row = insert(into, r->ext, r->key)) == NULL)
+			rv = -1;
+		else
+		{
+			row->count += r->count;
+			for (j = 0; j < naggs; j++)
+				if (agg_op[j] != AGG_COUNT)
+					combine(row, j, r->value[j]);
+		}
+		free(r->ext);
+		r->ext = NULL;
+		r->used = NO;
+	}
+	from->count = 0;
+	return rv;
+}
+
+/*
+ *	group_print()
+ *	Purpose: print table "t" to "fp": a header, then a row per group in
+ *			 order of the key, columns lined up
+ *	 Return: 0, or -1 with errno set if there is no memory to sort it
+ *	 Method: Each cell is formatted twice, once to size its column and
+ *			 once to print it, rather than kept.
+ */
+int group_print(FILE *fp, struct group_table *t)
+{
+	struct group_row **rows;
+	char cell[CELL_SIZE];
+	int width[GROUP_AGGS + 1];
+	int n = 0, i, j;
+
+	if ((rows = malloc((t->count + 1) * sizeof *rows)) == NULL)
+		return -1;
+	for (i = 0; i < t->size; i++)
+		if (t->rows[i].used)
+			rows[n++] = &t->rows[i];
+	qsort(rows, n, sizeof *rows, by_key);
+
+	//the widest cell of each column, the header's included
+	for (j = 0; j <= naggs; j++)
+	{
+		width[j] = head_cell(cell, j);
+		for (i = 0; i < n; i++)
+			if (row_cell(cell, rows[i], j) > width[j])
+				width[j] = strlen(cell);
+	}
+
+	for (i = -1; i < n; i++)					//-1, the header
+	{
+		for (j = 0; j <= naggs; j++)
+		{
+			if (i == -1)
+				head_cell(cell, j);
+			else
+				row_cell(cell, rows[i], j);
+			if (j == 0)
+				fprintf(fp, "%-*s", width[j], cell);
+			else
+				fprintf(fp, "  %*s", width[j], cell);
+		}
+		putc('\n', fp);
+	}
+
+	free(rows);
+	return 0;
+}
+
+/*
+ * group_free()
+ * Purpose: release what "t" holds, leaving it empty
+ */
+void group_free(struct group_table *t)
+{
+	int i;
+
+	for (i = 0; i < t->size; i++)
+		free(t->rows[i].ext);
+	free(t->rows);
+	memset(t, 0, sizeof *t);
+}
+
+/*
+ * find()
+ * Return: the row of "t" for the group "ext" or "key", or else the free
+ *		   slot where it would go; "t" must have a free slot
+ */
+static struct group_row *find(struct group_table *t, char *ext,
+								long long k)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	struct group_row *row;
+	int i;
+
+	if (ext)
+		for (i = 0; ext[i]; i++)
+			h = (h ^ (unsigned char) ext[i]) * 1099511628211ULL;
+	else
+		h = (unsigned long long) k * 0x9E3779B97F4A7C15ULL;
+	h ^= h >> 29;
+
+	for (i = h & (t->size - 1); ; i = (i + 1) & (t->size - 1))
+	{
+		row = &t->rows[i];
+		if (! row->used || (ext ? strcmp(row->ext, ext) == 0 : row->key == k))
+			return row;
+	}
+}
+
+/*
+ * insert()
+ * Return: the row of "t" for the group "ext" or "key", a new one with no
+ *		   totals if there was none, or NULL with errno set if there is no
+ *		   memory for it
+ */
+static struct group_row *insert(struct group_table *t, char *ext,
+									long long k)
+{
+	struct group_row *row;
+	int i;
+
+	if (t->size == 0 && grow(t) == -1)
+		return NULL;
+	row = find(t, ext, k);
+	if (row->used)
+		return row;									//the usual case
+
+	if (4 * (t->count + 1) > 3 * t->size)
+	{
+		if (grow(t) == -1)
+			return NULL;
+		row = find(t, ext, k);
+	}
+	if (ext && (row->ext = strdup(ext)) == NULL)
+		return NULL;
+	row->used = YES;
+	row->key = k;
+	row->count = 0;
+	for (i = 0; i < naggs; i++)
+		row->value[i] = agg_op[i] == AGG_MIN ? LLONG_MAX
+						: agg_op[i] == AGG_MAX ? LLONG_MIN : 0;
+	t->count++;
+	return row;
+}
+
+/*
+ * grow()
+ * Purpose: double the slots of "t", or give it its first ROWS_MIN
+ *  Return: 0, or -1 with errno set if there is no memory
+ */
+static int grow(struct group_table *t)
+{
+	struct group_table bigger = { t->size ? 2 * t->size : ROWS_MIN,
+									t->count, NULL };
+	int i;
+
+	if ((bigger.rows = calloc(bigger.size, sizeof *bigger.rows)) == NULL)
+		return -1;
+	for (i = 0; i < t->size; i++)
+		if (t->rows[i].used)
+			*find(&bigger, t->rows[i].ext, t->rows[i].key) = t->rows[i];
+	free(t->rows);
+	*t = bigger;
+	return 0;
+}
+
+/*
+ * combine()
+ * Purpose: add "value" into column "i" of "row", by the column's OP
+ */
+static void combine(struct group_row *row, int i, long long value)
+{
+	if (agg_op[i] == AGG_MIN)
+	{
+		if (value < row->value[i])
+			row->value[i] = value;
+	}
+	else if (agg_op[i] == AGG_MAX)
+	{
+		if (value > row->value[i])
+			row->value[i] = value;
+	}
+	else
+		row->value[i] += value;				//sum, or avg's sum
+}
+
+/*
+ * field_value()
+ * Return: field "f" of stat "info": bytes, or seconds since the epoch
+ */
+static long long field_value(int f, struct stat *info)
+{
+	if (f == 0)
+		return info->st_size;
+	if (f == 1)
+		return (long long) info->st_blocks * 512;
+	return f == 2 ? info->st_mtime : info->st_atime;
+}
+
+/*
+ * head_cell()
+ * Purpose: print the title of column "j" into "cell": the key's name for
+ *			0, and the --agg item for the rest
+ *  Return: its length
+ */
+static int head_cell(char *cell, int j)
+{
+	if (j == 0)
+		snprintf(cell, CELL_SIZE, "%s", key_names[key]);
+	else if (agg_op[j - 1] == AGG_COUNT)
+		snprintf(cell, CELL_SIZE, "count");
+	else
+		snprintf(cell, CELL_SIZE, "%s(%s)", agg_names[agg_op[j - 1]],
+					field_names[agg_field[j - 1]]);
+	return strlen(cell);
+}
+
+/*
+ *	row_cell()
+ *	Purpose: print column "j" of "row" into "cell": its key for 0, and an
+ *			 --agg total for the rest, a number or a time as the local date
+ *			 and time
+ *	 Return: its length
+ */
+static int row_cell(char *cell, struct group_row *row, int j)
+{
+	struct passwd *pw;
+	long long value;
+	struct tm tm;
+	time_t t;
+	int i = j - 1;
+
+	if (j == 0)
+	{
+		if (key == KEY_EXT)
+			snprintf(cell, CELL_SIZE, "%s", row->ext[0] ? row->ext : "-");
+		else if (key == KEY_OWNER && (pw = getpwuid(row->key)) != NULL)
+			snprintf(cell, CELL_SIZE, "%s", pw->pw_name);
+		else if (key == KEY_AGE)
+			snprintf(cell, CELL_SIZE, "%s", ages[row->key].name);
+		else
+			snprintf(cell, CELL_SIZE, "%lld", row->key);
+		return strlen(cell);
+	}
+
+	value = agg_op[i] == AGG_COUNT ? row->count : row->value[i];
+	if (agg_op[i] == AGG_AVG)
+		value /= row->count;
+	t = value;
+	if (agg_op[i] == AGG_COUNT || agg_field[i] < 2
+			|| localtime_r(&t, &tm) == NULL
+			|| strftime(cell, CELL_SIZE, "%Y-%m-%d %H:%M", &tm) == 0)
+		snprintf(cell, CELL_SIZE, "%lld", value);
+	return strlen(cell);
+}
+
+//for qsort(): rows by key, extensions as strings and the rest as numbers
+static int by_key(const void *a, const void *b)
+{
+	const struct group_row *x = *(struct group_row **) a;
+	const struct group_row *y = *(struct group_row **) b;
+
+	if (key == KEY_EXT)
+		return strcmp(x->ext, y->ext);
+	return (x->key > y->key) - (x->key < y->key);
+}
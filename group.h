@@ -0,0 +1,42 @@
+/*
+ * ==========================
+ *   FILE: ./group.h
+ * ==========================
+ * Purpose: Totals of the matches by a key, for --group-by, see group.c.
+ */
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* CONSTANTS */
+#define GROUP_AGGS	8				//--agg columns, at most
+
+//the totals of one group
+struct group_row {
+	int used;						//NO for a free slot
+	char *ext;						//the key, by --group-by ext
+	long long key;					//the key, by any other
+	long long count;
+	long long value[GROUP_AGGS];	//a sum, min or max per --agg column
+};
+
+//the groups seen so far, an open-addressed hash table
+struct group_table {
+	int size;						//slots, a power of 2, 0 until the first
+	int count;						//used
+	struct group_row *rows;
+};
+
+int group_key(char *);
+int group_aggs(char *);
+int group_needs_stat();
+void group_start();
+int group_add(struct group_table *, char *, int, struct stat *);
+int group_merge(struct group_table *, struct group_table *);
+int group_print(FILE *, struct group_table *);
+void group_free(struct group_table *);
+
+#endif
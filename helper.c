@@ -0,0 +1,176 @@
+/*
+ * ==========================
+ *   FILE: ./helper.c
+ * ==========================
+ * Purpose: Blocking calls made on behalf of a driver thread, so that the
+ *		driver can keep many of them outstanding at once without blocking.
+ *
+ * Outline: the driver hands a struct job to helper_submit() and carries
+ *		on; a helper thread calls job->run() and puts the job on the done
+ *		queue, where helper_wait() gives it back to the driver. Jobs may
+ *		finish in any order. Nothing here knows what the calls are; the
+ *		job is the first member of the caller's own struct, which holds
+ *		the arguments and results.
+ *
+ *		The helpers only ever block in the calls themselves, so they get
+ *		small stacks (HELPER_STACK), and a few hundred cost little more
+ *		than their stacks. Both queues are FIFO lists under one mutex.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "helper.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define HELPER_STACK	(128 * 1024)
+
+//a FIFO list of jobs
+struct queue {
+	struct job *head, *tail;
+};
+
+static void *helper_main(void *);
+static void put(struct queue *, struct job *);
+static struct job *take(struct queue *);
+
+/* FILE-SCOPE VARIABLES */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t todo_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct queue todo, done;
+static int stopping;
+static pthread_t *helpers;
+static int nhelpers;
+static void (*finish)(void);			//run by each helper as it exits
+
+/*
+ *	helper_start()
+ *	Purpose: start "n" helper threads
+ *	  Input: n, the number of helpers, and so of calls made at once
+ *			 at_exit, called on each helper before it exits, or NULL
+ *	 Return: 0, or -1 with errno set if not even one could be started;
+ *			 if some could, the pool runs with those
+ */
+int helper_start(int n, void (*at_exit)(void))
+{
+	pthread_attr_t attr;
+
+	if ((helpers = calloc(n, sizeof *helpers)) == NULL)
+		return -1;
+	finish = at_exit;
+	stopping = NO;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, HELPER_STACK);
+	for (nhelpers = 0; nhelpers < n; nhelpers++)
+		if ((errno = pthread_create(&helpers[nhelpers], &attr, helper_main,
+									NULL)) != 0)
+			break;
+	pthread_attr_destroy(&attr);
+
+	if (nhelpers == 0)
+	{
+		free(helpers);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * helper_submit()
+ * Purpose: queue "job" for the next free helper
+ */
+void helper_submit(struct job *job)
+{
+	pthread_mutex_lock(&lock);
+	put(&todo, job);
+	pthread_cond_signal(&todo_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * helper_wait()
+ * Purpose: wait for a submitted job to finish
+ *  Return: the job; the caller must know that one is outstanding
+ */
+struct job *helper_wait()
+{
+	struct job *job;
+
+	pthread_mutex_lock(&lock);
+	while ((job = take(&done)) == NULL)
+		pthread_cond_wait(&done_cond, &lock);
+	pthread_mutex_unlock(&lock);
+	return job;
+}
+
+/*
+ * helper_stop()
+ * Purpose: let the helpers exit, once the queued jobs are done, and
+ *			wait for them
+ */
+void helper_stop()
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	stopping = YES;
+	pthread_cond_broadcast(&todo_cond);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < nhelpers; i++)
+		pthread_join(helpers[i], NULL);
+	free(helpers);
+	helpers = NULL;
+	nhelpers = 0;
+}
+
+static void *helper_main(void *arg)
+{
+	struct job *job;
+
+	(void) arg;
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		if ((job = take(&todo)) != NULL)
+		{
+			pthread_mutex_unlock(&lock);
+			job->run(job);
+			pthread_mutex_lock(&lock);
+			put(&done, job);
+			pthread_cond_signal(&done_cond);
+		}
+		else if (stopping)
+			break;
+		else
+			pthread_cond_wait(&todo_cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (finish)
+		finish();
+	return NULL;
+}
+
+static void put(struct queue *q, struct job *job)
+{
+	job->next = NULL;
+	if (q->tail)
+		q->tail->next = job;
+	else
+		q->head = job;
+	q->tail = job;
+}
+
+static struct job *take(struct queue *q)
+{
+	struct job *job = q->head;
+
+	if (job && (q->head = job->next) == NULL)
+		q->tail = NULL;
+	return job;
+}
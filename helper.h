@@ -0,0 +1,23 @@
+/*
+ * ==========================
+ *   FILE: ./helper.h
+ * ==========================
+ * Purpose: A pool of threads that run blocking calls for one driver
+ *		thread, see helper.c.
+ */
+
+#ifndef HELPER_H
+#define HELPER_H
+
+//a blocking call to make; embedded first in the caller's own struct
+struct job {
+	void (*run)(struct job *);		//called on a helper thread
+	struct job *next;				//on a queue
+};
+
+int helper_start(int, void (*)(void));
+void helper_submit(struct job *);
+struct job *helper_wait();
+void helper_stop();
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * ==========================
+ *   FILE: ./hugemem.c
+ * ==========================
+ * Purpose: Allocate the big, long-lived areas of a search -- the visited
+ *		set and the workers' output buffers -- on huge pages, so that
+ *		walking them does not miss in the TLB at every other step.
+ *
+ * Outline: huge_alloc() maps zeroed memory directly. With --hugepages
+ *		(huge_mode(YES)), an area of at least HUGE_MIN bytes is rounded
+ *		up to whole huge pages and taken from the explicit pool
+ *		(MAP_HUGETLB, see /proc/sys/vm/nr_hugepages) if it has room.
+ *		Otherwise it falls back to normal pages aligned to a huge page
+ *		and marked MADV_HUGEPAGE, for the kernel to back with transparent
+ *		huge pages where it can. Without --hugepages, or for small areas,
+ *		areas are plain page-rounded mappings.
+ *
+ *		huge_free() must be given the size that was asked for; the mode
+ *		is set once, before the first allocation, so it can work out the
+ *		length that was mapped.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "hugemem.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define HUGE_MIN	(HUGE_PAGE / 32)		//smaller areas use normal pages
+
+static size_t mapped_length(size_t);
+static void *map_aligned(size_t);
+
+/* FILE-SCOPE VARIABLES */
+static int enabled = NO;
+static struct huge_stats stats;
+
+/*
+ * huge_mode()
+ * Purpose: turn huge pages on (YES) or off (NO), before any allocation
+ */
+void huge_mode(int on)
+{
+	enabled = on;
+}
+
+/*
+ * huge_enabled()
+ * Return: YES if --hugepages is in effect
+ */
+int huge_enabled()
+{
+	return enabled;
+}
+
+/*
+ *	huge_alloc()
+ *	Purpose: map "size" zeroed bytes, on huge pages if enabled
+ *	 Return: the area, page aligned, or NULL if it cannot be mapped
+ */
+void *huge_alloc(size_t size)
+{
+	size_t len = mapped_length(size);
+	void *p;
+
+	if (enabled && size >= HUGE_MIN)
+	{
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			__atomic_add_fetch(&stats.explicit, len, __ATOMIC_RELAXED);
+			return p;
+		}
+
+		//no explicit huge pages free: ask for transparent ones
+		if ((p = map_aligned(len)) == NULL)
+			return NULL;
+		madvise(p, len, MADV_HUGEPAGE);
+		__atomic_add_fetch(&stats.advised, len, __ATOMIC_RELAXED);
+		return p;
+	}
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	__atomic_add_fetch(&stats.normal, len, __ATOMIC_RELAXED);
+	return p;
+}
+
+/*
+ * huge_free()
+ * Purpose: unmap an area from huge_alloc() of "size" bytes
+ */
+void huge_free(void *p, size_t size)
+{
+	if (p != NULL)
+		munmap(p, mapped_length(size));
+}
+
+/*
+ * huge_stats()
+ * Purpose: copy out how many bytes were mapped of each kind
+ */
+void huge_stats(struct huge_stats *out)
+{
+	*out = stats;
+}
+
+/*
+ * mapped_length()
+ * Return: the length huge_alloc() maps for "size": whole huge pages if
+ *		   the area goes on them, else whole normal pages
+ */
+static size_t mapped_length(size_t size)
+{
+	size_t unit = enabled && size >= HUGE_MIN ? HUGE_PAGE
+				  : (size_t) sysconf(_SC_PAGESIZE);
+
+	return (size + unit - 1) / unit * unit;
+}
+
+/*
+ * map_aligned()
+ * Purpose: map "len" bytes of normal pages starting on a huge page
+ *			boundary, so that every huge page of the area can be backed
+ *			transparently; the slack around it is unmapped again
+ *  Return: the area, or NULL
+ */
+static void *map_aligned(size_t len)
+{
+	char *p = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	char *start;
+
+	if (p == MAP_FAILED)
+		return NULL;
+
+	start = (char *) (((uintptr_t) p + HUGE_PAGE - 1)
+					  & ~(uintptr_t) (HUGE_PAGE - 1));
+	if (start > p)
+		munmap(p, start - p);
+	munmap(start + len, p + HUGE_PAGE - start);
+	return start;
+}
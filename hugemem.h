@@ -0,0 +1,29 @@
+/*
+ * ==========================
+ *   FILE: ./hugemem.h
+ * ==========================
+ * Purpose: Large allocations, on huge pages when asked, see hugemem.c.
+ */
+
+#ifndef HUGEMEM_H
+#define HUGEMEM_H
+
+#include <stddef.h>
+
+/* CONSTANTS */
+#define HUGE_PAGE	(2 * 1024 * 1024)
+
+//bytes mapped so far, by the kind of page they got
+struct huge_stats {
+	long long explicit;				//MAP_HUGETLB pages
+	long long advised;				//normal pages, MADV_HUGEPAGE given
+	long long normal;				//huge pages off, or too small
+};
+
+void huge_mode(int);
+int huge_enabled();
+void *huge_alloc(size_t);
+void huge_free(void *, size_t);
+void huge_stats(struct huge_stats *);
+
+#endif
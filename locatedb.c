@@ -0,0 +1,594 @@
+/*
+ * ==========================
+ *   FILE: ./locatedb.c
+ * ==========================
+ * Purpose: Write the database locate searches, in the mlocate format, from
+ *		a search instead of a separate updatedb walk, and list again only
+ *		the directories that changed since the last one, for --updatedb.
+ *
+ * Outline: --updatedb FILE searches the tree with no predicates, and each
+ *		thread ldb_add()s what it would print to its own ldb_list; the
+ *		lists are merged, and ldb_write() sorts the entries by directory
+ *		and writes them to a new file that then replaces FILE.
+ *
+ *		The previous FILE, if there is one, is read by ldb_open() first.
+ *		A directory's entries change only with its mtime, and its ctime
+ *		goes with any change to it at all, so when a directory's newer of
+ *		the two is what the previous database has for it, ldb_reuse()
+ *		hands back the entries from there instead of the walk reading it
+ *		(the directory trick of mlocate's updatedb). Its subdirectories
+ *		are still stat()ed, and searched or reused in turn.
+ *
+ *		A directory changed while the search runs may have been read
+ *		before the change, so one whose time is not before the start of
+ *		the search is written with a time of 0, which is never reused;
+ *		so is one with no entries, which may have been unreadable or on
+ *		a filesystem left out, and costs nothing to read again.
+ *
+ * Format: as mlocate.db(5), integers big endian,
+ *
+ *		header						 "\0mlocate", the size of the
+ *									 configuration block (4 bytes),
+ *									 version 0, require visibility 1, 2
+ *									 bytes padding, the root path
+ *		configuration block			 empty; one that is not, updatedb's,
+ *									 is not reused from, as what it pruned
+ *									 is not known
+ *		directories					 each its time (8 bytes seconds, 4
+ *									 nanoseconds, 4 padding), path, then
+ *									 each entry as a type (0 a file, 1 a
+ *									 subdirectory) and name, then a 2
+ *
+ *		Directories are in the order of mlocate's walk, by path with '/'
+ *		before any other byte, so that each comes before those below it,
+ *		and the entries of each in the order of their names. plocate's
+ *		plocate-build reads this format too.
+ *
+ * Memory: an ldb_list keeps each path in chunks of CHUNK_SIZE, as nameidx.c
+ *		does, so there is no allocation per entry. The previous database
+ *		is mapped, and its directories pointed into.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "locatedb.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define MAGIC		"\0mlocate"			//8 bytes, no NUL after
+#define MAGIC_LEN	8
+#define HEADER_LEN	16					//to the root path
+#define DIR_LEN		16					//to a directory's path
+#define ENTRY_FILE	0					//entry types
+#define ENTRY_DIR	1
+#define ENTRY_END	2					//of a directory's entries
+#define CHUNK_SIZE	(1 << 20)			//bytes of paths per chunk
+#define LIST_MIN	1024				//first room of an ldb_list
+#define DIRS_MIN	1024				//first room of the old directories
+#define DB_MODE		0644				//of a new database
+
+//an entry of the tree, as the search found it
+struct ldb_entry {
+	char *path;
+	size_t parent;						//length of its directory's path
+	int dir;							//YES for a directory
+	long long sec;						//its time, if one, see dir_time()
+	long nsec;
+};
+
+//a chunk of an ldb_list's paths
+struct ldb_chunk {
+	struct ldb_chunk *next;
+	size_t used, size;
+	char data[];
+};
+
+//a directory of the previous database, pointing into its mapping
+struct old_dir {
+	char *path;
+	long long sec;
+	long nsec;
+	char *entries;						//each a type and a name, to ENTRY_END
+};
+
+static void dir_time(struct stat *, long long *, long *);
+static int read_old(size_t);
+static char *old_string(size_t *);
+static unsigned long long get_be(unsigned char *, int);
+static void put_be(FILE *, unsigned long long, int);
+static void put_dir(FILE *, struct ldb_entry *, size_t);
+static int dir_cmp(char *, size_t, char *, size_t);
+static int by_place(const void *, const void *);
+static int by_dir(const void *, const void *);
+static int by_old(const void *, const void *);
+
+/* FILE-SCOPE VARIABLES */
+static char *db_file;					//the database to write
+static char *db_root;					//of its tree, no '/' at the end
+static long long root_sec;				//its time
+static long root_nsec;
+static time_t scan_start;				//of the search, for dir_time()
+static mode_t db_mode = DB_MODE;		//the previous database's, if any
+static unsigned char *old_map;			//the previous database, mapped
+static size_t old_size;
+static struct old_dir *old_dirs;		//its directories, by dir_cmp()
+static size_t nold;
+
+/*
+ *	ldb_open()
+ *	Purpose: start a database "file" of the tree at "root", of stat
+ *			 "info", and read the one "file" holds now, if any, for
+ *			 ldb_reuse()
+ *	 Return: 0, or -1 with errno set: EINVAL if "file" is there but is
+ *			 not a locate database, or is damaged
+ *	   Note: A database of another root, or with a configuration block,
+ *			 is replaced but not reused from.
+ */
+int ldb_open(char *file, char *root, struct stat *info)
+{
+	struct stat st;
+	size_t len;
+	int fd;
+
+	db_file = file;
+	if ((db_root = strdup(root)) == NULL)
+		return -1;
+	for (len = strlen(db_root); len > 1 && db_root[len - 1] == '/'; len--)
+		db_root[len - 1] = '\0';
+	scan_start = time(NULL);
+	dir_time(info, &root_sec, &root_nsec);
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : -1;		//a first database
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	db_mode = st.st_mode & 07777;
+	old_size = st.st_size;
+	if (old_size < HEADER_LEN)
+		old_map = MAP_FAILED, errno = EINVAL;
+	else
+		old_map = mmap(NULL, old_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (old_map == MAP_FAILED)
+	{
+		old_map = NULL;
+		return -1;
+	}
+	if (read_old(old_size) == -1)
+	{
+		len = errno;
+		ldb_close();
+		errno = len;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	ldb_reuse()
+ *	Purpose: if the directory "path", of stat "info", is as the previous
+ *			 database has it, call visit(name, subdir, arg) for each of
+ *			 its entries there, "subdir" YES for a subdirectory
+ *	 Return: YES if it was, and its entries visited, else NO
+ */
+int ldb_reuse(char *path, struct stat *info, ldb_visit visit, void *arg)
+{
+	struct old_dir key, *d;
+	char *p;
+
+	if (nold == 0)
+		return NO;
+	dir_time(info, &key.sec, &key.nsec);
+	key.path = path;
+	if ((key.sec == 0 && key.nsec == 0)
+			|| (d = bsearch(&key, old_dirs, nold, sizeof *d, by_old)) == NULL
+			|| d->sec != key.sec || d->nsec != key.nsec)
+		return NO;
+
+	for (p = d->entries; *p != ENTRY_END; p += strlen(p + 1) + 2)
+		visit(p + 1, *p == ENTRY_DIR, arg);
+	return YES;
+}
+
+/*
+ *	ldb_add()
+ *	Purpose: add the entry "path", of stat "info", to list "l"; only the
+ *			 type of a file is needed, and the times of a directory
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+int ldb_add(struct ldb_list *l, char *path, struct stat *info)
+{
+	size_t need = strlen(path) + 1, room;
+	struct ldb_chunk *c = l->chunks;
+	struct ldb_entry *entries, *e;
+	char *slash;
+
+	if (c == NULL || c->size - c->used < need)
+	{
+		room = need > CHUNK_SIZE ? need : CHUNK_SIZE;
+		if ((c = malloc(sizeof *c + room)) == NULL)
+			return -1;
+		c->next = l->chunks;
+		c->used = 0;
+		c->size = room;
+		l->chunks = c;
+	}
+	if (l->count == l->room)
+	{
+		room = l->room ? 2 * l->room : LIST_MIN;
+		if ((entries = realloc(l->entries, room * sizeof *entries)) == NULL)
+			return -1;
+		l->entries = entries;
+		l->room = room;
+	}
+
+	e = &l->entries[l->count++];
+	e->path = memcpy(c->data + c->used, path, need);
+	c->used += need;
+	slash = strrchr(e->path, '/');
+	e->parent = slash == NULL ? 0 : slash == e->path ? 1 : slash - e->path;
+	e->dir = S_ISDIR(info->st_mode);
+	e->sec = e->nsec = 0;
+	if (e->dir)
+		dir_time(info, &e->sec, &e->nsec);
+	return 0;
+}
+
+/*
+ *	ldb_merge()
+ *	Purpose: move the entries of "from" to "into", leaving "from" empty
+ *	 Return: 0, or -1 with errno set if there is no memory; "from" is
+ *			 then left as it was
+ */
+int ldb_merge(struct ldb_list *into, struct ldb_list *from)
+{
+	struct ldb_chunk *c;
+	struct ldb_entry *entries;
+	size_t room = into->room;
+
+	while (room < into->count + from->count)
+		room = room ? 2 * room : LIST_MIN;
+	if (room > into->room)
+	{
+		if ((entries = realloc(into->entries, room * sizeof *entries))
+				== NULL)
+			return -1;
+		into->entries = entries;
+		into->room = room;
+	}
+	if (from->count > 0)
+		memcpy(into->entries + into->count, from->entries,
+				from->count * sizeof *from->entries);
+	into->count += from->count;
+
+	for (c = from->chunks; c && c->next; c = c->next)
+		;
+	if (c)
+	{
+		c->next = into->chunks;
+		into->chunks = from->chunks;
+	}
+	free(from->entries);
+	memset(from, 0, sizeof *from);
+	return 0;
+}
+
+/*
+ *	ldb_write()
+ *	Purpose: write the entries of "l" as the database ldb_open() started,
+ *			 replacing the file
+ *	 Return: 0, or -1 with errno set if it cannot be written or there is
+ *			 no memory; the file is then left as it was
+ *	 Method: The entries are sorted by directory, then name, and the
+ *			 directories, the root first, by path, the same order; each
+ *			 directory is written with the run of entries that are in it.
+ *			 The database is written to a temporary file in the same
+ *			 directory, with the previous one's mode, and renamed over
+ *			 the file, so that locate never sees half of it.
+ */
+int ldb_write(struct ldb_list *l)
+{
+	struct ldb_entry root, **dirs;
+	size_t ndirs = 0, i, j, n;
+	char *tmp;
+	FILE *fp = NULL;
+	int fd, rv = -1;
+
+	if ((dirs = malloc((l->count + 1) * sizeof *dirs)) == NULL)
+		return -1;
+	if ((tmp = malloc(strlen(db_file) + 8)) == NULL)
+	{
+		free(dirs);
+		return -1;
+	}
+	memset(&root, 0, sizeof root);
+	root.path = db_root;
+	root.dir = YES;
+	root.sec = root_sec;
+	root.nsec = root_nsec;
+	dirs[ndirs++] = &root;
+	if (l->count > 0)
+		qsort(l->entries, l->count, sizeof *l->entries, by_place);
+	for (i = 0; i < l->count; i++)
+		if (l->entries[i].dir)
+			dirs[ndirs++] = &l->entries[i];
+	qsort(dirs, ndirs, sizeof *dirs, by_dir);
+
+	sprintf(tmp, "%s.XXXXXX", db_file);
+	if ((fd = mkstemp(tmp)) == -1)
+		goto out;
+	if (fchmod(fd, db_mode) == -1 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		close(fd);
+		goto fail;
+	}
+
+	fwrite(MAGIC, 1, MAGIC_LEN, fp);
+	put_be(fp, 0, 4);							//configuration block size
+	put_be(fp, 0, 1);							//version
+	put_be(fp, 1, 1);							//require visibility
+	put_be(fp, 0, 2);
+	fwrite(db_root, 1, strlen(db_root) + 1, fp);
+
+	for (i = j = 0; i < ndirs; i++)
+	{
+		//skip any entries of directories not written, then take its own
+		while (j < l->count && dir_cmp(l->entries[j].path,
+						l->entries[j].parent, dirs[i]->path,
+						strlen(dirs[i]->path)) < 0)
+			j++;
+		for (n = 0; j + n < l->count && dir_cmp(l->entries[j + n].path,
+						l->entries[j + n].parent, dirs[i]->path,
+						strlen(dirs[i]->path)) == 0; n++)
+			;
+		put_dir(fp, dirs[i], n);
+		for (; n > 0; n--, j++)
+		{
+			put_be(fp, l->entries[j].dir ? ENTRY_DIR : ENTRY_FILE, 1);
+			fputs(l->entries[j].path + l->entries[j].parent
+					+ (l->entries[j].parent > 1), fp);
+			put_be(fp, 0, 1);
+		}
+		put_be(fp, ENTRY_END, 1);
+	}
+
+	if (fflush(fp) == 0 && ! ferror(fp) && fsync(fileno(fp)) == 0)
+		rv = 0;
+	if (fclose(fp) == EOF)
+		rv = -1;
+	if (rv == 0 && rename(tmp, db_file) == -1)
+		rv = -1;
+fail:
+	if (rv == -1)
+	{
+		i = errno;
+		unlink(tmp);
+		errno = i;
+	}
+out:
+	free(tmp);
+	free(dirs);
+	return rv;
+}
+
+/*
+ * ldb_free()
+ * Purpose: release what "l" holds, leaving it empty
+ */
+void ldb_free(struct ldb_list *l)
+{
+	struct ldb_chunk *c, *next;
+
+	for (c = l->chunks; c; c = next)
+	{
+		next = c->next;
+		free(c);
+	}
+	free(l->entries);
+	memset(l, 0, sizeof *l);
+}
+
+/*
+ * ldb_close()
+ * Purpose: release the previous database, and what ldb_open() kept
+ */
+void ldb_close()
+{
+	if (old_map)
+		munmap(old_map, old_size);
+	old_map = NULL;
+	free(old_dirs);
+	old_dirs = NULL;
+	nold = 0;
+	free(db_root);
+	db_root = NULL;
+}
+
+/*
+ * dir_time()
+ * Purpose: set "*sec" and "*nsec" to the time a directory of stat "info"
+ *			last changed, the newer of its mtime and ctime, or to 0 if
+ *			that is not before the search started
+ */
+static void dir_time(struct stat *info, long long *sec, long *nsec)
+{
+	*sec = info->st_mtim.tv_sec;
+	*nsec = info->st_mtim.tv_nsec;
+	if (info->st_ctim.tv_sec > *sec
+			|| (info->st_ctim.tv_sec == *sec && info->st_ctim.tv_nsec > *nsec))
+	{
+		*sec = info->st_ctim.tv_sec;
+		*nsec = info->st_ctim.tv_nsec;
+	}
+	if (*sec >= scan_start)
+		*sec = *nsec = 0;
+}
+
+/*
+ *	read_old()
+ *	Purpose: find the directories of the previous database, "size" bytes
+ *			 mapped at old_map, and sort them for ldb_reuse()
+ *	 Return: 0, or -1 with errno set: EINVAL if it is not a database, or
+ *			 is damaged
+ *	 Method: Every string is checked to end inside the file, and every
+ *			 entry type to be known, so that ldb_reuse() need not.
+ */
+static int read_old(size_t size)
+{
+	size_t at = HEADER_LEN, conf, room = 0;
+	struct old_dir *dirs, *d;
+	char *root, *name;
+
+	if (memcmp(old_map, MAGIC, MAGIC_LEN) != 0 || old_map[12] != 0
+			|| (root = old_string(&at)) == NULL)
+		goto damaged;
+	conf = get_be(old_map + MAGIC_LEN, 4);
+	if (conf > size - at)
+		goto damaged;
+	at += conf;
+	if (conf != 0 || strcmp(root, db_root) != 0)
+		return 0;								//nothing to reuse
+
+	while (at < size)
+	{
+		if (nold == room)
+		{
+			room = room ? 2 * room : DIRS_MIN;
+			if ((dirs = realloc(old_dirs, room * sizeof *dirs)) == NULL)
+				return -1;
+			old_dirs = dirs;
+		}
+		d = &old_dirs[nold++];
+		if (size - at < DIR_LEN)
+			goto damaged;
+		d->sec = get_be(old_map + at, 8);
+		d->nsec = get_be(old_map + at + 8, 4);
+		at += DIR_LEN;
+		if ((d->path = old_string(&at)) == NULL)
+			goto damaged;
+		d->entries = (char *) old_map + at;
+		for (;;)
+		{
+			if (at == size || old_map[at] > ENTRY_END)
+				goto damaged;
+			if (old_map[at++] == ENTRY_END)
+				break;
+			if ((name = old_string(&at)) == NULL || *name == '\0')
+				goto damaged;
+		}
+	}
+	if (nold > 0)
+		qsort(old_dirs, nold, sizeof *old_dirs, by_old);
+	return 0;
+
+damaged:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * old_string()
+ * Return: the string at offset "*at" of the previous database, "*at"
+ *		   moved past its NUL; NULL if it runs off the end of the file
+ */
+static char *old_string(size_t *at)
+{
+	unsigned char *nul = memchr(old_map + *at, '\0', old_size - *at);
+	char *s = (char *) old_map + *at;
+
+	if (nul == NULL)
+		return NULL;
+	*at = nul - old_map + 1;
+	return s;
+}
+
+/*
+ * get_be()
+ * Return: the "n" byte big endian integer at "p"
+ */
+static unsigned long long get_be(unsigned char *p, int n)
+{
+	unsigned long long v = 0;
+
+	while (n-- > 0)
+		v = v << 8 | *p++;
+	return v;
+}
+
+/*
+ * put_be()
+ * Purpose: write "v" to "fp" as an "n" byte big endian integer
+ */
+static void put_be(FILE *fp, unsigned long long v, int n)
+{
+	while (n-- > 0)
+		putc(v >> 8 * n & 0xff, fp);
+}
+
+/*
+ * put_dir()
+ * Purpose: write the header of directory "d", which has "n" entries; one
+ *			with none is given a time of 0, see the outline
+ */
+static void put_dir(FILE *fp, struct ldb_entry *d, size_t n)
+{
+	put_be(fp, n ? d->sec : 0, 8);
+	put_be(fp, n ? d->nsec : 0, 4);
+	put_be(fp, 0, 4);
+	fwrite(d->path, 1, strlen(d->path) + 1, fp);
+}
+
+/*
+ * dir_cmp()
+ * Return: how path "a", of "alen" bytes, compares with "b", of "blen",
+ *		   in the order of mlocate's walk: as strcmp() would, but with '/'
+ *		   before any other byte
+ */
+static int dir_cmp(char *a, size_t alen, char *b, size_t blen)
+{
+	size_t i;
+
+	for (i = 0; i < alen && i < blen && a[i] == b[i]; i++)
+		;
+	if (i == alen || i == blen)
+		return (i < alen) - (i < blen);
+	if (a[i] == '/' || b[i] == '/')
+		return a[i] == '/' ? -1 : 1;
+	return (unsigned char) a[i] - (unsigned char) b[i];
+}
+
+//for qsort(): entries by their directory, then by name
+static int by_place(const void *a, const void *b)
+{
+	const struct ldb_entry *x = a, *y = b;
+	int c = dir_cmp(x->path, x->parent, y->path, y->parent);
+
+	return c ? c : strcmp(x->path + x->parent, y->path + y->parent);
+}
+
+//for qsort(): directories by path
+static int by_dir(const void *a, const void *b)
+{
+	struct ldb_entry *x = *(struct ldb_entry **) a;
+	struct ldb_entry *y = *(struct ldb_entry **) b;
+
+	return dir_cmp(x->path, strlen(x->path), y->path, strlen(y->path));
+}
+
+//for qsort() and bsearch(): the previous database's directories by path
+static int by_old(const void *a, const void *b)
+{
+	const struct old_dir *x = a, *y = b;
+
+	return dir_cmp(x->path, strlen(x->path), y->path, strlen(y->path));
+}
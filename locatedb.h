@@ -0,0 +1,36 @@
+/*
+ * ==========================
+ *   FILE: ./locatedb.h
+ * ==========================
+ * Purpose: Databases for locate, in the mlocate format, written from a
+ *		search and reusing the unchanged directories of the last one, for
+ *		--updatedb, see locatedb.c.
+ */
+
+#ifndef LOCATEDB_H
+#define LOCATEDB_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+struct ldb_entry;
+struct ldb_chunk;
+
+//entries collected for a database, by one thread
+struct ldb_list {
+	struct ldb_entry *entries;		//"count" of them, their paths in
+	size_t count, room;				//"chunks"
+	struct ldb_chunk *chunks;
+};
+
+typedef void (*ldb_visit)(char *, int, void *);
+
+int ldb_open(char *, char *, struct stat *);
+int ldb_reuse(char *, struct stat *, ldb_visit, void *);
+int ldb_add(struct ldb_list *, char *, struct stat *);
+int ldb_merge(struct ldb_list *, struct ldb_list *);
+int ldb_write(struct ldb_list *);
+void ldb_free(struct ldb_list *);
+void ldb_close();
+
+#endif
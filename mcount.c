@@ -0,0 +1,47 @@
+/*
+ * ==========================
+ *   FILE: ./mcount.c
+ * ==========================
+ * Purpose: An allocator shim for alloc_check.sh: preloaded into pfind, it
+ *		counts calls to malloc(), calloc() and realloc() and prints the
+ *		total to stderr at exit, as "mcount: N allocations".
+ *
+ * Build: gcc -shared -fPIC -o mcount.so mcount.c
+ * Usage: LD_PRELOAD=./mcount.so ./pfind ...
+ *
+ * Note: the calls are passed on to glibc's own __libc_ entry points, so
+ *		the shim needs no dlsym(), which would itself allocate.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static long count;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+__attribute__((destructor))
+static void report()
+{
+	fprintf(stderr, "mcount: %ld allocations\n", count);
+}
@@ -0,0 +1,437 @@
+/*
+ * ==========================
+ *   FILE: ./memfs.c
+ * ==========================
+ * Purpose: In-memory filesystem backends, for replaying traces and for
+ *		benchmarking and testing the walker without touching a disk.
+ *
+ * Outline: mem_backend() serves a tree of struct mnode built with
+ *		mem_node(); each node carries its stat fields, the errno to report
+ *		for stat() and opendir(), and latencies to simulate (scaled).
+ *		replay_backend() in trace.c builds such a tree from a trace.
+ *
+ *		synthetic_backend() serves a tree that is never built: every
+ *		directory is generated from its depth when opened, from a spec
+ *		"DEPTH,FANOUT,FILES" -- FANOUT subdirectories per directory down to
+ *		DEPTH levels, and FILES files in every directory. File names cycle
+ *		through a few extensions and every tenth one is hidden, so that
+ *		-name and -type have something to select.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include "backend.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define SPIN_NS		50000			//delays spin below this, else sleep
+
+/* TREE BACKEND */
+struct mdir {
+	struct mnode *node;				//directory being read
+	struct mnode *next;				//next entry to return
+	struct mnode *batch[BATCH_MAX];	//entries of the last batch
+};
+
+static void *mem_opendir(char *);
+static int mem_readdir(void *, struct batch *);
+static int mem_stat(void *, int, char *, struct stat *);
+static void mem_closedir(void *);
+static struct mnode *lookup(char *);
+static int node_matches(struct mnode *, char *);
+static void delay(long);
+static long now_ns();
+
+/* SYNTHETIC BACKEND */
+struct sdir {
+	int depth;						//levels below the root
+	int next;						//index of the next entry to return
+	char names[BATCH_MAX][32];
+};
+
+static void *syn_opendir(char *);
+static int syn_readdir(void *, struct batch *);
+static int syn_stat(void *, int, char *, struct stat *);
+static void syn_closedir(void *);
+static int syn_depth(char *);
+
+/* FILE-SCOPE VARIABLES */
+static struct mnode *root;			//tree being served
+static __thread struct mnode *last_stat;	//node this thread stat()ed last
+static double scale;				//multiplier for node latencies
+
+static char *syn_root;				//starting path of the synthetic tree
+static int syn_max_depth, syn_fanout, syn_files;
+
+static struct backend tree_backend = {
+	mem_opendir, mem_readdir, mem_stat, mem_closedir
+};
+
+static struct backend syn_backend = {
+	syn_opendir, syn_readdir, syn_stat, syn_closedir
+};
+
+/*
+ * mem_node()
+ * Purpose: allocate a node named "name" as the last child of "parent", or
+ *			as a root if "parent" is NULL. Other fields start zeroed.
+ *  Return: the node; exits if memory runs out, as the tree is useless
+ */
+struct mnode *mem_node(struct mnode *parent, char *name)
+{
+	struct mnode *node = calloc(1, sizeof *node);
+
+	if (node == NULL || (node->name = strdup(name)) == NULL)
+	{
+		perror("mem_node");
+		exit(1);
+	}
+
+	node->parent = parent;
+	if (parent && parent->last)
+		parent->last->next = node;
+	else if (parent)
+		parent->child = node;
+	if (parent)
+		parent->last = node;
+	return node;
+}
+
+/*
+ *	mem_backend()
+ *	Purpose: serve the tree under "tree", whose name is the starting path
+ *	  Input: tree, the root node
+ *			 latency_scale, multiplier for the node latencies; 0 for none
+ *	 Return: the tree backend
+ */
+struct backend *mem_backend(struct mnode *tree, double latency_scale)
+{
+	root = tree;
+	last_stat = NULL;
+	scale = latency_scale;
+	return &tree_backend;
+}
+
+static void *mem_opendir(char *path)
+{
+	struct mnode *node = lookup(path);
+	struct mdir *md;
+
+	if (node == NULL)
+		return NULL;
+	delay(node->dir_ns);
+
+	if (! node->opened)						//e.g. never opened in a trace
+	{
+		errno = S_ISDIR(node->info.st_mode) ? ENODATA : ENOTDIR;
+		return NULL;
+	}
+	if (node->dir_err)
+	{
+		errno = node->dir_err;
+		return NULL;
+	}
+
+	if ((md = malloc(sizeof *md)) == NULL)
+		return NULL;
+	md->node = node;
+	md->next = node->child;
+	return md;
+}
+
+static int mem_readdir(void *dir, struct batch *b)
+{
+	struct mdir *md = dir;
+
+	for (b->count = 0; b->count < BATCH_MAX && md->next; b->count++)
+	{
+		md->batch[b->count] = md->next;
+		b->name[b->count] = md->next->name;
+		b->type[b->count] = md->next->stat_err ? DT_UNKNOWN
+							: IFTODT(md->next->info.st_mode);
+		md->next = md->next->next;
+	}
+	return b->count;
+}
+
+static int mem_stat(void *dir, int i, char *path, struct stat *info)
+{
+	struct mnode *node = dir ? ((struct mdir *) dir)->batch[i] : lookup(path);
+
+	if (node == NULL)
+		return -1;
+	delay(node->stat_ns);
+	last_stat = node;
+
+	if (node->stat_err)
+	{
+		errno = node->stat_err;
+		return -1;
+	}
+	*info = node->info;
+	return 0;
+}
+
+static void mem_closedir(void *dir)
+{
+	free(dir);
+}
+
+/*
+ *	lookup()
+ *	Purpose: find the node for a path built by the walker
+ *	 Return: the node, or NULL with errno set to ENOENT
+ *	 Method: the walker opens a directory right after stat()ing it, so the
+ *			 last stat()ed node is tried first. Otherwise the path is
+ *			 followed component by component from the root.
+ */
+static struct mnode *lookup(char *path)
+{
+	struct mnode *node;
+	size_t rlen = strlen(root->name);
+	char *p, *end;
+	size_t len;
+
+	if (last_stat && node_matches(last_stat, path))
+		return last_stat;
+
+	//the path must be the root, or the root followed by components
+	while (rlen > 1 && root->name[rlen - 1] == '/')
+		rlen--;
+	if (strncmp(path, root->name, rlen) != 0 || (path[rlen] != '\0'
+			&& path[rlen] != '/' && root->name[rlen - 1] != '/'))
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+
+	node = root;
+	for (p = path + rlen; node && *p; p = end)
+	{
+		while (*p == '/')
+			p++;
+		if ((len = strcspn(p, "/")) == 0)
+			break;
+		end = p + len;
+		for (node = node->child; node; node = node->next)
+			if (strlen(node->name) == len && strncmp(node->name, p, len) == 0)
+				break;
+	}
+
+	if (node == NULL)
+		errno = ENOENT;
+	return node;
+}
+
+/*
+ * node_matches()
+ * Purpose: check whether "path" names "node", comparing from the end
+ *  Return: YES or NO
+ */
+static int node_matches(struct mnode *node, char *path)
+{
+	size_t len = strlen(path);
+	size_t n;
+
+	for (; node != root; node = node->parent)
+	{
+		n = strlen(node->name);
+		if (len < n + 1 || strncmp(path + len - n, node->name, n) != 0)
+			return NO;
+		len -= n;
+		if (path[len - 1] != '/')
+			return NO;
+		while (len > 1 && path[len - 1] == '/')
+			len--;
+	}
+
+	n = strlen(root->name);
+	while (n > 1 && root->name[n - 1] == '/')
+		n--;
+	return len == n && strncmp(path, root->name, n) == 0;
+}
+
+/*
+ * delay()
+ * Purpose: stand in for a latency of "ns", scaled. Short delays are spun,
+ *			since sleeping overshoots them badly.
+ */
+static void delay(long ns)
+{
+	struct timespec ts;
+	long until;
+
+	ns = ns * scale;
+	if (ns <= 0)
+		return;
+
+	if (ns < SPIN_NS)
+	{
+		until = now_ns() + ns;
+		while (now_ns() < until)
+			;
+		return;
+	}
+
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * now_ns()
+ * Return: monotonic time in nanoseconds
+ */
+static long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ *	synthetic_backend()
+ *	Purpose: serve a generated tree rooted at "path"
+ *	  Input: path, the starting path the walker will be given
+ *			 spec, "DEPTH,FANOUT,FILES" as described at the top of the file
+ *	 Return: the synthetic backend, or NULL with errno set to EINVAL if
+ *			 the spec is malformed
+ */
+struct backend *synthetic_backend(char *path, char *spec)
+{
+	char extra;
+
+	if (sscanf(spec, "%d,%d,%d%c", &syn_max_depth, &syn_fanout, &syn_files,
+				&extra) != 3 || syn_max_depth < 0 || syn_fanout < 0
+			|| syn_files < 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	syn_root = path;
+	return &syn_backend;
+}
+
+/*
+ * syn_depth()
+ * Return: how many levels below the root "path" is, or -1 if "path" is
+ *		   not a generated directory
+ */
+static int syn_depth(char *path)
+{
+	size_t rlen = strlen(syn_root);
+	int depth = 0;
+	size_t len;
+	char *p;
+
+	if (strncmp(path, syn_root, rlen) != 0)
+		return -1;
+
+	for (p = path + rlen; *p; p += len)
+	{
+		p += strspn(p, "/");
+		if ((len = strcspn(p, "/")) == 0)
+			break;
+		if (p[0] != 'd')					//only "dN" are directories
+			return -1;
+		depth++;
+	}
+	return depth;
+}
+
+static void *syn_opendir(char *path)
+{
+	int depth = syn_depth(path);
+	struct sdir *sd;
+
+	if (depth < 0)
+	{
+		errno = ENOTDIR;
+		return NULL;
+	}
+	if ((sd = malloc(sizeof *sd)) == NULL)
+		return NULL;
+	sd->depth = depth;
+	sd->next = 0;
+	return sd;
+}
+
+/*
+ * Entries are numbered: 0 is ".", 1 is "..", then the subdirectories
+ * (if not at the deepest level), then the files.
+ */
+static int syn_readdir(void *dir, struct batch *b)
+{
+	static char *ext[] = { ".c", ".h", ".txt", ".log", "" };
+	struct sdir *sd = dir;
+	int dirs = sd->depth < syn_max_depth ? syn_fanout : 0;
+	int total = 2 + dirs + syn_files;
+	int n;
+
+	for (b->count = 0; b->count < BATCH_MAX && sd->next < total; b->count++)
+	{
+		n = sd->next++;
+		b->name[b->count] = sd->names[b->count];
+		b->type[b->count] = n < 2 + dirs ? DT_DIR : DT_REG;
+
+		if (n < 2)
+			strcpy(b->name[b->count], n == 0 ? "." : "..");
+		else if (n < 2 + dirs)
+			sprintf(b->name[b->count], "d%d", n - 2);
+		else
+		{
+			n -= 2 + dirs;
+			sprintf(b->name[b->count], "%sf%d%s", n % 10 == 9 ? "." : "",
+					n, ext[n % 5]);
+		}
+	}
+	return b->count;
+}
+
+static int syn_stat(void *dir, int i, char *path, struct stat *info)
+{
+	unsigned long h = 14695981039346656037UL;
+	struct sdir *sd = dir;
+	int depth, isdir;
+	char *p;
+
+	if (sd)
+	{
+		p = sd->names[i];
+		isdir = p[0] == 'd' || strcmp(p, ".") == 0 || strcmp(p, "..") == 0;
+		depth = sd->depth + (p[0] == 'd');
+	}
+	else
+	{
+		depth = syn_depth(path);
+		isdir = depth >= 0;
+	}
+
+	for (p = path; *p; p++)
+		h = (h ^ (unsigned char) *p) * 1099511628211UL;
+
+	memset(info, 0, sizeof *info);
+	info->st_dev = 1;
+	info->st_ino = h;
+	info->st_uid = h % 4 ? 1000 : 0;
+	info->st_size = isdir ? 4096 : h % 65536;
+	info->st_mtime = 1500000000 + h % 100000000;
+	info->st_atime = info->st_mtime + h % 1000000;
+	info->st_ctime = info->st_mtime;
+	info->st_mode = isdir ? S_IFDIR | 0755 : S_IFREG | 0644;
+	info->st_nlink = ! isdir ? 1
+					 : 2 + (depth < syn_max_depth ? syn_fanout : 0);
+	return 0;
+}
+
+static void syn_closedir(void *dir)
+{
+	free(dir);
+}
@@ -0,0 +1,792 @@
+/*
+ * ==========================
+ *   FILE: ./nameidx.c
+ * ==========================
+ * Purpose: A persistent index of the entries of a tree, by name, so that
+ *		a -name search for a substring ("*invoice*"), which no walk can
+ *		prune, reads a few posting lists instead of every directory.
+ *
+ * Outline: --index-build walks the tree as a search with no predicates
+ *		would, and each thread idx_add()s what it would print to its own
+ *		idx_list; the lists are merged, and idx_write() sorts the paths
+ *		and writes the file. --index then idx_open()s it, and
+ *		idx_search() hands back each entry whose name could match a
+ *		-name pattern, for pfind to check as a walk would.
+ *
+ *		Every trigram (3 bytes in a row) of each entry's name, its last
+ *		path component, has a posting list: the numbers of the entries
+ *		whose names hold it, ascending. A name matching a pattern holds
+ *		every literal run of the pattern, the text between its wildcards,
+ *		and so every trigram in those runs; the entries in all of those
+ *		lists are the only ones worth checking. A pattern with no run of
+ *		3 bytes has no trigram, and every entry is checked.
+ *
+ * Format: in the byte order of the machine that built it,
+ *
+ *		struct idx_header			 magic, counts and section offsets
+ *		entries						 each "SHARED LENGTH SUFFIX TYPE": the
+ *									 bytes its path shares with the one
+ *									 before, varints, the rest, and its
+ *									 DT_* type
+ *		blocks						 the offset of every BLOCK'th entry,
+ *									 which shares nothing, to start at
+ *		struct idx_trigram[]		 by key: count and postings offset
+ *		postings					 each list as varint gaps, the first
+ *									 from -1
+ *
+ *		A varint is 7 bits a byte, low first, the top bit set on all but
+ *		the last. Paths are sorted, so neighbours share long prefixes,
+ *		and the gaps in a list of a common trigram are mostly 1 byte.
+ *		The sections are 8 byte aligned. idx_open() maps the file and
+ *		checks every offset and count against its size before use, and
+ *		decoding never reads past a section, so a damaged index fails
+ *		with EINVAL rather than crashing.
+ *
+ * Memory: an idx_list keeps each path in chunks of CHUNK_SIZE, its type
+ *		in the byte before it, so there is no allocation per entry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nameidx.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define MAGIC		"pfind-index 1\n"	//in 16 bytes, NUL padded
+#define CHUNK_SIZE	(1 << 20)			//bytes of paths per chunk
+#define BLOCK		64					//entries per restart
+#define LIST_MIN	1024				//first room of an idx_list
+#define TRIS_MIN	4096				//first slots of the trigram table
+#define VARINT_MAX	10					//bytes of a 64 bit varint
+
+//the start of an index file
+struct idx_header {
+	char magic[16];
+	unsigned long long entries, blocks, trigrams;
+	unsigned long long entries_off, blocks_off, tri_off, post_off, size;
+};
+
+//a trigram of the file's table
+struct idx_trigram {
+	unsigned key;						//its 3 bytes, first in the high one
+	unsigned count;						//entries in its list
+	unsigned long long offset;			//of the list, in the postings
+};
+
+//a chunk of an idx_list's paths
+struct idx_chunk {
+	struct idx_chunk *next;
+	size_t used, size;
+	char data[];
+};
+
+//a trigram's list, while it is built
+struct tri_build {
+	unsigned key;						//0 for a free slot; the key + 1
+	unsigned count;
+	long long last;						//entry last added
+	unsigned char *buf;					//its varints, "len" bytes
+	size_t len, room;
+};
+
+struct name_index {
+	unsigned char *map;
+	size_t size;
+	struct idx_header *h;
+	unsigned char *entries, *entries_end;
+	unsigned long long *blocks;
+	struct idx_trigram *tris;
+	unsigned char *postings, *postings_end;
+};
+
+//where idx_search() is in the entries, decoding them in order
+struct cursor {
+	unsigned char *p;
+	unsigned long long next;			//the entry at "p"
+	char *path;							//the entry before it, "len" bytes
+	size_t len, room;
+	int type;
+};
+
+static char *base_name(char *);
+static int name_keys(char *, unsigned **, size_t *, size_t *);
+static int pattern_keys(char *, unsigned *, int);
+static int add_posting(struct tri_build **, size_t *, size_t *, unsigned,
+						long long);
+static int put_varint(unsigned char *, unsigned long long);
+static int get_varint(unsigned char **, unsigned char *,
+						unsigned long long *);
+static int write_all(FILE *, void *, size_t, unsigned long long *);
+static int decode(struct name_index *, struct cursor *);
+static int seek_entry(struct name_index *, struct cursor *,
+						unsigned long long);
+static unsigned long long *candidates(struct name_index *, unsigned *, int,
+										size_t *);
+static int by_path(const void *, const void *);
+static int by_key(const void *, const void *);
+static int by_value(const void *, const void *);
+static int by_length(const void *, const void *);
+
+/*
+ *	idx_add()
+ *	Purpose: add an entry to list "l": "path", or "path!/member" for an
+ *			 archive member, of file type "mode", 0 if not known
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+int idx_add(struct idx_list *l, char *path, char *member, mode_t mode)
+{
+	size_t plen = strlen(path), mlen = member ? strlen(member) + 2 : 0;
+	size_t need = plen + mlen + 2, room;
+	struct idx_chunk *c = l->chunks;
+	char **paths, *p;
+
+	if (c == NULL || c->size - c->used < need)
+	{
+		room = need > CHUNK_SIZE ? need : CHUNK_SIZE;
+		if ((c = malloc(sizeof *c + room)) == NULL)
+			return -1;
+		c->next = l->chunks;
+		c->used = 0;
+		c->size = room;
+		l->chunks = c;
+	}
+	if (l->count == l->room)
+	{
+		room = l->room ? 2 * l->room : LIST_MIN;
+		if ((paths = realloc(l->paths, room * sizeof *paths)) == NULL)
+			return -1;
+		l->paths = paths;
+		l->room = room;
+	}
+
+	p = c->data + c->used;
+	*p++ = mode ? IFTODT(mode) : DT_UNKNOWN;	//the type, before the path
+	memcpy(p, path, plen + 1);
+	if (member)
+	{
+		memcpy(p + plen, "!/", 2);
+		memcpy(p + plen + 2, member, mlen - 1);
+	}
+	c->used += need;
+	l->paths[l->count++] = p;
+	return 0;
+}
+
+/*
+ *	idx_merge()
+ *	Purpose: move the entries of "from" to "into", leaving "from" empty
+ *	 Return: 0, or -1 with errno set if there is no memory; "from" is
+ *			 then left as it was
+ */
+int idx_merge(struct idx_list *into, struct idx_list *from)
+{
+	struct idx_chunk *c;
+	char **paths;
+	size_t room = into->room;
+
+	while (room < into->count + from->count)
+		room = room ? 2 * room : LIST_MIN;
+	if (room > into->room)
+	{
+		if ((paths = realloc(into->paths, room * sizeof *paths)) == NULL)
+			return -1;
+		into->paths = paths;
+		into->room = room;
+	}
+	if (from->count > 0)
+		memcpy(into->paths + into->count, from->paths,
+				from->count * sizeof *from->paths);
+	into->count += from->count;
+
+	for (c = from->chunks; c && c->next; c = c->next)
+		;
+	if (c)
+	{
+		c->next = into->chunks;
+		into->chunks = from->chunks;
+	}
+	free(from->paths);
+	memset(from, 0, sizeof *from);
+	return 0;
+}
+
+/*
+ *	idx_write()
+ *	Purpose: write the entries of "l" to the index "file"
+ *	 Return: 0, or -1 with errno set if it cannot be written or there is
+ *			 no memory
+ *	 Method: The paths are sorted and written front coded, and the lists
+ *			 of each trigram built, as varints, at the same time; then
+ *			 the blocks, the trigram table by key, and the lists.
+ */
+int idx_write(struct idx_list *l, char *file)
+{
+	static const char zeros[8];
+	struct idx_header h;
+	struct tri_build *tris = NULL;
+	struct idx_trigram t;
+	unsigned long long *blocks = NULL, off = 0, list_off = 0;
+	unsigned char var[2 * VARINT_MAX];
+	unsigned *keys = NULL;
+	size_t nkeys, keys_room = 0, ntris = 0, tris_room = 0, i, j, shared;
+	char *prev = "";
+	FILE *fp;
+	int n, rv = -1;
+
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, MAGIC, sizeof MAGIC);
+	h.entries = l->count;
+	h.blocks = (l->count + BLOCK - 1) / BLOCK;
+	if (l->count > 0)
+		qsort(l->paths, l->count, sizeof *l->paths, by_path);
+	if ((fp = fopen(file, "w")) == NULL)
+		return -1;
+	if ((blocks = malloc((h.blocks + 1) * sizeof *blocks)) == NULL
+			|| write_all(fp, &h, sizeof h, &off) == -1)
+		goto out;
+
+	//the entries, and the lists
+	h.entries_off = off;
+	for (i = 0; i < l->count; i++)
+	{
+		shared = 0;
+		if (i % BLOCK == 0)
+			blocks[i / BLOCK] = off - h.entries_off;
+		else
+			while (prev[shared] && prev[shared] == l->paths[i][shared])
+				shared++;
+		n = put_varint(var, shared);
+		n += put_varint(var + n, strlen(l->paths[i] + shared));
+		if (write_all(fp, var, n, &off) == -1
+				|| write_all(fp, l->paths[i] + shared,
+							strlen(l->paths[i] + shared), &off) == -1
+				|| write_all(fp, l->paths[i] - 1, 1, &off) == -1)
+			goto out;
+		prev = l->paths[i];
+
+		if (name_keys(base_name(l->paths[i]), &keys, &nkeys, &keys_room)
+				== -1)
+			goto out;
+		for (j = 0; j < nkeys; j++)
+			if (add_posting(&tris, &ntris, &tris_room, keys[j], i) == -1)
+				goto out;
+	}
+	if (write_all(fp, (void *) zeros, -off & 7, &off) == -1)
+		goto out;
+
+	h.blocks_off = off;
+	if (write_all(fp, blocks, h.blocks * sizeof *blocks, &off) == -1)
+		goto out;
+
+	//the table, by key: the free slots sort first and are left out
+	qsort(tris, tris_room, sizeof *tris, by_key);
+	h.tri_off = off;
+	for (i = tris_room - ntris; i < tris_room; i++)
+	{
+		t.key = tris[i].key - 1;
+		t.count = tris[i].count;
+		t.offset = list_off;
+		list_off += tris[i].len;
+		if (write_all(fp, &t, sizeof t, &off) == -1)
+			goto out;
+	}
+	h.trigrams = ntris;
+	h.post_off = off;
+	for (i = tris_room - ntris; i < tris_room; i++)
+		if (write_all(fp, tris[i].buf, tris[i].len, &off) == -1)
+			goto out;
+	h.size = off;
+
+	if (fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, fp) == 1)
+		rv = 0;
+out:
+	if (fclose(fp) == EOF)
+		rv = -1;
+	for (i = 0; i < tris_room; i++)
+		free(tris[i].buf);
+	free(tris);
+	free(keys);
+	free(blocks);
+	return rv;
+}
+
+/*
+ * idx_free()
+ * Purpose: release what "l" holds, leaving it empty
+ */
+void idx_free(struct idx_list *l)
+{
+	struct idx_chunk *c, *next;
+
+	for (c = l->chunks; c; c = next)
+	{
+		next = c->next;
+		free(c);
+	}
+	free(l->paths);
+	memset(l, 0, sizeof *l);
+}
+
+/*
+ *	idx_open()
+ *	Purpose: open the index "file" for idx_search()
+ *	 Return: the index, or NULL with errno set: EINVAL if it is not an
+ *			 index, or is damaged
+ */
+struct name_index *idx_open(char *file)
+{
+	struct name_index *ix;
+	struct idx_header *h;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return NULL;
+	if ((ix = calloc(1, sizeof *ix)) == NULL || fstat(fd, &st) == -1)
+	{
+		free(ix);
+		close(fd);
+		return NULL;
+	}
+	ix->size = st.st_size;
+	if (ix->size < sizeof *h)
+		ix->map = MAP_FAILED, errno = EINVAL;
+	else
+		ix->map = mmap(NULL, ix->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ix->map == MAP_FAILED)
+	{
+		free(ix);
+		return NULL;
+	}
+
+	//every section in order, in the file, and as long as its count says;
+	//the order is checked first, so the sizes below cannot wrap
+	h = ix->h = (struct idx_header *) ix->map;
+	if (memcmp(h->magic, MAGIC, sizeof MAGIC) != 0 || h->size != ix->size
+			|| h->entries_off != sizeof *h
+			|| h->blocks_off < h->entries_off || h->tri_off < h->blocks_off
+			|| h->post_off < h->tri_off || h->post_off > h->size
+			|| h->blocks != (h->entries + BLOCK - 1) / BLOCK
+			|| h->blocks_off % 8
+			|| h->blocks > (h->size - h->blocks_off) / 8
+			|| h->tri_off != h->blocks_off + 8 * h->blocks
+			|| h->trigrams > (h->size - h->tri_off) / sizeof *ix->tris
+			|| h->post_off != h->tri_off + h->trigrams * sizeof *ix->tris)
+	{
+		idx_close(ix);
+		errno = EINVAL;
+		return NULL;
+	}
+	ix->entries = ix->map + h->entries_off;
+	ix->entries_end = ix->map + h->blocks_off;
+	ix->blocks = (unsigned long long *) (ix->map + h->blocks_off);
+	ix->tris = (struct idx_trigram *) (ix->map + h->tri_off);
+	ix->postings = ix->map + h->post_off;
+	ix->postings_end = ix->map + h->size;
+	return ix;
+}
+
+/*
+ *	idx_search()
+ *	Purpose: call visit(path, type, arg) for each entry of index "ix"
+ *			 whose name may match the -name "pattern", or for every entry
+ *			 if it is NULL, in the order of their paths
+ *	 Return: 0, or what visit() returned if not 0, which stops it; or -1
+ *			 with errno set, EINVAL if the index is damaged
+ *	   Note: The entries are only those whose names hold every trigram of
+ *			 the pattern's literal runs; the pattern is for the caller to
+ *			 match.
+ */
+int idx_search(struct name_index *ix, char *pattern, idx_visit visit,
+				void *arg)
+{
+	unsigned keys[256];
+	unsigned long long *ids = NULL, id;
+	struct cursor c;
+	size_t n = 0, i;
+	int nkeys = pattern ? pattern_keys(pattern, keys, 256) : 0;
+	int rv = 0;
+
+	if (nkeys > 0 && (ids = candidates(ix, keys, nkeys, &n)) == NULL)
+		return n == 0 ? 0 : -1;					//none, or no memory
+
+	memset(&c, 0, sizeof c);
+	for (i = 0; rv == 0 && i < (nkeys > 0 ? n : ix->h->entries); i++)
+	{
+		id = nkeys > 0 ? ids[i] : i;
+		if (seek_entry(ix, &c, id) == -1)
+			rv = -1;
+		else
+			rv = visit(c.path, c.type, arg);
+	}
+	free(c.path);
+	free(ids);
+	return rv;
+}
+
+/*
+ * idx_close()
+ * Purpose: release index "ix"
+ */
+void idx_close(struct name_index *ix)
+{
+	munmap(ix->map, ix->size);
+	free(ix);
+}
+
+/*
+ * base_name()
+ * Return: the last component of "path", the name -name matches
+ */
+static char *base_name(char *path)
+{
+	char *slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
+
+/*
+ *	name_keys()
+ *	Purpose: set "*keys" to the trigrams of "name", each once, "*n" of
+ *			 them, growing the array, of "*room", as needed
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+static int name_keys(char *name, unsigned **keys, size_t *n, size_t *room)
+{
+	size_t len = strlen(name), i, j;
+	unsigned *k;
+
+	*n = 0;
+	if (len < 3)
+		return 0;
+	if (len > *room)
+	{
+		if ((k = realloc(*keys, len * sizeof *k)) == NULL)
+			return -1;
+		*keys = k;
+		*room = len;
+	}
+	for (i = 0; i + 2 < len; i++)
+		(*keys)[i] = (unsigned char) name[i] << 16
+					| (unsigned char) name[i + 1] << 8
+					| (unsigned char) name[i + 2];
+	qsort(*keys, len - 2, sizeof **keys, by_value);
+	for (i = j = 0; i < len - 2; i++)
+		if (j == 0 || (*keys)[i] != (*keys)[j - 1])
+			(*keys)[j++] = (*keys)[i];
+	*n = j;
+	return 0;
+}
+
+/*
+ *	pattern_keys()
+ *	Purpose: put the trigrams of the literal runs of -name "pattern" in
+ *			 "keys", at most "max"
+ *	 Return: how many
+ *	 Method: A run ends at '*' or '?'; "\c" is a literal "c". At a '['
+ *			 the pattern stops being read, since a bracket expression is
+ *			 hard to find the end of, and fewer trigrams only means more
+ *			 entries to check.
+ */
+static int pattern_keys(char *pattern, unsigned *keys, int max)
+{
+	unsigned key = 0;
+	int run = 0, n = 0;
+	char *p;
+
+	for (p = pattern; *p && *p != '[' && n < max; p++)
+	{
+		if (*p == '*' || *p == '?')
+		{
+			run = 0;
+			continue;
+		}
+		if (*p == '\\' && *++p == '\0')
+			break;
+		key = (key << 8 | (unsigned char) *p) & 0xffffff;
+		if (++run >= 3)
+			keys[n++] = key;
+	}
+	return n;
+}
+
+/*
+ *	add_posting()
+ *	Purpose: add entry "id" to the list of trigram "key", in the table
+ *			 "*tris" of "*room" slots, "*n" used, growing it as needed
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+static int add_posting(struct tri_build **tris, size_t *n, size_t *room,
+						unsigned key, long long id)
+{
+	struct tri_build *t, *bigger;
+	size_t size, i, j;
+	unsigned char *buf;
+
+	if (4 * (*n + 1) > 3 * *room)
+	{
+		size = *room ? 2 * *room : TRIS_MIN;
+		if ((bigger = calloc(size, sizeof *bigger)) == NULL)
+			return -1;
+		for (i = 0; i < *room; i++)
+			if ((*tris)[i].key)
+			{
+				for (j = (*tris)[i].key * 2654435761u & (size - 1);
+						bigger[j].key; j = (j + 1) & (size - 1))
+					;
+				bigger[j] = (*tris)[i];
+			}
+		free(*tris);
+		*tris = bigger;
+		*room = size;
+	}
+
+	for (i = (key + 1) * 2654435761u & (*room - 1);
+			(*tris)[i].key && (*tris)[i].key != key + 1;
+			i = (i + 1) & (*room - 1))
+		;
+	t = &(*tris)[i];
+	if (t->key == 0)
+	{
+		t->key = key + 1;
+		t->last = -1;
+		(*n)++;
+	}
+	if (t->room - t->len < VARINT_MAX)
+	{
+		size = t->room ? 2 * t->room : 16;
+		if ((buf = realloc(t->buf, size)) == NULL)
+			return -1;
+		t->buf = buf;
+		t->room = size;
+	}
+	t->len += put_varint(t->buf + t->len, id - t->last);
+	t->last = id;
+	t->count++;
+	return 0;
+}
+
+/*
+ * put_varint()
+ * Purpose: write "v" at "p" as a varint
+ *  Return: the bytes written
+ */
+static int put_varint(unsigned char *p, unsigned long long v)
+{
+	int n = 0;
+
+	for (; v >= 0x80; v >>= 7)
+		p[n++] = (v & 0x7f) | 0x80;
+	p[n++] = v;
+	return n;
+}
+
+/*
+ * get_varint()
+ * Purpose: read a varint at "*p" into "*v", and move "*p" past it
+ *  Return: 0, or -1 if it runs past "end" or is too long
+ */
+static int get_varint(unsigned char **p, unsigned char *end,
+						unsigned long long *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; *p < end && shift < 64; shift += 7)
+	{
+		*v |= (unsigned long long) (**p & 0x7f) << shift;
+		if ((*(*p)++ & 0x80) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * write_all()
+ * Purpose: write "n" bytes of "buf" to "fp", adding them to "*off"
+ *  Return: 0, or -1 with errno set
+ */
+static int write_all(FILE *fp, void *buf, size_t n, unsigned long long *off)
+{
+	if (n > 0 && fwrite(buf, n, 1, fp) != 1)
+		return -1;
+	*off += n;
+	return 0;
+}
+
+/*
+ *	decode()
+ *	Purpose: decode the entry at cursor "c", making it the cursor's path
+ *			 and type, and move on to the next
+ *	 Return: 0, or -1 with errno EINVAL if the index is damaged, or with
+ *			 errno set if there is no memory
+ */
+static int decode(struct name_index *ix, struct cursor *c)
+{
+	unsigned long long shared, len;
+	size_t room;
+	char *path;
+
+	if (get_varint(&c->p, ix->entries_end, &shared) == -1
+			|| get_varint(&c->p, ix->entries_end, &len) == -1
+			|| shared > c->len || len >= (size_t) (ix->entries_end - c->p))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (shared + len + 1 > c->room)
+	{
+		for (room = c->room ? c->room : 256; room < shared + len + 1; )
+			room *= 2;
+		if ((path = realloc(c->path, room)) == NULL)
+			return -1;
+		c->path = path;
+		c->room = room;
+	}
+	memcpy(c->path + shared, c->p, len);
+	c->len = shared + len;
+	c->path[c->len] = '\0';
+	c->p += len;
+	c->type = *c->p++;
+	c->next++;
+	return 0;
+}
+
+/*
+ *	seek_entry()
+ *	Purpose: make entry "id" of "ix" the path and type of cursor "c"
+ *	 Return: 0, or -1 with errno set, as decode()
+ *	 Method: An entry ahead in the same block is reached by decoding on;
+ *			 any other from the start of its block.
+ */
+static int seek_entry(struct name_index *ix, struct cursor *c,
+						unsigned long long id)
+{
+	unsigned long long start = id / BLOCK * BLOCK;
+
+	if (c->p == NULL || id < c->next || c->next <= start)
+	{
+		if (ix->blocks[id / BLOCK] >= (size_t) (ix->entries_end
+												- ix->entries))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		c->p = ix->entries + ix->blocks[id / BLOCK];
+		c->next = start;
+		c->len = 0;
+	}
+	while (c->next <= id)
+		if (decode(ix, c) == -1)
+			return -1;
+	return 0;
+}
+
+/*
+ *	candidates()
+ *	Purpose: intersect the lists of the trigrams "keys", "nkeys" of them
+ *	 Return: the entries in all of them, ascending, "*n" of them, or NULL
+ *			 with "*n" 0 if there are none, or with "*n" not 0 and errno
+ *			 set if there is no memory or the index is damaged
+ *	 Method: The shortest list is decoded, and each of the others in turn
+ *			 read through alongside it, keeping the entries in both.
+ */
+static unsigned long long *candidates(struct name_index *ix, unsigned *keys,
+										int nkeys, size_t *n)
+{
+	struct idx_trigram *found[256], probe;
+	unsigned long long *ids, id, gap;
+	unsigned char *p, *end;
+	size_t i, kept, m;
+	int k;
+
+	*n = 0;
+	for (k = 0; k < nkeys; k++)
+	{
+		probe.key = keys[k];
+		found[k] = bsearch(&probe, ix->tris, ix->h->trigrams,
+							sizeof probe, by_value);
+		if (found[k] == NULL
+				|| found[k]->offset > (size_t) (ix->postings_end
+												- ix->postings))
+			return NULL;						//no entry has it
+	}
+	qsort(found, nkeys, sizeof *found, by_length);
+
+	*n = 1;										//for the errors
+	if ((ids = malloc((found[0]->count + 1) * sizeof *ids)) == NULL)
+		return NULL;
+	for (k = 0, m = 0; k < nkeys; k++)
+	{
+		p = ix->postings + found[k]->offset;
+		end = ix->postings_end;
+		for (i = 0, kept = 0, id = -1; i < found[k]->count; i++)
+		{
+			if (get_varint(&p, end, &gap) == -1 || gap == 0
+					|| (id += gap) >= ix->h->entries)
+			{
+				free(ids);
+				errno = EINVAL;
+				return NULL;
+			}
+			if (k == 0)
+				ids[kept++] = id;
+			else
+			{
+				while (m < *n && ids[m] < id)
+					m++;
+				if (m < *n && ids[m] == id)
+					ids[kept++] = id;
+			}
+		}
+		*n = kept;
+		m = 0;
+	}
+	if (*n == 0)
+	{
+		free(ids);
+		return NULL;
+	}
+	return ids;
+}
+
+//for qsort(): paths in strcmp() order
+static int by_path(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+//for qsort(): building trigrams by key, free slots (0) first
+static int by_key(const void *a, const void *b)
+{
+	const struct tri_build *x = a, *y = b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+//for qsort() and bsearch(): keys ascending, or the table's trigrams by
+//key, which comes first in them
+static int by_value(const void *a, const void *b)
+{
+	unsigned x = *(unsigned *) a, y = *(unsigned *) b;
+
+	return (x > y) - (x < y);
+}
+
+//for qsort(): the table's trigrams, shortest list first
+static int by_length(const void *a, const void *b)
+{
+	const struct idx_trigram *x = *(struct idx_trigram **) a;
+	const struct idx_trigram *y = *(struct idx_trigram **) b;
+
+	return (x->count > y->count) - (x->count < y->count);
+}
@@ -0,0 +1,34 @@
+/*
+ * ==========================
+ *   FILE: ./nameidx.h
+ * ==========================
+ * Purpose: A name index of a tree, with trigram postings for -name
+ *		substring searches, for --index-build and --index, see nameidx.c.
+ */
+
+#ifndef NAMEIDX_H
+#define NAMEIDX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//entries collected for an index, by one thread
+struct idx_list {
+	char **paths;					//"count" of them, in its chunks, each
+	size_t count, room;				//after its DT_* type
+	struct idx_chunk *chunks;
+};
+
+struct name_index;					//an index file, open
+
+typedef int (*idx_visit)(char *, int, void *);
+
+int idx_add(struct idx_list *, char *, char *, mode_t);
+int idx_merge(struct idx_list *, struct idx_list *);
+int idx_write(struct idx_list *, char *);
+void idx_free(struct idx_list *);
+struct name_index *idx_open(char *);
+int idx_search(struct name_index *, char *, idx_visit, void *);
+void idx_close(struct name_index *);
+
+#endif
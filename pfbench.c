@@ -0,0 +1,561 @@
+/*
+ * ==========================
+ *   FILE: ./pfbench.c
+ * ==========================
+ * Purpose: Microbenchmarks for the per-entry kernels of pfind.
+ *
+ * Outline: pfbench includes pfind.c directly (with its main() renamed) so
+ *		that each kernel can be timed in isolation on the same name corpus:
+ *
+ *			path join	-- construct_path() against a bare buffer join
+ *			glob match	-- check_entry() with a -name pattern, and fnmatch()
+ *			dirent		-- readdir() against raw getdents64() parsing, and
+ *						   dir_read() building its index in an arena
+ *			dots		-- telling ".", ".." and hidden names apart with
+ *						   strcmp() per name, against mark_batch()
+ *			output		-- printf() against buffered fwrite() into /dev/null
+ *			visited		-- the exact visited set against the bounded filter,
+ *						   adding one (dev, ino) pair per name, growth
+ *						   included; then BIG_SET pairs on normal pages
+ *						   against huge pages, where the TLB matters
+ *
+ *		Every kernel reports ns/entry and, where the kernel allows it,
+ *		instructions/entry from a perf_event_open() counter. When a new
+ *		implementation of a kernel is written, add it to the table in main()
+ *		beside the one it replaces.
+ *
+ *		With --scaling, pfbench instead times whole --threads searches of
+ *		a directory with 1, 2, 4 ... workers and prints the speedup and
+ *		efficiency of each over one worker. On a warm tree in tmpfs, where
+ *		no worker waits on a disk, it should stay close to linear up to
+ *		the number of cores; where it does not, look for shared state.
+ *
+ * Usage: pfbench [corpus-file [directory [pattern]]]
+ *		pfbench --scaling directory [max-threads]
+ *		corpus-file holds one name per line, e.g. recorded on a real machine
+ *		with "find / -printf '%f\n' > corpus". Without one, the names under
+ *		/usr are read. directory is what the dirent kernels read (default
+ *		/usr/bin); pattern is the -name pattern (default "*.c").
+ */
+
+#define _GNU_SOURCE				//struct dirent64
+#define main pfind_main
+#include "pfind.c"
+#undef main
+#include "dirread.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* CONSTANTS */
+#define MAX_CORPUS	(1 << 20)		//names kept from the corpus
+#define ROUNDS		5				//best-of rounds per kernel
+#define DIRENT_BUF	(64 * 1024)		//getdents64 buffer size
+#define BIG_SET		(1 << 23)		//pairs added by the big visited kernels
+
+/* BENCHMARK FUNCTIONS */
+void load_corpus(char *);
+void walk_corpus(char *, int);
+void run_kernel(char *, long (*)(void));
+void run_scaling(char *, int);
+int open_counter();
+long long read_counter(int);
+
+/* KERNELS */
+long k_construct_path();
+long k_join_buffer();
+long k_check_entry();
+long k_fnmatch();
+long k_readdir();
+long k_getdents64();
+long k_dir_read();
+long k_strcmp_dots();
+long k_mark_batch();
+long k_printf();
+long k_fwrite();
+long k_visited_exact();
+long k_visited_filter();
+long k_visited_normal();
+long k_visited_huge();
+long visited_big(int);
+
+/* FILE-SCOPE VARIABLES */
+static char **corpus;				//names to feed the kernels
+static int ncorpus;
+static char *bench_dir = "/usr/bin";
+static char *pattern = "*.c";
+static FILE *sink;					//output kernels write here
+static long checksum;				//keeps the compiler honest
+
+int main(int ac, char **av)
+{
+	progname = av[0];
+	if (ac > 2 && strcmp(av[1], "--scaling") == 0)
+	{
+		run_scaling(av[2], ac > 3 ? atoi(av[3])
+							: (int) sysconf(_SC_NPROCESSORS_ONLN));
+		return 0;
+	}
+
+	corpus = malloc(MAX_CORPUS * sizeof(char *));
+	sink = fopen("/dev/null", "w");
+
+	if (corpus == NULL || sink == NULL)
+	{
+		perror(progname);
+		return 1;
+	}
+
+	if (ac > 1)
+		load_corpus(av[1]);
+	else
+		walk_corpus("/usr", 0);
+	if (ac > 2)
+		bench_dir = av[2];
+	if (ac > 3)
+		pattern = av[3];
+
+	printf("%d names, dirent kernels on %s, pattern \"%s\"\n\n",
+			ncorpus, bench_dir, pattern);
+	printf("%-24s %12s %12s\n", "kernel", "ns/entry", "insns/entry");
+
+	run_kernel("path: construct_path", k_construct_path);
+	run_kernel("path: join_buffer", k_join_buffer);
+	run_kernel("match: check_entry", k_check_entry);
+	run_kernel("match: fnmatch", k_fnmatch);
+	run_kernel("dirent: readdir", k_readdir);
+	run_kernel("dirent: getdents64", k_getdents64);
+	run_kernel("dirent: dir_read", k_dir_read);
+	run_kernel("dots: strcmp", k_strcmp_dots);
+	run_kernel("dots: mark_batch", k_mark_batch);
+	run_kernel("output: printf", k_printf);
+	run_kernel("output: fwrite", k_fwrite);
+	run_kernel("visited: exact set", k_visited_exact);
+	run_kernel("visited: filter", k_visited_filter);
+	run_kernel("visited: big, normal", k_visited_normal);
+	run_kernel("visited: big, hugepages", k_visited_huge);
+
+	return checksum == 42;			//never true, but can't be optimized out
+}
+
+/*
+ *	load_corpus()
+ *	Purpose: read one name per line from "file" into the corpus
+ *	 Errors: exits 1 if the file cannot be opened or holds no names
+ */
+void load_corpus(char *file)
+{
+	FILE *fp = fopen(file, "r");
+	char line[4096];
+
+	if (fp == NULL)
+	{
+		file_error(file);
+		exit(1);
+	}
+
+	while (ncorpus < MAX_CORPUS && fgets(line, sizeof line, fp))
+	{
+		line[strcspn(line, "\n")] = '\0';
+		corpus[ncorpus++] = strdup(line);
+	}
+	fclose(fp);
+
+	if (ncorpus == 0)
+	{
+		fprintf(stderr, "%s: `%s': empty corpus\n", progname, file);
+		exit(1);
+	}
+}
+
+/*
+ *	walk_corpus()
+ *	Purpose: fallback corpus, the names found under "dir" (a few levels)
+ */
+void walk_corpus(char *dir, int depth)
+{
+	DIR *dp = opendir(dir);
+	struct dirent *de;
+	char *path;
+
+	if (dp == NULL)
+		return;
+
+	while ((de = readdir(dp)) != NULL && ncorpus < MAX_CORPUS)
+	{
+		corpus[ncorpus++] = strdup(de->d_name);
+		if (depth < 4 && de->d_type == DT_DIR
+				&& recurse_directory(name_marks(de->d_name), S_IFDIR) == YES)
+		{
+			if (asprintf(&path, "%s/%s", dir, de->d_name) != -1)
+			{
+				walk_corpus(path, depth + 1);
+				free(path);
+			}
+		}
+	}
+	closedir(dp);
+}
+
+/*
+ *	run_kernel()
+ *	Purpose: time a kernel over ROUNDS runs and print its best per-entry
+ *			 cost. Each kernel returns the number of entries it processed.
+ */
+void run_kernel(char *label, long (*kernel)(void))
+{
+	int fd = open_counter();
+	double best_ns = 0, best_insns = 0;
+	long long insns;
+	long start, n;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++)
+	{
+		if (fd != -1)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		start = now_ns();
+		n = kernel();
+		start = now_ns() - start;
+		if (fd != -1)
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+		insns = read_counter(fd);
+		if (n > 0 && (i == 0 || (double) start / n < best_ns))
+		{
+			best_ns = (double) start / n;
+			best_insns = insns < 0 ? -1 : (double) insns / n;
+		}
+	}
+
+	if (best_insns < 0)
+		printf("%-24s %12.1f %12s\n", label, best_ns, "n/a");
+	else
+		printf("%-24s %12.1f %12.1f\n", label, best_ns, best_insns);
+
+	if (fd != -1)
+		close(fd);
+}
+
+/*
+ *	run_scaling()
+ *	Purpose: time parallel_search() of "dir" with 1, 2, 4 ... and finally
+ *			 "max" workers, best of ROUNDS each, after one warm-up search
+ *	 Output: workers, ms, speedup and efficiency against one worker. The
+ *			 matches themselves go to /dev/null.
+ */
+void run_scaling(char *dir, int max)
+{
+	struct query q = { NULL, 0, 0, 0, 0, 0, NULL, 0, NULL, NULL };
+	long best[POOL_MAX + 1];
+	int out = dup(1);
+	int null = open("/dev/null", O_WRONLY);
+	long start;
+	int n, i;
+
+	if (out == -1 || null == -1 || max < 1 || max > POOL_MAX)
+	{
+		fprintf(stderr, "%s: cannot run scaling benchmark\n", progname);
+		exit(1);
+	}
+
+	fflush(stdout);
+	dup2(null, 1);
+	threads = 1;
+	parallel_search(dir, &q);						//warm the caches
+
+	for (n = 1; n <= max; n = n < max && 2 * n > max ? max : 2 * n)
+	{
+		threads = n;
+		for (i = 0; i < ROUNDS; i++)
+		{
+			start = now_ns();
+			parallel_search(dir, &q);
+			fflush(stdout);
+			start = now_ns() - start;
+			if (i == 0 || start < best[n])
+				best[n] = start;
+		}
+		if (n == max)
+			break;
+	}
+
+	dup2(out, 1);
+	printf("%8s %10s %9s %11s\n", "workers", "ms", "speedup", "efficiency");
+	for (n = 1; n <= max; n = n < max && 2 * n > max ? max : 2 * n)
+	{
+		printf("%8d %10.1f %9.2f %10.0f%%\n", n, best[n] / 1e6,
+				(double) best[1] / best[n],
+				100.0 * best[1] / best[n] / n);
+		if (n == max)
+			break;
+	}
+}
+
+/*
+ *	open_counter()
+ *	Purpose: open a user-space instruction counter for this thread
+ *	 Return: the counter fd, or -1 when perf events are not permitted
+ */
+int open_counter()
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * read_counter()
+ * Return: instructions counted on "fd", or -1 if there is no counter
+ */
+long long read_counter(int fd)
+{
+	long long count;
+
+	if (fd == -1 || read(fd, &count, sizeof count) != sizeof count)
+		return -1;
+	return count;
+}
+
+/*
+ * The kernels. Each processes the whole corpus (or bench_dir) once and
+ * returns the number of entries it handled.
+ */
+
+long k_construct_path()
+{
+	struct pathbuf *dir = path_buffer("/usr/share/some/parent");
+	char *path;
+	int i;
+
+	for (i = 0; i < ncorpus; i++)
+	{
+		path = construct_path(dir, corpus[i]);
+		if (path != NULL)
+			checksum += path[0];
+	}
+	return ncorpus;
+}
+
+//candidate: append the child to a reused buffer holding the parent
+long k_join_buffer()
+{
+	static char buf[PATH_MAX + 256];
+	size_t plen = strlen("/usr/share/some/parent");
+	size_t len;
+	int i;
+
+	memcpy(buf, "/usr/share/some/parent", plen);
+	buf[plen] = '/';
+	for (i = 0; i < ncorpus; i++)
+	{
+		len = strlen(corpus[i]);
+		memcpy(buf + plen + 1, corpus[i], len + 1);
+		checksum += buf[plen + len];
+	}
+	return ncorpus;
+}
+
+long k_check_entry()
+{
+	struct query q = { pattern, 0, 0, 0, 0, 0, NULL, 0, NULL, NULL };
+	struct stat info;
+	int i;
+
+	memset(&info, 0, sizeof info);
+	info.st_mode = S_IFREG;
+	for (i = 0; i < ncorpus; i++)
+		checksum += check_entry(&q, corpus[i], 0, &info);
+	return ncorpus;
+}
+
+long k_fnmatch()
+{
+	int i;
+
+	for (i = 0; i < ncorpus; i++)
+		checksum += fnmatch(pattern, corpus[i], FNM_PERIOD);
+	return ncorpus;
+}
+
+long k_readdir()
+{
+	DIR *dp = opendir(bench_dir);
+	struct dirent *de;
+	long n = 0;
+
+	if (dp == NULL)
+		return 0;
+	while ((de = readdir(dp)) != NULL)
+	{
+		checksum += de->d_type + de->d_name[0];
+		n++;
+	}
+	closedir(dp);
+	return n;
+}
+
+//candidate: parse linux_dirent64 records straight out of a large buffer
+long k_getdents64()
+{
+	static char buf[DIRENT_BUF];
+	int fd = open(bench_dir, O_RDONLY | O_DIRECTORY);
+	struct dirent64 *de;
+	long nread, off, n = 0;
+
+	if (fd == -1)
+		return 0;
+	while ((nread = syscall(SYS_getdents64, fd, buf, sizeof buf)) > 0)
+	{
+		for (off = 0; off < nread; off += de->d_reclen)
+		{
+			de = (struct dirent64 *) (buf + off);
+			checksum += de->d_type + de->d_name[0];
+			n++;
+		}
+	}
+	close(fd);
+	return n;
+}
+
+//as backend.c reads: the whole directory, arena kept from run to run
+long k_dir_read()
+{
+	static struct dirlist dl;
+	int fd = open(bench_dir, O_RDONLY | O_DIRECTORY);
+	int i, n;
+
+	if (fd == -1)
+		return 0;
+	n = dir_read(fd, &dl);
+	close(fd);
+	for (i = 0; i < n; i++)
+		checksum += dl.ent[i].type + dl.ent[i].name[0];
+	return n;
+}
+
+long k_strcmp_dots()
+{
+	int i;
+
+	for (i = 0; i < ncorpus; i++)
+		checksum += (strcmp(corpus[i], ".") == 0)
+					+ (strcmp(corpus[i], "..") == 0)
+					+ (corpus[i][0] == '.');
+	return ncorpus;
+}
+
+long k_mark_batch()
+{
+	struct query q = { NULL, 0, 0, 0, 0, 0, NULL, 0, NULL, NULL };
+	struct batch b;
+	struct marks m;
+	int i;
+
+	for (i = 0; i < ncorpus; i += b.count)
+	{
+		b.count = ncorpus - i < BATCH_MAX ? ncorpus - i : BATCH_MAX;
+		memcpy(b.name, corpus + i, b.count * sizeof(char *));
+		mark_batch(&b, "dir", &q, &m);
+		checksum += m.dot[0] + m.dotdot[0] + m.hidden[1];
+	}
+	return ncorpus;
+}
+
+long k_printf()
+{
+	int i;
+
+	for (i = 0; i < ncorpus; i++)
+		fprintf(sink, "%s\n", corpus[i]);
+	fflush(sink);
+	return ncorpus;
+}
+
+//candidate: copy whole lines into a block and fwrite() it when full
+long k_fwrite()
+{
+	static char block[64 * 1024];
+	size_t used = 0, len;
+	int i;
+
+	for (i = 0; i < ncorpus; i++)
+	{
+		len = strlen(corpus[i]);
+		if (used + len + 1 > sizeof block)
+		{
+			fwrite(block, 1, used, sink);
+			used = 0;
+		}
+		memcpy(block + used, corpus[i], len);
+		used += len;
+		block[used++] = '\n';
+	}
+	fwrite(block, 1, used, sink);
+	fflush(sink);
+	return ncorpus;
+}
+
+long k_visited_exact()
+{
+	int i;
+
+	visited_init(0);
+	for (i = 0; i < ncorpus; i++)
+		checksum += visited_add(1, (ino_t) i * 7919 + corpus[i][0]);
+	visited_free();
+	return ncorpus;
+}
+
+long k_visited_filter()
+{
+	int i;
+
+	visited_init(16 * 1024 * 1024);
+	for (i = 0; i < ncorpus; i++)
+		checksum += visited_add(1, (ino_t) i * 7919 + corpus[i][0]);
+	visited_free();
+	return ncorpus;
+}
+
+long k_visited_normal()
+{
+	return visited_big(NO);
+}
+
+long k_visited_huge()
+{
+	return visited_big(YES);
+}
+
+//add BIG_SET pairs and look them all up again, huge pages on or off
+long visited_big(int huge)
+{
+	long i;
+
+	huge_mode(huge);
+	visited_init(0);
+	for (i = 0; i < BIG_SET; i++)
+		checksum += visited_add(1, i * 7919);
+	for (i = 0; i < BIG_SET; i++)
+		checksum += visited_add(1, i * 7919);
+	visited_free();
+	huge_mode(NO);
+	return 2 * BIG_SET;
+}
@@ -10,14 +10,127 @@
  *
  * Outline: pfind recursively searches, depth-first, through directories and
  *		any subdirectories it encounters, starting with a provided path.
- *		Results are filtered according to user-specified "-name" and/or
- *		"-type" options.
+ *		Results are filtered according to user-specified "-name", "-type"
+ *		and/or "-size" options, kept together in a struct query. With
+ *		--archives, zip and tar files are searched too, see archive.c.
  *
+ *		The "." and ".." entries, and hidden ones (a leading '.'), are
+ *		told apart once per batch of entries by mark_batch(), which sets
+ *		a bit per entry in one bitmask for each. process_dir() skips the
+ *		entries that are never output or searched before stat()ing them,
+ *		so neither they nor the rest branch on their names one by one.
+ *		-hidden outputs only hidden entries; -no-hidden skips them, and
+ *		does not search hidden directories either.
  *
- * Data structures: construct_path() will malloc() a block of memory to store
- *		the full path of the current directory entry returned by the call to
- *		readdir(). If it is a directory, this is passed through to be
- *		recursively searched, otherwise, the char * is freed.
+ *		With --threads N, the same functions run on a pool of N workers
+ *		(pool.c): instead of recursing, process_entry() submits each
+ *		subdirectory, and each archive, as a task of its own. Each worker
+ *		collects its output in a buffer that is written out in whole
+ *		lines, so the lines of different workers never mix. --numa also
+ *		places the workers and their buffers on NUMA nodes.
+ *
+ *		A huge directory would still be searched by one worker, so once
+ *		a directory has been CHUNK_AFTER batches long, each further batch
+ *		is handed off as a chunk, a task of its own that stat()s, matches
+ *		and outputs its entries by path, while the directory's own task
+ *		reads on. Only CHUNK_AHEAD chunks per worker are queued at once;
+ *		beyond that the directory's task searches its batches in place.
+ *
+ *		--schedule picks which queued directory a worker takes first:
+ *		by default the newest, so each worker goes depth-first; or, by
+ *		priorities from sched.c, the shallowest, the largest, or the one
+ *		weighted highest by a --weights file. --stats reports the critical
+ *		path, the longest chain of tasks each submitted by the one before,
+ *		which no number of workers can search faster.
+ *
+ *		With --async N, for filesystems where each call takes long, one
+ *		thread searches many directories at once instead. Each directory
+ *		is a struct walk, a coroutine kept as an explicit state, whose
+ *		blocking calls are made by N helper threads (helper.c) while the
+ *		thread moves other walks on. See async_search().
+ *
+ *		-unique prints each file with several hard links only once, and
+ *		-follow follows symbolic links, searching each directory only
+ *		once so that link loops end. Both record (device, inode) pairs in
+ *		the concurrent set of visited.c. Which of several names is used
+ *		for a file or directory is the first one reached, and so may vary
+ *		from run to run with --threads.
+ *
+ *		--hugepages puts the visited set and the output buffers on huge
+ *		pages where the system has them, see hugemem.c.
+ *
+ *		Large directories are searched in inode order while stat() is
+ *		slow, as on a cold cache; see backend.c and --inode-order.
+ *
+ *		An entry is not stat()ed at all when the search needs nothing
+ *		from it but its name and whether it is a directory, and that is
+ *		known already: from its d_type, or, on filesystems where a
+ *		directory has 2 links plus one per subdirectory, because that
+ *		many subdirectories have been found and the rest are leaves.
+ *		See needs_stat().
+ *
+ *		-fstype matches files on filesystems of one type. --skip-pseudo
+ *		does not search directories on the kernel's pseudo filesystems
+ *		(/proc, /sys, ...), and --local-only those on remote ones; the
+ *		directory is output, if it matches, but never opened. Types come
+ *		from the mount table, see fstype.c.
+ *
+ *		--queries FILE searches for many queries at once, one per line of
+ *		the file, each printing to its own -fprint file or to stdout.
+ *		The tree is walked once for all of them: an entry is stat()ed if
+ *		any query needs it, once, and report() then tries each query on
+ *		it in turn. A directory is searched unless every query has
+ *		-no-hidden and it is hidden; in_view() keeps the rest of the
+ *		-no-hidden queries out of it.
+ *
+ *		--batch answers many searches in one process, for scripts that
+ *		would otherwise start pfind once per small directory: a job per
+ *		line of stdin, a starting path and its predicates, each answered
+ *		with its matches and an empty line. The workers, helpers, buffers
+ *		and mount table are set up once for all of them; see run_batch().
+ *
+ *		--top N --by KEY outputs only the N matches of largest size, or
+ *		latest mtime or atime (smallest or earliest with --by -KEY), best
+ *		first, once the search is over. Each thread keeps its own heap of
+ *		at most N, so memory is bounded however many files match, and the
+ *		heaps are merged at the end; see topn.c and print_top().
+ *
+ *		--group-by KEY --agg LIST outputs, instead of the matches, a
+ *		table of totals of them by extension, owner, depth or age, such
+ *		as their count, total size and latest mtime. Each thread adds up
+ *		its own in a hash table of its own, and the tables are merged at
+ *		the end; see group.c and print_groups().
+ *
+ *		--estimate PCT does not walk the whole tree: it estimates how
+ *		many entries match, and their total size, to within PCT percent
+ *		at 95% confidence, from random descents of the tree, listing only
+ *		the directories they pass through; see estimate.c.
+ *
+ *		--index-build FILE writes, instead of the matches, an index of
+ *		the names in the tree, and --index FILE then searches the index
+ *		instead of the tree: -name is narrowed down to the entries whose
+ *		names hold each three letter run of its pattern, from trigram
+ *		posting lists, before fnmatch() checks them. Like locate's, the
+ *		index is as old as its last build; see nameidx.c.
+ *
+ *		--updatedb FILE writes, instead of the matches, a database for
+ *		mlocate's (or plocate's) locate, so that the search replaces
+ *		updatedb. A directory whose times show it has not changed since
+ *		the last database is listed from there instead of read; see
+ *		locatedb.c.
+ *
+ * Data structures: each worker has a struct worker_state of its own, cache
+ *		line aligned so that no two workers write to the same line. Its
+ *		counters for --stats are summed only when they are reported. The
+ *		plain search uses a single state of the same kind.
+ *
+ *		Paths are built in a struct pathbuf, one per directory level,
+ *		kept in the worker state and reused from directory to directory:
+ *		process_dir() copies "dirname/" in once, and construct_path()
+ *		only appends each entry's name. A subdirectory is searched with
+ *		the next level's buffer, so the path to it stays put meanwhile.
+ *		Once the deepest level has been reached and the longest path seen,
+ *		the search allocates nothing per entry (see alloc_check.sh).
  */
 
  /* INCLUDES */
@@ -28,33 +141,387 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <fnmatch.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <setjmp.h>
+#include "backend.h"
+#include "archive.h"
+#include "pool.h"
+#include "visited.h"
+#include "hugemem.h"
+#include "helper.h"
+#include "sched.h"
+#include "fstype.h"
+#include "topn.h"
+#include "group.h"
+#include "estimate.h"
+#include "nameidx.h"
+#include "locatedb.h"
 
 /* CONSTANTS */
 #define NO	0
 #define YES	1
+#define OUT_SIZE	65536			//bytes of output a worker buffers,
+									//or HUGE_PAGE with --hugepages
+
+#define PATH_INIT	256				//first size of a path buffer
+#define ASYNC_MAX	4096			//most --async calls outstanding
+#define TOP_MAX		1000000			//most --top matches kept
+#define PROBES_MAX	100000			//--estimate probes, unless --probes
+#define CHUNK_AFTER	32				//batches searched in place, at least
+#define CHUNK_AHEAD	2				//chunks queued per worker, at most
+#define QUERY_WORDS	64				//words on a --queries line, at most
+
+//what mark_batch() says about a name, one bit each
+#define MARK_DOT	1				//"."
+#define MARK_DOTDOT	2				//".."
+#define MARK_HIDDEN	4				//any other name starting with '.'
+#define MARK_WORDS	((BATCH_MAX + 63) / 64)	//words in a batch bitmask
+
+/* SEARCH CRITERIA */
+struct query {
+	char *name;					//-name pattern, or NULL
+	int type;					//-type bitmask, or 0
+	int size_cmp;				//-size: '+', '-', '=', or 0 if not given
+	long long size;				//-size count, in units of size_unit
+	long long size_unit;		//bytes per -size unit
+	int hidden;					//'+' for -hidden, '-' for -no-hidden, or 0
+	char *fstype;				//-fstype type, or NULL
+	int out;					//-fprint output, see add_output(); 0 is stdout
+	char *line;					//the --queries line it points into, or NULL
+	struct query *next;			//the next query of the file, or NULL
+};
+
+//a worker's buffered output for one of the outputs
+struct outbuf {
+	char *buf;						//"size" bytes
+	size_t len;						//waiting to be written
+	size_t size;
+};
+
+//the names of a batch, a bit per entry, from mark_batch()
+struct marks {
+	unsigned long dot[MARK_WORDS];
+	unsigned long dotdot[MARK_WORDS];
+	unsigned long hidden[MARK_WORDS];
+	unsigned long skip[MARK_WORDS];		//neither output nor searched
+};
+
+//what visit_member() needs to know about the archive being searched
+struct archive_search {
+	char *path;					//the archive, as printed
+	struct query *q;
+};
+
+//what idx_search() hands back to index_visit(), for --index
+struct index_search {
+	char *root;					//the starting path
+	struct query *q;
+};
+
+//what ldb_reuse() hands back to reuse_entry(), for --updatedb
+struct reuse_search {
+	struct pathbuf *dir;		//of the directory reused
+	struct query *q;
+};
+
+//where a pool task stands in the search, for the tasks it submits
+struct lineage {
+	int depth;						//below the starting path
+	long cp_start;					//critical path to its submission, ns
+	struct sched_dir *dir;			//for --save-weights, or NULL
+};
+
+//a directory or archive to search, as a pool task
+struct search_task {
+	struct query *q;
+	int kind;						//archive type, or ARCHIVE_NONE
+	long subdirs;					//from known_subdirs(), or -1
+	struct lineage at;
+	char path[];
+};
+
+//a batch of a huge directory, searched as a pool task of its own
+struct chunk {
+	struct query *q;
+	struct lineage at;				//the directory's
+	struct marks m;					//of the batch
+	int count;
+	char *name[BATCH_MAX];			//into "buf"
+	unsigned char type[BATCH_MAX];
+	char *dirname;					//into "buf"
+	char *buf;						//"size" bytes, kept for reuse
+	size_t size;
+	struct chunk *next_free;
+};
+
+//what one worker has done, for --stats
+struct counters {
+	long dirs;						//directories read
+	long entries;					//entries stat()ed
+	long matches;					//lines output
+	long errors;					//errors reported
+	long chunks;					//batches handed off as chunks
+	long unstatted;					//entries needs_stat() spared
+	long pruned;					//directories on skipped filesystems
+	long reused;					//directories --updatedb did not read
+};
+
+//the paths of the entries of one directory, "dirname/" then a name
+struct pathbuf {
+	char *dirname;					//the directory, as given
+	char *buf;						//"size" bytes
+	size_t size;
+	size_t prefix;					//length of "dirname/" in buf
+};
+
+//what an async_op asks a helper to do
+#define OP_OPEN		0				//the backend's opendir()
+#define OP_STAT		1				//its stat(), and stat() for -follow
+#define OP_CLOSE	2				//its closedir()
+
+//where a walk is: what it needs next, or what it waits for
+#define WALK_OPEN	0				//needs opening
+#define WALK_STAT	1				//has entries left to stat()
+#define WALK_WAIT	2				//waits for the last stat()s of a batch
+#define WALK_CLOSE	3				//needs closing
+#define WALK_BUSY	4				//waits for its open or close
+
+//a directory being searched by --async, a coroutine in explicit states
+struct walk {
+	struct query *q;
+	int state;						//WALK_*
+	void *dir;						//from the backend's opendir()
+	struct batch entries;			//the batch being stat()ed
+	struct marks m;					//its marks
+	int next;						//next entry of "entries" to stat()
+	int pending;					//stat()s issued and not yet back
+	int start;						//YES for the starting path
+	struct walk *below;				//next on the ready stack
+	char path[];
+};
+
+//one blocking call, made on a helper thread for the --async driver
+struct async_op {
+	struct job job;					//first, for helper.c
+	int kind;						//OP_*
+	struct walk *w;
+	int i;							//entry of w->entries, for OP_STAT
+	int rv, err;					//what the call returned, and errno
+	struct stat info;
+	struct pathbuf path;			//holds the entry's path, for OP_STAT
+	char *full_path;				//from construct_path(), or NULL
+	struct async_op *next_free;
+};
+
+//a worker's own state; its output buffers are separate mappings
+struct worker_state {
+	struct counters count;
+	int depth;						//directories open in process_dir()
+	int levels;						//path buffers allocated
+	struct pathbuf **paths;			//one per depth, reused
+	struct outbuf *out;				//one per output; stdout's from
+									//huge_alloc()
+	struct lineage *task;			//of the task running, or NULL
+	long task_start;				//when it started, ns, with --stats
+	long busy;						//ns spent running tasks
+	long critical;					//longest task chain ending here, ns
+	long first_match;				//ns from the start, 0 until one
+	struct top_heap top;			//the best matches, with --top
+	struct group_table groups;		//the totals, with --group-by
+	struct idx_list index;			//the entries, with --index-build
+	struct ldb_list locate;			//and with --updatedb
+} __attribute__((aligned(CACHE_LINE)));
 
 /* MAIN LOGIC FUNCTIONS */
-void searchdir(char *, char *, int);
-void process_file(char *, char *, int);
-void process_dir(char *, char *, int, DIR *);
-int check_entry(char *, int, char *, char *, mode_t);
-int recurse_directory(char *, mode_t);
+void search(char *, struct query *);
+void searchdir(char *, struct query *, long);
+void process_file(char *, struct query *);
+void process_dir(char *, struct query *, void *, long);
+int process_entry(struct pathbuf *, char *, int, struct query *, void *,
+					int);
+void process_leaf(struct pathbuf *, char *, int, int, struct query *);
+int needs_stat(struct query *, char *, int, long);
+long known_subdirs(char *, struct stat *);
+void found_entry(char *, char *, int, struct query *, struct stat *);
+void report(struct query *, char *, char *, int, struct stat *);
+int check_entry(struct query *, char *, int, struct stat *);
+int on_fstype(struct query *, char *, struct stat *);
+int in_view(struct query *, char *, char *);
+int fs_wanted(char *, struct stat *);
+int recurse_directory(int, mode_t);
+void mark_batch(struct batch *, char *, struct query *, struct marks *);
+int entry_marks(struct marks *, int);
+int name_marks(char *);
+int first_visit(struct stat *);
+void follow_link(char *, struct stat *);
+void search_archive(char *, int, struct query *);
+int visit_member(struct member *, void *);
+
+/* PARALLEL SEARCH */
+void parallel_search(char *, struct query *);
+void release_chunks();
+void submit_search(char *, int, struct query *, struct stat *);
+struct search_task *new_task(char *, int, struct query *);
+void search_task(void *);
+int submit_chunk(char *, struct batch *, struct marks *, struct query *);
+void chunk_task(void *);
+void descend(struct lineage *, int);
+void task_done(struct lineage *, long);
+void print_match(struct query *, char *, char *, struct stat *);
+long long top_key(struct stat *);
+void print_top(struct query *);
+int match_depth(char *, char *);
+void print_groups(struct query *);
+void estimate_search(char *, struct query *);
+void estimate_dir(char *, void *);
+int write_index();
+void index_search(char *, struct query *);
+int index_visit(char *, int, void *);
+int write_locate();
+int reuse_dir(char *, struct query *, struct stat *);
+void reuse_entry(char *, int, void *);
+void start_worker(int);
+void finish_worker(int);
+void flush_output(struct worker_state *);
+void print_stats();
+long now_ns();
+
+/* ASYNC SEARCH */
+void async_search(char *, struct query *);
+void start_walk(char *, struct query *);
+void issue(struct walk *, struct async_op *);
+void run_op(struct job *);
+void op_done(struct async_op *);
+void next_batch(struct walk *);
 
 /* MEMORY ALLOCATION */
-char * construct_path(char *, char *);
+struct pathbuf *path_buffer(char *);
+int start_path(struct pathbuf *, char *);
+char * construct_path(struct pathbuf *, char *);
+int reserve_path(struct pathbuf *, size_t);
 
 /* OPTION PROCESSING FUNCTIONS */
-void get_option(char **, char **, int *);
-void get_path(char **, char **, char **, int *);
+int get_option(char **, struct query *);
+int get_path(char **, char **, struct query *);
 int get_type(char);
+void get_size(char *, struct query *);
+void set_backend(char *);
+void start_visited(char *);
+void start_schedule();
+void start_mounts(struct query *);
+void start_locate(char *, struct query *);
+void huge_stdout();
+
+/* --queries AND --batch */
+void run_batch(struct query *);
+void start_totals();
+void warn_overflows();
+struct query *load_queries(char *, struct query *);
+int split_line(char *, char **, int);
+int add_output(char *);
+FILE *output_file(int);
+int close_outputs();
+void free_queries(struct query *);
 
 /* ERROR FUNCTIONS */
 void file_error(char *);
 void syntax_error();
 void type_error(char *, char *);
+void fail() __attribute__((noreturn));
+void index_error(char *) __attribute__((noreturn));
+int is_option(char *);
+int is_predicate(char *);
 
 /* FILE-SCOPE VARIABLES*/
 static char *progname;			//used for error-reporting
+static struct backend *fs = &posix_backend;	//filesystem being searched
+
+//--record and --replay settings, applied by set_backend()
+static char *record_file;
+static int record_hash = NO;
+static char *replay_file;
+static double replay_scale = 1.0;
+static char *synthetic_spec;			//--synthetic DEPTH,FANOUT,FILES
+static int search_archives = NO;		//--archives: look inside zip/tar
+static char *inode_order;				//--inode-order auto|always|never
+
+//--threads and --numa; 0 threads is the plain recursive search
+static int threads = 0;
+static int numa = NO;
+static int show_stats = NO;				//--stats
+static long run_start, run_time;		//of the search, ns, for --stats
+
+//--schedule POLICY, and the --weights files it reads and writes
+static char *schedule;
+static int policy = SCHED_DEPTH;
+static char *weights_file;
+static char *save_weights_file;
+
+//--skip-pseudo and --local-only: filesystems whose directories are not
+//searched
+static int skip_pseudo = NO;
+static int local_only = NO;
+
+//--queries FILE, a query per line, and the outputs they -fprint to: 0 is
+//stdout, the rest are opened by add_output()
+static char *queries_file;
+static int mixed_hidden = NO;			//some -no-hidden, some not
+static size_t start_len;				//of the starting path, for in_view()
+static FILE **outputs;
+static char **output_files;
+static int noutputs = 1;
+
+//--batch, and where a job that is not valid goes back to
+static int batch_mode = NO;
+static jmp_buf *job_failed;
+
+//--top N --by KEY: output only the N matches with the highest KEY, 's'
+//size, 'm' mtime or 'a' atime, or with a '-' before KEY the lowest
+static int top_n = 0;
+static char *top_by;
+static int top_field = 's';
+static int top_sign = 1;
+
+//--group-by KEY and --agg LIST: output totals of the matches by KEY, see
+//group.c
+static int group_by = NO;
+static int agg_given = NO;
+
+//--estimate PCT: estimate the matches and bytes to within PCT percent,
+//from at most --probes random probes, see estimate.c
+static double estimate_pct = 0;
+static long estimate_probes = 0;
+
+//--index-build FILE: write a name index of the tree instead of output;
+//--index FILE: search one instead of the tree, see nameidx.c
+static char *index_build_file;
+static char *index_file;
+
+//--updatedb FILE: write a locate database of the tree instead of output,
+//reusing the directories of the last one that have not changed
+static char *updatedb_file;
+
+//-unique, -follow, and --visited-filter MB for a bounded visited set
+static int unique = NO;
+static int follow = NO;
+static long visited_mb = 0;
+
+//--async N: calls outstanding at once, and the walks with calls to make
+static int async_ops = 0;
+static struct walk *ready;						//a stack, for depth-first
+static long async_calls;						//for --stats
+
+//chunks queued and not yet started, and those free for reuse
+static int chunks_queued;
+static struct chunk *free_chunks;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct worker_state *states[POOL_MAX];	//one per worker
+static struct worker_state solo;				//for the plain search
+static __thread struct worker_state *local = &solo;	//the caller's own
 
 /*
  * main()
@@ -64,55 +531,139 @@ static char *progname;			//used for error-reporting
  *  Return: 0 on success, exits 1 and prints message to stderr on other
  *			failures (see corresponding functions for more info).
  *    Note: Options are processed with the help of two functions, get_path()
- *			and get_option(). The program exits if more than six command line
- *			arguments exist, as that would be a syntax error (1 program name,
- *			1 start path, max 2 args for -name, and max 2 args for -type.)
+ *			and get_option().
  *
  *			On invalid or missing arguments, these functions will print an
  *			error and exit(1). Option processing is done by going through
- *			char **av. On path processing, av is incremented once (av++)
- *			after the if/else block as the path is one argument. For options,
- *			av is incremented twice, once in get_option to cycle past the
- *			"-option" flag, and the av++ after the if/else block to iterate
- *			past the value for the option.
+ *			char **av. On path processing, av is incremented once as the
+ *			path is one argument. For options, av is advanced by the number
+ *			of arguments get_option() consumed: two for an option with a
+ *			value, one for a flag like --record-hash.
+ *
+ *			With --batch there is no path; the searches come from stdin,
+ *			see run_batch().
  */
 int main (int ac, char **av)
 {
 	//variables set to default values for user options
 	char *path = NULL;
-	char *name = NULL;
-	int type = 0;
+	struct query q = { NULL, 0, 0, 0, 0, 0, NULL, 0, NULL, NULL };
+	struct query *queries = &q;					//or those of --queries
 
 	progname = *av++;							//initialize to program name
 
-	if(ac > 6)
-		syntax_error();							//syntax error, see above
+	if(ac < 2)
+		syntax_error();							//no starting path
 
 	while (*av)									//process command-line args
 	{
 		if (!path)								//no starting_path given
-			get_path(av, &path, &name, &type);	//exit(1) if not valid
+			av += get_path(av, &path, &q);		//exit(1) if not valid
 		else									//check args are valid options
-			get_option(av++, &name, &type);		//exit(1) if not valid
-
-		av++;
+			av += get_option(av, &q);			//exit(1) if not valid
 	}
 
+	if (path && batch_mode)
+	{
+		fprintf(stderr, "%s: --batch reads its starting paths from stdin\n",
+				progname);
+		exit(1);
+	}
+	start_totals();								//exit(1) if not valid
 	if (path)									//if path was specified
-		searchdir(path, name, type);			//perform find there
+	{
+		if (queries_file)
+			queries = load_queries(queries_file, &q);	//exit(1) if not valid
+		set_backend(path);						//--record/--replay, if any
+		if (unique || follow)
+			start_visited(path);
+		start_schedule();						//--schedule and --weights
+		start_mounts(queries);					//-fstype and the like
+		if (updatedb_file)
+			start_locate(path, queries);		//exit(1) if not valid
+		if (huge_enabled() && ! threads)
+			huge_stdout();						//output buffer on a huge page
+		run_start = show_stats ? now_ns() : 0;
+		search(path, queries);					//perform find there
+		run_time = show_stats ? now_ns() - run_start : 0;
+		if (top_n)
+			print_top(queries);					//the matches kept
+		else if (group_by)
+			print_groups(queries);				//and the totals
+	}
+	else if (batch_mode)
+		run_batch(&q);							//a search per line of stdin
 	else
 		syntax_error();							//otherwise, syntax error
 
+	if (close_outputs() == -1)					//a -fprint file failed
+		return 1;
+	if (record_finish() == -1)					//trace could not be written
+	{
+		file_error(record_file);
+		return 1;
+	}
+	if (index_build_file && write_index() == -1)
+	{
+		file_error(index_build_file);
+		return 1;
+	}
+	if (updatedb_file && write_locate() == -1)
+	{
+		file_error(updatedb_file);
+		return 1;
+	}
+	if (save_weights_file && sched_save(save_weights_file) == -1)
+	{
+		file_error(save_weights_file);
+		return 1;
+	}
+	sched_free();
+
+	if (show_stats)
+		print_stats();
+
+	if ((unique || follow) && ! batch_mode)		//run_batch() has its own
+	{
+		warn_overflows();
+		visited_free();
+	}
+	fs_free();
+	if (queries_file)
+		free_queries(queries);
+
 	return 0;
 }
 
+/*
+ * search()
+ * Purpose: search from the starting path "path" for the queries "q", on
+ *			the workers of --threads, with --async, or here
+ */
+void search(char *path, struct query *q)
+{
+	start_len = strlen(path);
+	if (group_by)
+		group_start();							//the time ages count from
+	if (estimate_pct)
+		estimate_search(path, q);				//probe it, instead
+	else if (index_file)
+		index_search(path, q);					//or look it up
+	else if (threads)
+		parallel_search(path, q);				//perform find on workers
+	else if (async_ops)
+		async_search(path, q);					//on one thread and helpers
+	else
+		searchdir(path, q, -1);					//perform find there
+}
+
 /*
  * searchdir()
  * Purpose: Recursively search a directory, filtering output based on
- *			optional findme and type parameters.
+ *			the optional criteria in q.
  *   Input: dirname, path of the current directory to search
- * 			findme, the pattern to look for/match against
- * 			type, the kind of file to search for
+ * 			q, the criteria to match against
+ *			subdirs, how many subdirectories it has, or -1 if unknown
  *  Output: searchdir() calls on two helper functions -- process_file()
  *			and process_dir() -- to match a file/entries within a directory
  *			to the, optionally, specified criteria. If they match, those
@@ -123,17 +674,17 @@ int main (int ac, char **av)
  *			a file. Otherwise, it iterates recursively though all entries in
  *			the directory with help of process_dir().
  */
-void searchdir(char *dirname, char *findme, int type)
+void searchdir(char *dirname, struct query *q, long subdirs)
 {
-	DIR* current_dir = opendir(dirname);		//attempt to open dir
+	void *current_dir = fs->opendir(dirname);	//attempt to open dir
 
 	if ( current_dir == NULL )					//couldn't open dir
-		process_file(dirname, findme, type);	//try using 'dirname' as file
+		process_file(dirname, q);				//try using 'dirname' as file
 	else
-		process_dir(dirname, findme, type, current_dir);
+		process_dir(dirname, q, current_dir, subdirs);
 
 	if(current_dir)
-		closedir(current_dir);					//prevent memory leaks
+		fs->closedir(current_dir);				//prevent memory leaks
 
 	return;
 }
@@ -142,8 +693,7 @@ void searchdir(char *dirname, char *findme, int type)
  *	process_file()
  *	Purpose: Check to see if "dirname" references a file instead of a dir.
  *	  Input: dirname, used as the name of a file
- * 			 findme, the pattern to look for/match against
- * 			 type, the kind of file to search for
+ * 			 q, the criteria to match against
  *	 Return: If "dirname" is a file that matches the criteria, the name
  *			 will be printed to stdout. In all other cases, the function
  *			 returns.
@@ -153,12 +703,15 @@ void searchdir(char *dirname, char *findme, int type)
  *			 See man page for opendir for kinds of possible errors. Most
  *			 common cases are EACCES and ENOENT errors.
  */
-void process_file(char *dirname, char *findme, int type)
+void process_file(char *dirname, struct query *q)
 {
 	struct stat info;
+	int open_errno = errno;		//why opendir() failed
+	char *base;					//last component, for -hidden
+	int marks;
 
 	//get stat on starting path "file"
-	if (lstat(dirname, &info) == -1)
+	if (fs->stat(NULL, 0, dirname, &info) == -1)
 	{
 		file_error(dirname);
 		return;
@@ -167,13 +720,20 @@ void process_file(char *dirname, char *findme, int type)
 	//check to see if it dirname is actually a directory
 	if(S_ISDIR(info.st_mode))
 	{
+		errno = open_errno;
 		file_error(dirname);	//it was a dir, output errno from opendir()
 		return;
 	}
 
 	//filter start path/file according to criteria
-	if (check_entry(findme, type, dirname, dirname, info.st_mode))
-		printf("%s\n", dirname);
+	base = strrchr(dirname, '/');
+	base = base ? base + 1 : dirname;
+	marks = name_marks(base);
+	report(q, dirname, base, marks, &info);
+
+	//search inside the start file if it is an archive
+	if (search_archives && S_ISREG(info.st_mode) && archive_type(dirname))
+		search_archive(dirname, archive_type(dirname), q);
 
 	return;
 }
@@ -182,304 +742,2889 @@ void process_file(char *dirname, char *findme, int type)
  *	process_dir()
  *	Purpose: Check all entries in an open directory and match against criteria
  *	  Input: dirname, path of the current directory to search
- * 			 findme, the pattern to look for/match against
- * 			 type, the kind of file to search for
- *			 search, pointer to the directory from call to opendir()
+ * 			 q, the criteria to match against
+ *			 search, the directory handle from the backend's opendir()
  *	 Return: For each directory entry read, if it matches the 'find' criteria
  *			 the full path to that entry will be printed to stdout.
- *   Errors: If lstat() has a problem reading the file at 'full_path', the
- *			 errno that lstat() generates will be output by calling the helper
- *			 function file_error().
+ *   Errors: If the directory cannot be read to the end, the errno from the
+ *			 backend is output by calling the helper function file_error().
+ *	 Method: Entries are read from the backend a batch at a time and
+ *			 marked by mark_batch(), which also masks out those that are
+ *			 neither output nor searched. Each of the rest is handed to
+ *			 process_entry() with its marks, or to process_leaf() if
+ *			 needs_stat() says so, which it may once "subdirs" (-1 if not
+ *			 known) have been found. With --threads, the batches after
+ *			 the first CHUNK_AFTER may go to submit_chunk() instead.
  */
-void process_dir(char *dirname, char *findme, int type, DIR *search)
+void process_dir(char *dirname, struct query *q, void *search, long subdirs)
 {
-	struct dirent *dp = NULL;			//pointer to directory entry
-	struct stat info;					//file info
-	char *full_path = NULL;				//store full path
+	struct batch entries;				//batch of directory entries
+	struct marks m;						//its dot, dotdot and hidden entries
+	struct pathbuf *dir;				//paths of the entries
+	int i, n, batches = 0;
 
-	//read through entries
-	while( (dp = readdir(search)) != NULL )
+	local->count.dirs++;
+	if ((dir = path_buffer(dirname)) == NULL)
 	{
-		//turn parent/child into a single pathname
-		full_path = construct_path(dirname, dp->d_name);
+		file_error(dirname);			//no memory for the paths
+		return;
+	}
+	local->depth++;
 
-		if (lstat(full_path, &info) == -1)		//problem reading file
+	//read through entries
+	while( (n = fs->readdir(search, &entries)) > 0 )
+	{
+		mark_batch(&entries, dirname, q, &m);
+		if (threads && ++batches > CHUNK_AFTER
+				&& submit_chunk(dirname, &entries, &m, q))
+			continue;							//another worker may
+		for (i = 0; i < n; i++)
 		{
-			file_error(full_path);				//output errno
-			continue;
+			if (m.skip[i / 64] >> (i % 64) & 1)
+				continue;
+			if (! needs_stat(q, entries.name[i], entries.type[i], subdirs))
+				process_leaf(dir, entries.name[i], entry_marks(&m, i),
+							entries.type[i], q);
+			else if (process_entry(dir, entries.name[i], entry_marks(&m, i),
+							q, search, i) && subdirs > 0)
+				subdirs--;
 		}
-
-		//filter start path/file according to criteria
-		if (check_entry(findme, type, dirname, dp->d_name, info.st_mode))
-			printf("%s\n", full_path);
-
-		//check if 'd_name' is dir and should recurse -- NO for '.' & '..'
-		if ( recurse_directory(dp->d_name, info.st_mode) == YES )
-			searchdir(full_path, findme, type);
-
-		if(full_path != NULL)
-			free(full_path);		//prevent memory leaks
 	}
 
+	if (n == -1)
+		file_error(dirname);			//readdir() failed part way
+
+	local->depth--;
 	return;
 }
 
 /*
- *	check_entry()
- *	Purpose: Compare the current file/directory entry again matching criteria
- *	  Input: findme, the pattern to look for/match against
- * 			 type, the kind of file to search for
- *			 dirname, the name of the current directory we are in
- *			 fname, the name of the current entry being checked
- *			 mode, the file type for "fname"
- *	 Return: NO, if matching criteria are specified and "fname" does not match
- *			 NO, if fname is the "." or ".." entry and the directory is not
- *				 a "." or ".."
- *			 YES, for all other cases
+ *	process_entry()
+ *	Purpose: Stat one directory entry, print it if it matches the criteria,
+ *			 and recurse into it if it is a subdirectory
+ *	  Input: dir, the path buffer of the directory the entry is in
+ *			 d_name, name of the entry
+ *			 marks, its MARK_* bits from mark_batch()
+ * 			 q, the criteria to match against
+ *			 search, the directory handle the entry was read from, or
+ *			 NULL to stat() it by path, as chunks do
+ *			 i, the index of the entry in the batch last read from "search"
+ *	 Return: YES if it is a subdirectory ("." and ".." are not), else NO
+ *   Errors: If lstat() has a problem reading the file at 'full_path', the
+ *			 errno that lstat() generates will be output by calling the helper
+ *			 function file_error().
  */
-int
-check_entry(char *findme, int type, char *dirname, char *fname, mode_t mode)
+int process_entry(struct pathbuf *dir, char *d_name, int marks,
+					struct query *q, void *search, int i)
 {
-	//check if name is specified and filter if no match
-	if(findme && fnmatch(findme, fname, FNM_PERIOD) != 0)
-		return NO;
+	int subdir;
+	struct stat info;					//file info
+	char *full_path;					//in "dir", valid until the next entry
 
-	//check if type is specified and filter if no match
-	if( (type != 0) && ((S_IFMT & mode) != (unsigned) type) )
-		return NO;
+	//turn parent/child into a single pathname
+	full_path = construct_path(dir, d_name);
+	local->count.entries++;
 
-	if (strcmp(fname, "..") == 0 && strcmp(fname, dirname) != 0)
+	if (full_path == NULL)						//no memory for the path
+	{
+		file_error(d_name);
 		return NO;
+	}
 
-	if (strcmp(fname, ".") == 0 && strcmp(fname, dirname) != 0)
+	if (fs->stat(search, i, full_path, &info) == -1)	//problem reading file
+	{
+		file_error(full_path);					//output errno
 		return NO;
+	}
+	subdir = S_ISDIR(info.st_mode) && ! (marks & (MARK_DOT | MARK_DOTDOT));
 
-	return YES;
+	//with -follow, a symbolic link stands for what it points to
+	if (follow && S_ISLNK(info.st_mode))
+		follow_link(full_path, &info);
+
+	found_entry(full_path, d_name, marks, q, &info);
+	return subdir;
 }
 
 /*
- * recurse_directory()
- * Purpose: check if the given directory entry is one we need to recurse
- *   Input: name, the current entry in the directory
- * 			mode, the current mode/type of file
- *  Return: NO, the file mode is not a directory. Or, the file is a directory
- * 				but it is either the current, ".", or parent, "..", entry.
- *			YES, the entry is a subdirectory that we should recursively search
+ *	process_leaf()
+ *	Purpose: print a directory entry that needs_stat() has said is no
+ *			 directory and needs no stat(), if it matches the criteria
+ *	  Input: as process_entry(), and type, its DT_* type, which may be
+ *			 DT_UNKNOWN
+ *	 Method: found_entry() is given a stat with only the file type set,
+ *			 from "type", or 0 for unknown (not a directory, nor anything
+ *			 else that -type or --archives would look at).
  */
-int recurse_directory(char *name, mode_t mode)
+void process_leaf(struct pathbuf *dir, char *d_name, int marks, int type,
+					struct query *q)
 {
-	//if the file isn't a directory, the current ".", or parent ".." dir
-	if (! S_ISDIR(mode) || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-		return NO;
+	struct stat info;
+	char *full_path = construct_path(dir, d_name);
 
-	//all other cases, the file is a subdirectory to recursively search
-	return YES;
+	local->count.entries++;
+	local->count.unstatted++;
+	if (full_path == NULL)						//no memory for the path
+	{
+		file_error(d_name);
+		return;
+	}
+
+	memset(&info, 0, sizeof info);
+	info.st_mode = type == DT_UNKNOWN ? 0 : DTTOIF(type);
+	found_entry(full_path, d_name, marks, q, &info);
 }
 
 /*
- *	get_option()
- *	Purpose: process command line options
- *	  Input: args, the array pointer to command-line arguments
- *			 name, pointer to store specified user
- *			 type, pointer to store specified file type
- *	 Return: None. This function passes through pointers from main
- *			 to store the variables.
- *	 Errors: If there is an invalid option (not -name or -type), missing value,
- *			 or an option has already been declared, type_error() is called
- *			 to output a message to stderr and exit with a non-zero status.
- *			 See also, errors above for invalid input.
- *	   Note: Each option that appears, must have a corresponding value.
- *			 The order the options appear in does not matter, but they can
- *			 only appear once.
+ *	needs_stat()
+ *	Purpose: tell whether a directory entry must be stat()ed
+ *	  Input: q, the criteria, or the first of --queries
+ *			 d_name, its name, and type, its DT_* type or DT_UNKNOWN
+ *			 subdirs, the subdirectories of its directory not found yet,
+ *			 or -1 if not known
+ *	 Return: NO if all the search needs to know is whether it is a
+ *			 directory, and that is known: it is not
+ *	 Method: -size, -fstype, -unique, -follow, --top and --estimate
+ *			 need a stat() of every entry, in any query, and so does
+ *			 --group-by unless it needs no more than the name and depth.
+ *			 So does --record, whose trace holds only what was stat()ed,
+ *			 for --replay to find.
+ *			 Otherwise a known type that is not DT_DIR is enough, and
+ *			 with none, so is there being no subdirectory left, as long
+ *			 as neither -type nor --archives would want the type. The
+ *			 one stat() serves every query.
  */
-void get_option(char **args, char **name, int *type)
+int needs_stat(struct query *q, char *d_name, int type, long subdirs)
 {
-	char *option = *args++;				//store option, then point to next arg
-	char *value = *args;				//store value for option (if any)
+	int typed = NO;
 
-	//the name option, not previously declared
-	if (strcmp(option, "-name") == 0 && (*name == NULL))
-	{
-		if( value )											//option exists
-			*name = value;
-		else
-			type_error(option, value);						//missing arg
-	}
-	//the type option, not previously declared
-	else if (strcmp(option, "-type") == 0 && *type == 0)
-	{
-		if (value)											//option exists
-			*type = get_type(value[0]);
-		else
-			type_error(option, value);						//missing arg
-	}
-	//either an unknown predicate, or is repeat of -name or -type
-	else
+	if (unique || follow || top_n || estimate_pct || record_file
+			|| (group_by && group_needs_stat()))
+		return YES;
+	for (; q; q = q->next)
 	{
-		type_error(option, value);
+		if (q->size_cmp || q->fstype)
+			return YES;
+		typed = typed || q->type;
 	}
+	if (type != DT_UNKNOWN)
+		return type == DT_DIR;
+	return subdirs != 0 || typed
+			|| (search_archives && archive_type(d_name));
+}
 
-	return;
+/*
+ *	known_subdirs()
+ *	Return: how many subdirectories the directory "path", of stat "info",
+ *			has by its link count, or -1 if the count cannot be trusted:
+ *			the filesystem does not keep it (see fstype.c), or the
+ *			search could not use it anyway
+ */
+long known_subdirs(char *path, struct stat *info)
+{
+	if (fs != &posix_backend || unique || follow || info->st_nlink < 2
+			|| ! fs_nlink_counts(path, info->st_dev))
+		return -1;
+	return info->st_nlink - 2;
 }
 
 /*
- *	get_path()
- *	Purpose: Test the command line argument to see if it is a valid path.
- *	  Input: args, the array of command line arguments
- *			 path, variable to store the specified path in
- *			 name, variable to use as placeholder for out-of-order option
- *			 type, variable to use as placeholder for out-of-order option
- *	 Return: Prints message to stderr and exit(1) on out of order options
- *			 or invalid options.
- *	 Method: If the argument does not begin with an option specifier "-",
- *			 get_path() assumes it is a valid start path and assigns it to
- *			 the path variable. Otherwise, it attempts to recreate the
- *			 behavior in 'find' by processing args first and then outputting
- *			 a "paths must precede expression" error, or general syntax
- *			 error. Ex. 'find -name foobar .'
+ *	found_entry()
+ *	Purpose: print a stat()ed entry if it matches the criteria, and search
+ *			 it if it is a subdirectory or, with --archives, an archive
+ *	  Input: full_path, the entry's path
+ *			 d_name, its name, and marks, the MARK_* bits of the name
+ * 			 q, the criteria to match against
+ *			 info, its stat, already followed with -follow
+ *	 Method: A subdirectory is searched at once by the plain search; with
+ *			 --threads it becomes a task, and with --async a walk. One on
+ *			 a filesystem fs_wanted() turns down is not searched at all.
+ *			 Either way it is searched once for all of --queries. With
+ *			 --estimate, it is only noted, for a probe to list, and with
+ *			 --updatedb it may be listed from the last database.
  */
-void get_path(char **args, char **path, char **name, int *type)
+void found_entry(char *full_path, char *d_name, int marks, struct query *q,
+					struct stat *info)
 {
-	if(*args[0] != '-')				//arg DOESN'T begin with option specifier
-		*path = *args;				//set path to the value
-	else							//arg DOES begin with option specifier '-'
-	{
-		//process options and args first, a la 'find'
-		while(*args && *args[0] == '-')
-		{
-			get_option(args, name, type);
-			args += 2;
-		}
+	//filter start path/file according to criteria
+	report(q, full_path, d_name, marks, info);
 
-		if(*args)						//assume remaining arg is start path
-		{
-			fprintf(stderr, "%s: paths must precede expression: ", progname);
-			fprintf(stderr, "%s\n", *args);
-			syntax_error();
-		}
-		else							//otherwise, general syntax error
+	//check if 'd_name' is dir and should recurse -- NO for '.' & '..'
+	if ( recurse_directory(marks, info->st_mode) == YES
+			&& fs_wanted(full_path, info)
+			&& (! follow || visited_add(info->st_dev, info->st_ino)) )
+	{
+		if (estimate_pct)
 		{
-			syntax_error();
+			if (est_subdir(full_path, info->st_nlink > 2
+							? info->st_nlink - 1 : 1) == -1)	//for a probe
+				file_error(full_path);
 		}
+		else if (updatedb_file && reuse_dir(full_path, q, info))
+			local->count.reused++;				//as the last database had it
+		else if (threads)
+			submit_search(full_path, ARCHIVE_NONE, q, info);	//another worker
+		else if (async_ops)
+			start_walk(full_path, q);
+		else
+			searchdir(full_path, q, known_subdirs(full_path, info));
 	}
 
-	return;
+	//with --archives, search inside zip and tar files too
+	if (search_archives && S_ISREG(info->st_mode) && archive_type(d_name))
+	{
+		if (threads)
+			submit_search(full_path, archive_type(d_name), q, info);
+		else
+			search_archive(full_path, archive_type(d_name), q);
+	}
 }
 
 /*
- * get_type()
- * Purpose: check to see if -type is supported, and if so, provide bitmask
- *   Input: c, the char to check
- *  Return: the bitmask associated with the -type specified. If -type is
- *			not a valid option, print message to stderr and exit.
- * Options: the following options are allowed, as per <sys/stat.h>, the
- *			'find' command, and the homework spec: {b|c|d|f|l|p|s}. See
- *			inline comments below for the types they represent.
+ *	report()
+ *	Purpose: print an entry for each query it matches
+ *	  Input: q, the query, or the first of --queries
+ *			 path, the entry's path, and name, its last component
+ *			 marks, the MARK_* bits of the name
+ *			 info, its stat
+ *	   Note: With -unique, whether the file has been output before is
+ *			 asked once, when a query first matches it, and holds for the
+ *			 rest.
  */
-int get_type(char c)
+void report(struct query *q, char *path, char *name, int marks,
+				struct stat *info)
 {
-	switch (c) {
-		case 'b':
-			return S_IFBLK;		//block special
-		case 'c':
-			return S_IFCHR;		//character special
-		case 'd':
-			return S_IFDIR;		//directory
-		case 'f':
-			return S_IFREG;		//regular file
-		case 'l':
-			return S_IFLNK;		//symbolic link
-		case 'p':
-			return S_IFIFO;		//FIFO
-		case 's':
-			return S_IFSOCK;	//socket
-		default:
-			fprintf(stderr, "%s: ", progname);
-            fprintf(stderr, "Unknown argument to -type: %c\n", c);
-			exit(1);
-	}
+	int first = -1;								//first_visit(), once asked
+
+	for (; q; q = q->next)
+		if (check_entry(q, name, marks, info) && on_fstype(q, path, info)
+				&& in_view(q, path, name)
+				&& (first == -1 ? (first = first_visit(info)) : first))
+			print_match(q, path, NULL, info);
 }
 
 /*
- *	construct_path()
- *	Purpose: concatenate a parent and child into a full path name
- *	  Input: parent, current path to the open directory
- *			 child, name of the last entry read by readdir()
- *	 Return: pointer to full path string allocated by malloc()
- *   Errors: if malloc() or sprintf() fail, return NULL. This will
- *			 cause lstat() to output an error back in process_file or
- *			 process_dir().
- *   Method: Start by malloc()ing enough memory to store the combined
- *			 path. If sucessful, call sprintf() to copy into "newstr":
- *			 1) just the parent, if parent and child are the same;
- *			 2) if parent or child has trailing or leading '/',
- *			 	respectively, do not copy an extra '/'; or
- *			 3) concatenate "parent/child"
- */
-char * construct_path(char *parent, char *child)
-{
-	int rv;
-	int path_size = 1 + strlen(parent) + 1 + strlen(child);
-	char *newstr = malloc(path_size);
-
-	//Check malloc() returned memory. If no, lstat() will output error
-	if (newstr == NULL)
-		return NULL;
+ *	check_entry()
+ *	Purpose: Compare the current file/directory entry again matching criteria
+ *	  Input: q, the criteria: -name pattern, -type, -size and -hidden
+ *			 fname, the name of the current entry being checked
+ *			 marks, its MARK_* bits, from mark_batch() or name_marks()
+ *			 info, the file info for "fname"
+ *	 Return: NO, if matching criteria are specified and "fname" does not match
+ *			 YES, for all other cases
+ *	   Note: The "." and ".." entries that are not to be output never get
+ *			 here; process_dir() leaves them out.
+ */
+int
+check_entry(struct query *q, char *fname, int marks, struct stat *info)
+{
+	long long units;
 
-	//Concatenate "parent/child", see Method above for how
-	if (strcmp(parent, child) == 0)
-		rv = sprintf(newstr, "%s", parent);
-	else if (parent[strlen(parent) - 1] == '/' || child[0] == '/')
-		rv = sprintf(newstr, "%s%s", parent, child);
-	else
-		rv = sprintf(newstr, "%s/%s", parent, child);
+	//check if name is specified and filter if no match
+	if(q->name && fnmatch(q->name, fname, FNM_PERIOD) != 0)
+		return NO;
+
+	//check if type is specified and filter if no match
+	if( (q->type != 0) && ((S_IFMT & info->st_mode) != (unsigned) q->type) )
+		return NO;
 
-	//check for sprintf error --or-- overflow error
-	if ( rv < 0 || rv > (path_size - 1) )
+	//check if size is specified, in whole units rounded up as 'find' does
+	if (q->size_cmp != 0)
 	{
-		free(newstr);		//failed to construct path
-		return NULL;		//return will cause lstat() error
+		units = (info->st_size + q->size_unit - 1) / q->size_unit;
+		if ((q->size_cmp == '+' && units <= q->size)
+				|| (q->size_cmp == '-' && units >= q->size)
+				|| (q->size_cmp == '=' && units != q->size))
+			return NO;
 	}
 
-	return newstr;
+	//-hidden wants only hidden entries, -no-hidden none
+	if (q->hidden && ((marks & MARK_HIDDEN) != 0) != (q->hidden == '+'))
+		return NO;
+
+	return YES;
 }
 
 /*
- *	file_error()
- *	Purpose: Helper function to display error message.
- *	  Input: path, the full path of the file there was an error with
- *	 Return: Prints an error message with program name, the full path,
- *			 and the error message set by errno. After printing, the
- *			 function returns to continue to search through any remaining
- *			 files.
+ *	on_fstype()
+ *	Purpose: the -fstype test, kept apart from check_entry() because it
+ *			 needs the entry's path, for the odd device whose type must
+ *			 be asked of the filesystem
+ *	 Return: YES if there is no -fstype, or "path", of stat "info", is on
+ *			 a filesystem of that type
  */
-void file_error(char *path)
+int on_fstype(struct query *q, char *path, struct stat *info)
 {
-	//example -- "./pfind: `/tmp/pft.IO8Et0': Permission denied"
-	fprintf(stderr, "%s: `%s': %s\n", progname, path, strerror(errno));
-	return;
+	return q->fstype == NULL
+			|| strcmp(fs_type(path, info->st_dev), q->fstype) == 0;
 }
 
 /*
- *	syntax_error()
- *	Purpose: Helper function to display error message and exit.
- *	 Return: This function is called when a syntax error occurs. It
- *			 displays the message and exits with value of 1.
+ *	in_view()
+ *	Purpose: the rest of -no-hidden for --queries, where a hidden
+ *			 directory is searched if any query wants what is in it
+ *	  Input: path, an entry's path, and name, its last component; with a
+ *			 name of "", the whole path is looked at
+ *	 Return: NO if "q" has -no-hidden and one of the directories "path"
+ *			 is in, below the starting path, is hidden, else YES
+ *	   Note: Unless the queries differ, mark_batch() has skipped hidden
+ *			 entries already, and this is never needed. The entry's own
+ *			 name is check_entry()'s.
  */
-void syntax_error()
+int in_view(struct query *q, char *path, char *name)
 {
-	fprintf(stderr, "usage: pfind starting_path ");
-	fprintf(stderr, "[-name filename-or-pattern] ");
-	fprintf(stderr, "[-type {f|d|b|c|p|l|s}]\n");
-	exit(1);
-}
+	size_t i, end;
+
+	if (! mixed_hidden || q->hidden != '-')
+		return YES;
+
+	//"/." ends a directory name in "path"; the one before the starting
+	//path's end may start the first below it
+	end = strlen(path) - strlen(name);
+	for (i = start_len > 0 ? start_len - 1 : 0; i + 1 < end; i++)
+		if (path[i] == '/' && path[i + 1] == '.')
+			return NO;
+	return YES;
+}
+
+/*
+ *	fs_wanted()
+ *	Purpose: tell whether the directory "path", of stat "info", is on a
+ *			 filesystem to search, by --skip-pseudo and --local-only
+ *	 Return: YES, or NO, counting it for --stats
+ */
+int fs_wanted(char *path, struct stat *info)
+{
+	int class;
+
+	if (! skip_pseudo && ! local_only)
+		return YES;
+
+	class = fs_class(path, info->st_dev);
+	if ((skip_pseudo && class == FS_PSEUDO)
+			|| (local_only && class == FS_REMOTE))
+	{
+		local->count.pruned++;
+		return NO;
+	}
+	return YES;
+}
+
+/*
+ *	search_archive()
+ *	Purpose: match the members of a zip or tar archive against criteria
+ *	  Input: path, the archive, as it would be printed
+ *			 kind, the archive type from archive_type()
+ *			 q, the criteria to match against
+ *	 Return: Each matching member is printed as "path!/member/path".
+ *   Errors: If the archive cannot be read, or is damaged part way, an
+ *			 error is printed to stderr and the search carries on.
+ */
+void search_archive(char *path, int kind, struct query *q)
+{
+	struct archive_search ctx = { path, q };
+
+	if (archive_scan(path, kind, visit_member, &ctx) == 0)
+		return;
+
+	if (errno == EINVAL)
+	{
+		local->count.errors++;
+		fprintf(stderr, "%s: `%s': damaged or unsupported archive\n",
+				progname, path);
+	}
+	else
+		file_error(path);
+}
+
+/*
+ * visit_member()
+ * Purpose: callback for archive_scan(), check one member against criteria,
+ *			those of each of --queries in turn
+ *  Return: 0, to carry on with the next member
+ *    Note: A member is on no filesystem, so never matches -fstype.
+ */
+int visit_member(struct member *m, void *arg)
+{
+	struct archive_search *ctx = arg;
+	struct stat info;
+	struct query *q;
+	int marks = name_marks(m->name);
+
+	memset(&info, 0, sizeof info);
+	info.st_mode = m->mode;
+	info.st_size = m->size;
+	info.st_mtime = m->mtime;
+
+	for (q = ctx->q; q; q = q->next)
+		if (q->fstype == NULL && check_entry(q, m->name, marks, &info)
+				&& in_view(q, ctx->path, ""))
+			print_match(q, ctx->path, m->path, &info);
+
+	return 0;
+}
+
+/*
+ *	parallel_search()
+ *	Purpose: search from "path" on a pool of --threads workers
+ *	  Input: path, the starting path
+ * 			 q, the criteria to match against
+ *	 Method: The starting path is the first task; searchdir() then submits
+ *			 a task per subdirectory and archive as it finds them, and
+ *			 pool_run() returns when there are none left.
+ */
+void parallel_search(char *path, struct query *q)
+{
+	struct pool_config cfg = { threads, numa, policy != SCHED_DEPTH,
+								start_worker, finish_worker };
+	struct search_task *t = new_task(path, ARCHIVE_NONE, q);
+	int i;
+
+	if (t)
+		pool_run(&cfg, search_task, t);
+
+	//the workers of --batch are held, and write out nothing themselves
+	//until the last job
+	for (i = 0; batch_mode && i < threads; i++)
+		if (states[i])
+			flush_output(states[i]);
+	if (! batch_mode)
+		release_chunks();
+}
+
+/*
+ * release_chunks()
+ * Purpose: free the chunks kept for reuse; no worker may be searching
+ */
+void release_chunks()
+{
+	struct chunk *c;
+
+	while ((c = free_chunks) != NULL)
+	{
+		free_chunks = c->next_free;
+		free(c->buf);
+		free(c);
+	}
+}
+
+/*
+ * submit_search()
+ * Purpose: queue a directory, or an archive of type "kind", to search;
+ *			"info" is its stat(), for the --schedule priority
+ */
+void submit_search(char *path, int kind, struct query *q, struct stat *info)
+{
+	struct search_task *t = new_task(path, kind, q);
+
+	if (t && kind == ARCHIVE_NONE)
+		t->subdirs = known_subdirs(path, info);
+	if (t && policy == SCHED_DEPTH)
+		pool_submit(search_task, t);
+	else if (t)
+		pool_submit_at(search_task, t,
+						sched_priority(policy, path, t->at.depth, info));
+}
+
+/*
+ *	new_task()
+ *	Purpose: allocate a search task, with its own copy of "path", found
+ *			 by the task running on this thread, if any
+ *	 Return: the task, or NULL
+ *	 Errors: If there is no memory for the task, the error is reported
+ *			 against "path", as a failed opendir() would be.
+ */
+struct search_task *new_task(char *path, int kind, struct query *q)
+{
+	struct search_task *t = malloc(sizeof *t + strlen(path) + 1);
+
+	if (t == NULL)
+	{
+		file_error(path);
+		return NULL;
+	}
+	t->q = q;
+	t->kind = kind;
+	t->subdirs = -1;
+	descend(&t->at, 1);
+	if (save_weights_file && kind == ARCHIVE_NONE)
+		t->at.dir = sched_dir(t->at.dir, path);
+	strcpy(t->path, path);
+	return t;
+}
+
+/*
+ * search_task()
+ * Purpose: run one task from submit_search() on a worker, and free it
+ */
+void search_task(void *arg)
+{
+	struct search_task *t = arg;
+	long entries = local->count.entries;
+
+	local->task = &t->at;
+	local->task_start = show_stats ? now_ns() : 0;
+	if (t->kind == ARCHIVE_NONE)
+		searchdir(t->path, t->q, t->subdirs);
+	else
+		search_archive(t->path, t->kind, t->q);
+	task_done(&t->at, local->count.entries - entries);
+	free(t);
+}
+
+/*
+ *	submit_chunk()
+ *	Purpose: hand a batch of a huge directory to another worker
+ *	  Input: dirname, the directory
+ *			 b, the batch, and m, its marks from mark_batch()
+ * 			 q, the criteria to match against
+ *	 Return: YES if the batch was queued as a chunk; NO if enough chunks
+ *			 are queued already, or there is no memory for one, and the
+ *			 caller is to search the batch itself
+ *	 Method: The names are copied, as the batch is only good until the
+ *			 next readdir(). Chunks are kept for reuse once searched, so
+ *			 that, with at most CHUNK_AHEAD queued per worker, a huge
+ *			 directory costs a few chunks however many entries it has.
+ *			 In a pool with priorities, chunks come before everything
+ *			 else: their directory has been started already.
+ */
+int submit_chunk(char *dirname, struct batch *b, struct marks *m,
+					struct query *q)
+{
+	struct chunk *c;
+	size_t need = strlen(dirname) + 1, len;
+	char *p;
+	int i;
+
+	if (__atomic_load_n(&chunks_queued, __ATOMIC_RELAXED)
+			>= CHUNK_AHEAD * threads)
+		return NO;
+	for (i = 0; i < b->count; i++)
+		need += strlen(b->name[i]) + 1;
+
+	pthread_mutex_lock(&chunk_lock);
+	if ((c = free_chunks) != NULL)
+		free_chunks = c->next_free;
+	pthread_mutex_unlock(&chunk_lock);
+	if (c == NULL && (c = calloc(1, sizeof *c)) == NULL)
+		return NO;
+	if (c->size < need)
+	{
+		if ((p = realloc(c->buf, need)) == NULL)
+		{
+			free(c->buf);
+			free(c);
+			return NO;
+		}
+		c->buf = p;
+		c->size = need;
+	}
+
+	c->q = q;
+	descend(&c->at, 0);
+	c->m = *m;
+	c->count = b->count;
+	c->dirname = p = c->buf;
+	p = stpcpy(p, dirname) + 1;
+	for (i = 0; i < b->count; i++, p += len + 1)
+	{
+		len = strlen(b->name[i]);
+		c->name[i] = memcpy(p, b->name[i], len + 1);
+		c->type[i] = b->type[i];
+	}
+
+	local->count.chunks++;
+	__atomic_add_fetch(&chunks_queued, 1, __ATOMIC_RELAXED);
+	pool_submit_at(chunk_task, c, LONG_MAX);
+	return YES;
+}
+
+/*
+ *	chunk_task()
+ *	Purpose: search the entries of a chunk from submit_chunk() on a
+ *			 worker, and keep the chunk for reuse
+ *	 Method: As process_dir() would, but with no directory handle: each
+ *			 entry is stat()ed by its path. Subdirectories in chunks are
+ *			 not counted against the directory's link count, so it may
+ *			 stat() more than it needs to, never fewer.
+ */
+void chunk_task(void *arg)
+{
+	struct chunk *c = arg;
+	struct pathbuf *dir;
+	long entries = local->count.entries;
+	int i;
+
+	__atomic_sub_fetch(&chunks_queued, 1, __ATOMIC_RELAXED);
+	local->task = &c->at;
+	local->task_start = show_stats ? now_ns() : 0;
+
+	if ((dir = path_buffer(c->dirname)) == NULL)
+		file_error(c->dirname);			//no memory for the paths
+	else
+	{
+		local->depth++;
+		for (i = 0; i < c->count; i++)
+		{
+			if (c->m.skip[i / 64] >> (i % 64) & 1)
+				continue;
+			if (! needs_stat(c->q, c->name[i], c->type[i], -1))
+				process_leaf(dir, c->name[i], entry_marks(&c->m, i),
+							c->type[i], c->q);
+			else
+				process_entry(dir, c->name[i], entry_marks(&c->m, i),
+							c->q, NULL, 0);
+		}
+		local->depth--;
+	}
+	task_done(&c->at, local->count.entries - entries);
+
+	pthread_mutex_lock(&chunk_lock);
+	c->next_free = free_chunks;
+	free_chunks = c;
+	pthread_mutex_unlock(&chunk_lock);
+}
+
+/*
+ * descend()
+ * Purpose: fill in "at" for a task submitted by the one running on this
+ *			thread, if any: "deeper" levels below it, on the critical path
+ *			through it, and in its directory for --save-weights
+ */
+void descend(struct lineage *at, int deeper)
+{
+	struct lineage *up = local->task;
+
+	at->depth = up ? up->depth + deeper : 0;
+	at->cp_start = up && show_stats ? up->cp_start
+									+ (now_ns() - local->task_start) : 0;
+	at->dir = up ? up->dir : NULL;
+}
+
+/*
+ * task_done()
+ * Purpose: account for the task that has just run on this thread, which
+ *			stat()ed "entries" entries
+ *	 Note: With --stats, the task's time ends a chain of tasks, each
+ *			submitted by the one before, of length cp_start plus that
+ *			time; the worker keeps the longest it has seen.
+ */
+void task_done(struct lineage *at, long entries)
+{
+	long took;
+
+	sched_entries(at->dir, entries);
+	if (show_stats)
+	{
+		took = now_ns() - local->task_start;
+		local->busy += took;
+		if (at->cp_start + took > local->critical)
+			local->critical = at->cp_start + took;
+	}
+	local->task = NULL;
+}
+
+/*
+ *	print_match()
+ *	Purpose: output one match of query "q" to its output, "path", or
+ *			 "path!/member" for an archive member; "info" is its stat, for
+ *			 --top, which keeps the best matches to output at the end
+ *	 Method: The plain search prints with fprintf(). A worker appends to
+ *			 its own buffer for the output instead, writing it out first
+ *			 if the line would not fit; fwrite() locks the file for the
+ *			 whole buffer, so lines are never split between workers.
+ *			 With --top, each thread offers the match to its own heap
+ *			 (topn.c), and print_top() merges them; with --group-by, it
+ *			 adds it to its own table of totals (group.c), and
+ *			 print_groups() merges those. With --estimate, it is only
+ *			 counted in the directory being listed, and with
+ *			 --index-build or --updatedb kept in the thread's list for
+ *			 write_index() or write_locate().
+ */
+void print_match(struct query *q, char *path, char *member,
+					struct stat *info)
+{
+	struct worker_state *ws = local;
+	struct outbuf *ob;
+	FILE *fp = output_file(q->out);
+	size_t plen, mlen;
+	char *name;
+
+	ws->count.matches++;
+	if (show_stats && ws->first_match == 0)
+		ws->first_match = now_ns() - run_start;
+	if (estimate_pct)
+	{
+		est_match(info->st_size);				//in the directory listed
+		return;
+	}
+	if (index_build_file)
+	{
+		if (idx_add(&ws->index, path, member, info->st_mode) == -1)
+			file_error(path);					//no memory to keep it
+		return;
+	}
+	if (updatedb_file)
+	{
+		if (ldb_add(&ws->locate, path, info) == -1)
+			file_error(path);
+		return;
+	}
+	if (top_n)
+	{
+		if (top_offer(&ws->top, top_n, top_key(info), path, member) == -1)
+			file_error(path);					//no memory to keep it
+		return;
+	}
+	if (group_by)
+	{
+		name = member ? member : path;			//the last component, for
+		if (strrchr(name, '/'))					//its extension
+			name = strrchr(name, '/') + 1;
+		if (group_add(&ws->groups, name, match_depth(path, member),
+						info) == -1)
+			file_error(path);					//no memory for the group
+		return;
+	}
+	if (threads == 0)
+	{
+		if (member)
+			fprintf(fp, "%s!/%s\n", path, member);
+		else
+			fprintf(fp, "%s\n", path);
+		return;
+	}
+
+	ob = &ws->out[q->out];
+	plen = strlen(path);
+	mlen = member ? strlen(member) + 2 : 0;
+	if (ob->len + plen + mlen + 1 > ob->size)
+	{
+		fwrite(ob->buf, 1, ob->len, fp);
+		ob->len = 0;
+	}
+
+	if (plen + mlen + 1 > ob->size)				//longer than the buffer
+	{
+		flockfile(fp);
+		if (member)
+			fprintf(fp, "%s!/%s\n", path, member);
+		else
+			fprintf(fp, "%s\n", path);
+		funlockfile(fp);
+		return;
+	}
+
+	memcpy(ob->buf + ob->len, path, plen);
+	ob->len += plen;
+	if (member)
+	{
+		memcpy(ob->buf + ob->len, "!/", 2);
+		memcpy(ob->buf + ob->len + 2, member, mlen - 2);
+		ob->len += mlen;
+	}
+	ob->buf[ob->len++] = '\n';
+}
+
+/*
+ * top_key()
+ * Return: the --top key of a match of stat "info", higher to be output
+ *		   first: its size or a time in ns, negated for --by -KEY
+ */
+long long top_key(struct stat *info)
+{
+	long long key;
+
+	if (top_field == 's')
+		key = info->st_size;
+	else if (top_field == 'm')
+		key = info->st_mtim.tv_sec * 1000000000LL + info->st_mtim.tv_nsec;
+	else
+		key = info->st_atim.tv_sec * 1000000000LL + info->st_atim.tv_nsec;
+	return key * top_sign;
+}
+
+/*
+ *	print_top()
+ *	Purpose: for --top, output the best matches of the search just over,
+ *			 best first, each as "KEY PATH", to the output of query "q"
+ *	 Method: The heaps of all threads are merged into one, which keeps
+ *			 the best --top of all; each is left empty for the next search
+ *			 of --batch. A size is printed in bytes, a time as the local
+ *			 date and time.
+ */
+void print_top(struct query *q)
+{
+	struct top_heap all;
+	FILE *fp = output_file(q->out);
+	char when[64];
+	long long key;
+	time_t t;
+	struct tm tm;
+	int i;
+
+	memset(&all, 0, sizeof all);
+	if (top_merge(&all, &solo.top) == -1)
+		file_error("--top");
+	for (i = 0; i < POOL_MAX; i++)
+		if (states[i] && top_merge(&all, &states[i]->top) == -1)
+			file_error("--top");
+	top_sort(&all);
+
+	for (i = 0; i < all.count; i++)
+	{
+		key = all.items[i].key * top_sign;
+		if (top_field == 's')
+		{
+			fprintf(fp, "%lld %s\n", key, all.items[i].path);
+			continue;
+		}
+		t = key / 1000000000LL - (key % 1000000000LL < 0);
+		if (localtime_r(&t, &tm) == NULL
+				|| strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &tm) == 0)
+			snprintf(when, sizeof when, "%lld", (long long) t);
+		fprintf(fp, "%s %s\n", when, all.items[i].path);
+	}
+	top_free(&all);
+}
+
+/*
+ *	match_depth()
+ *	Return: the levels a match is below the starting path, for --group-by
+ *			depth: its path's '/'s past the starting path, and one more
+ *			for an archive "member", and one per '/' in it
+ *	   Note: The starting path is 0 even if it ends in '/', and that '/'
+ *			 is the first of the rest otherwise.
+ */
+int match_depth(char *path, char *member)
+{
+	size_t i, len = strlen(path);
+	int depth = 0;
+
+	for (i = start_len > 0 ? start_len - 1 : 0; len > start_len && i < len;
+			i++)
+		depth += path[i] == '/';
+	for (; member && *member; member++)
+		depth += *member == '/';
+	return depth + (member != NULL);
+}
+
+/*
+ *	print_groups()
+ *	Purpose: for --group-by, output the table of totals of the search
+ *			 just over, to the output of query "q"
+ *	 Method: The tables of all threads are added into one; each is left
+ *			 empty for the next search of --batch.
+ */
+void print_groups(struct query *q)
+{
+	struct group_table all;
+	int i;
+
+	memset(&all, 0, sizeof all);
+	if (group_merge(&all, &solo.groups) == -1)
+		file_error("--group-by");
+	for (i = 0; i < POOL_MAX; i++)
+		if (states[i] && group_merge(&all, &states[i]->groups) == -1)
+			file_error("--group-by");
+	if (group_print(output_file(q->out), &all) == -1)
+		file_error("--group-by");
+	group_free(&all);
+}
+
+/*
+ *	estimate_search()
+ *	Purpose: --estimate, print estimates of the matches below "path" of
+ *			 query "q", and of their total size, each with the half width
+ *			 of its 95% confidence interval
+ *	 Method: estimate() chooses the directories to list, and lists each
+ *			 with estimate_dir(): searchdir() as ever, but matches are
+ *			 counted rather than printed, and subdirectories noted rather
+ *			 than searched, see print_match() and found_entry().
+ */
+void estimate_search(char *path, struct query *q)
+{
+	struct est_result r;
+
+	if (estimate(path, estimate_dir, q, estimate_pct,
+				estimate_probes ? estimate_probes : PROBES_MAX, &r) == -1)
+	{
+		file_error(path);
+		return;
+	}
+	if (r.exact)
+	{
+		printf("matches: %.0f (exact)\nbytes: %.0f (exact)\n", r.matches,
+				r.bytes);
+	}
+	else
+	{
+		printf("matches: %.0f +- %.0f (%.1f%%)\n", r.matches,
+				r.matches_error, r.matches ? 100 * r.matches_error
+				/ r.matches : 0);
+		printf("bytes: %.0f +- %.0f (%.1f%%)\n", r.bytes, r.bytes_error,
+				r.bytes ? 100 * r.bytes_error / r.bytes : 0);
+	}
+	printf("probes: %ld, directories read: %ld\n", r.probes, r.dirs);
+}
+
+/*
+ * estimate_dir()
+ * Purpose: estimate() hook, list the directory "path" for query "arg"
+ */
+void estimate_dir(char *path, void *arg)
+{
+	searchdir(path, arg, -1);
+}
+
+/*
+ *	write_index()
+ *	Purpose: --index-build, write the entries the search found, those of
+ *			 every thread, to the index file
+ *	 Return: 0, or -1 with errno set if it cannot be written
+ */
+int write_index()
+{
+	struct idx_list all;
+	int i, rv;
+
+	memset(&all, 0, sizeof all);
+	rv = idx_merge(&all, &solo.index);
+	for (i = 0; i < POOL_MAX && rv == 0; i++)
+		if (states[i])
+			rv = idx_merge(&all, &states[i]->index);
+	if (rv == 0)
+		rv = idx_write(&all, index_build_file);
+	idx_free(&all);
+	return rv;
+}
+
+/*
+ *	write_locate()
+ *	Purpose: --updatedb, write the entries every thread found to the
+ *			 database, then release the last one
+ *	 Return: 0, or -1 with errno set if it cannot be written
+ */
+int write_locate()
+{
+	struct ldb_list all;
+	int i, rv;
+
+	memset(&all, 0, sizeof all);
+	rv = ldb_merge(&all, &solo.locate);
+	for (i = 0; i < POOL_MAX && rv == 0; i++)
+		if (states[i])
+			rv = ldb_merge(&all, &states[i]->locate);
+	if (rv == 0)
+		rv = ldb_write(&all);
+	ldb_free(&all);
+	ldb_close();
+	return rv;
+}
+
+/*
+ *	reuse_dir()
+ *	Purpose: --updatedb, search the directory "path", of stat "info", for
+ *			 query "q" from the last database instead of reading it, if
+ *			 it has not changed since
+ *	 Return: YES if it had not, else NO, for it to be read
+ *	 Method: Its files are taken as they are, as process_leaf() takes an
+ *			 entry of no known type, and its subdirectories stat()ed by
+ *			 process_entry(), and searched or reused in turn.
+ */
+int reuse_dir(char *path, struct query *q, struct stat *info)
+{
+	struct reuse_search ctx;
+	int reused;
+
+	if ((ctx.dir = path_buffer(path)) == NULL)
+		return NO;								//read it, then
+	ctx.q = q;
+	local->depth++;
+	reused = ldb_reuse(path, info, reuse_entry, &ctx);
+	local->depth--;
+	return reused;
+}
+
+/*
+ * reuse_entry()
+ * Purpose: ldb_reuse() callback, search the entry "name" of the directory
+ *			being reused, a subdirectory if "subdir"
+ */
+void reuse_entry(char *name, int subdir, void *arg)
+{
+	struct reuse_search *ctx = arg;
+
+	if (subdir)
+		process_entry(ctx->dir, name, name_marks(name), ctx->q, NULL, 0);
+	else
+		process_leaf(ctx->dir, name, name_marks(name), DT_UNKNOWN, ctx->q);
+}
+
+/*
+ *	index_search()
+ *	Purpose: --index, search the index file for what a search from "path"
+ *			 for query "q" would find, without reading the tree
+ *	 Method: idx_search() narrows the entries down by the trigrams of
+ *			 -name, and index_visit() checks each as the walk would.
+ *	 Errors: An index that cannot be read, or -fstype, which it cannot
+ *			 answer, is reported, and pfind exits 1.
+ */
+void index_search(char *path, struct query *q)
+{
+	struct index_search ctx = { path, q };
+	struct name_index *ix;
+	int err;
+
+	if (q->fstype)
+	{
+		fprintf(stderr, "%s: --index cannot be used with -fstype\n",
+				progname);
+		exit(1);
+	}
+	if ((ix = idx_open(index_file)) == NULL)
+		index_error(index_file);
+	if (idx_search(ix, q->name, index_visit, &ctx) == -1)
+	{
+		err = errno;
+		idx_close(ix);
+		errno = err;
+		index_error(index_file);
+	}
+	idx_close(ix);
+}
+
+/*
+ *	index_visit()
+ *	Purpose: idx_search() callback, print an entry of the index, "path" of
+ *			 DT_* "type", if a search from the starting path would
+ *	 Return: 0, to carry on
+ *	 Method: The entry must be below the starting path, spelled as it was
+ *			 for the build, or be it if it is "." (which the walk prints),
+ *			 and with -no-hidden none of the directories between may be
+ *			 hidden. -type is answered from the index; -size, and -type
+ *			 for an entry of no known type, stat() the path, and an entry
+ *			 gone since the index was built is left out.
+ */
+int index_visit(char *path, int type, void *arg)
+{
+	struct index_search *ctx = arg;
+	struct query *q = ctx->q;
+	struct stat info;
+	size_t i, len = strlen(ctx->root);
+	char *name;
+
+	if (strncmp(path, ctx->root, len) != 0)
+		return 0;
+	if (path[len] == '\0')
+	{
+		if (strcmp(path, ".") != 0 && strcmp(path, "..") != 0)
+			return 0;
+	}
+	else if (path[len] != '/' && (len == 0 || path[len - 1] != '/'))
+		return 0;
+
+	name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	for (i = len > 0 ? len - 1 : 0; q->hidden == '-' && path + i + 1 < name;
+			i++)
+		if (path[i] == '/' && path[i + 1] == '.')
+			return 0;
+
+	memset(&info, 0, sizeof info);
+	info.st_mode = type == DT_UNKNOWN ? 0 : DTTOIF(type);
+	if ((q->size_cmp || (q->type && type == DT_UNKNOWN))
+			&& fs->stat(NULL, 0, path, &info) == -1)
+		return 0;
+
+	if (check_entry(q, name, name_marks(name), &info))
+		print_match(q, path, NULL, &info);
+	return 0;
+}
+
+/*
+ * start_worker()
+ * Purpose: pool hook, allocate a worker's state and output buffers, one
+ *			per output. It runs on the worker itself, after placement, so
+ *			all are node-local. With --hugepages the stdout buffer fills a
+ *			huge page; the -fprint files of --queries get OUT_SIZE each.
+ *	  Note: A state left from an earlier run is reused, counters and all.
+ */
+void start_worker(int id)
+{
+	struct worker_state *ws;
+	void *p;
+	int i;
+
+	if (states[id] == NULL)
+	{
+		if ((errno = posix_memalign(&p, CACHE_LINE, sizeof *ws)))
+		{
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			exit(1);
+		}
+		ws = p;
+		//all of it: process_dir() starts at depth 0 with no path buffers
+		memset(ws, 0, sizeof *ws);
+		if ((ws->out = calloc(noutputs, sizeof *ws->out)) == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			exit(1);
+		}
+		ws->out[0].size = huge_enabled() ? HUGE_PAGE : OUT_SIZE;
+		ws->out[0].buf = huge_alloc(ws->out[0].size);
+		for (i = 1; i < noutputs; i++)
+		{
+			ws->out[i].size = OUT_SIZE;
+			ws->out[i].buf = malloc(OUT_SIZE);
+		}
+		for (i = 0; i < noutputs; i++)
+			if (ws->out[i].buf == NULL)
+			{
+				fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+				exit(1);
+			}
+		states[id] = ws;
+	}
+	local = states[id];
+}
+
+/*
+ * finish_worker()
+ * Purpose: pool hook, write out a worker's buffered output and free the
+ *			directories its thread kept for reuse. The state is kept for
+ *			print_stats().
+ */
+void finish_worker(int id)
+{
+	flush_output(states[id]);
+	posix_release();
+}
+
+/*
+ * flush_output()
+ * Purpose: write a worker's buffered lines to each output in one fwrite()
+ */
+void flush_output(struct worker_state *ws)
+{
+	int i;
+
+	for (i = 0; i < noutputs; i++)
+	{
+		if (ws->out[i].len > 0)
+			fwrite(ws->out[i].buf, 1, ws->out[i].len, output_file(i));
+		ws->out[i].len = 0;
+	}
+}
+
+/*
+ *	print_stats()
+ *	Purpose: report what the search did, for --stats, on stderr
+ *	 Method: The counters of every worker state are summed here, once,
+ *			 and the states freed; with --threads the pool's own counters
+ *			 follow, and with --hugepages what kind of pages were mapped.
+ */
+void print_stats()
+{
+	struct counters sum = solo.count;
+	long busy = 0, critical = 0, first = solo.first_match;
+	struct pool_stats ps;
+	struct huge_stats hs;
+	int i, j;
+
+	for (i = 0; i < POOL_MAX; i++)
+	{
+		if (states[i] == NULL)
+			continue;
+		sum.dirs += states[i]->count.dirs;
+		sum.entries += states[i]->count.entries;
+		sum.matches += states[i]->count.matches;
+		sum.errors += states[i]->count.errors;
+		sum.chunks += states[i]->count.chunks;
+		sum.unstatted += states[i]->count.unstatted;
+		sum.pruned += states[i]->count.pruned;
+		sum.reused += states[i]->count.reused;
+		busy += states[i]->busy;
+		if (states[i]->critical > critical)
+			critical = states[i]->critical;
+		if (states[i]->first_match
+				&& (first == 0 || states[i]->first_match < first))
+			first = states[i]->first_match;
+		while (states[i]->levels > 0)
+		{
+			free(states[i]->paths[--states[i]->levels]->buf);
+			free(states[i]->paths[states[i]->levels]);
+		}
+		free(states[i]->paths);
+		huge_free(states[i]->out[0].buf, states[i]->out[0].size);
+		for (j = 1; j < noutputs; j++)
+			free(states[i]->out[j].buf);
+		free(states[i]->out);
+		top_free(&states[i]->top);
+		group_free(&states[i]->groups);
+		idx_free(&states[i]->index);
+		ldb_free(&states[i]->locate);
+		free(states[i]);
+		states[i] = NULL;
+	}
+
+	fprintf(stderr, "%s: %ld directories, %ld entries, %ld matches, "
+			"%ld errors\n", progname, sum.dirs, sum.entries, sum.matches,
+			sum.errors);
+	fprintf(stderr, "%s: %ld entries not stat()ed, by type or link count\n",
+			progname, sum.unstatted);
+	if (skip_pseudo || local_only)
+		fprintf(stderr, "%s: %ld directories on skipped filesystems\n",
+				progname, sum.pruned);
+	if (updatedb_file)
+		fprintf(stderr, "%s: %ld directories listed from the last database\n",
+				progname, sum.reused);
+	if (fs == &posix_backend)
+		fprintf(stderr, "%s: %ld directories read in inode order\n",
+				progname, posix_sorted_dirs());
+
+	if (async_ops)
+		fprintf(stderr, "%s: %d helpers, %ld calls\n", progname, async_ops,
+				async_calls);
+
+	if (threads)
+	{
+		pool_stats(&ps);
+		fprintf(stderr, "%s: %d workers, %ld tasks, %ld steals, "
+				"%ld failed steals, %ld sleeps, %ld chunks\n", progname,
+				threads, ps.tasks, ps.steals, ps.failed_steals, ps.sleeps,
+				sum.chunks);
+		fprintf(stderr, "%s: critical path %.1f ms of %.1f ms work "
+				"(parallelism %.1f), %.1f ms wall\n", progname, critical / 1e6,
+				busy / 1e6, critical ? (double) busy / critical : 0.0,
+				run_time / 1e6);
+	}
+	if (sum.matches > 0)
+		fprintf(stderr, "%s: first match after %.3f ms\n", progname,
+				first / 1e6);
+
+	if (huge_enabled())
+	{
+		huge_stats(&hs);
+		fprintf(stderr, "%s: mapped %lld KiB on explicit huge pages, "
+				"%lld KiB advised, %lld KiB normal\n", progname,
+				hs.explicit / 1024, hs.advised / 1024, hs.normal / 1024);
+	}
+}
+
+/*
+ * now_ns()
+ * Return: the monotonic clock, in ns
+ */
+long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ *	async_search()
+ *	Purpose: search from "path" with --async N calls to the backend
+ *			 outstanding at once, driven from this one thread
+ *	  Input: path, the starting path
+ * 			 q, the criteria to match against
+ *	 Method: Each directory is a struct walk, a coroutine whose state
+ *			 says what it needs next: to be opened, to have its entries
+ *			 stat()ed, to be closed. The blocking calls themselves are
+ *			 made by N helper threads (helper.c), each call an async_op;
+ *			 2N ops are in circulation, so that the helpers have the next
+ *			 calls queued while this thread handles the last results.
+ *
+ *			 The loop hands free ops to the walk on top of the ready
+ *			 stack, then handles one finished op, which may move its walk
+ *			 on, or start new walks for the subdirectories it finds.
+ *			 These go on top, so the search stays roughly depth-first
+ *			 and the walks alive at once stay few. A walk costs its batch
+ *			 and marks, under 2 KiB, and has no stack of its own.
+ *
+ *			 All output, matching and visited-set work happens here; only
+ *			 the backend calls (and the stat() of -follow) run on the
+ *			 helpers. Archives are read here, blocking.
+ *	 Errors: If the helpers cannot be started, pfind exits 1.
+ */
+void async_search(char *path, struct query *q)
+{
+	struct async_op *ops, *free_ops = NULL, *op;
+	int i, nops = 2 * async_ops, busy = 0;
+
+	//the helpers of --batch are started once, by run_batch()
+	if ((ops = calloc(nops, sizeof *ops)) == NULL
+			|| (! batch_mode && helper_start(async_ops, posix_release) == -1))
+	{
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+	for (i = 0; i < nops; i++)
+	{
+		ops[i].job.run = run_op;
+		ops[i].next_free = free_ops;
+		free_ops = &ops[i];
+	}
+
+	start_walk(path, q);
+	if (ready)
+		ready->start = YES;
+	while (ready || busy)
+	{
+		while (ready && free_ops)
+		{
+			op = free_ops;
+			free_ops = op->next_free;
+			issue(ready, op);
+			helper_submit(&op->job);
+			busy++;
+		}
+
+		op = (struct async_op *) helper_wait();
+		busy--;
+		op_done(op);
+		op->next_free = free_ops;
+		free_ops = op;
+	}
+
+	if (! batch_mode)
+		helper_stop();
+	for (i = 0; i < nops; i++)
+		free(ops[i].path.buf);
+	free(ops);
+}
+
+/*
+ * start_walk()
+ * Purpose: queue a directory for the --async search, with its own copy
+ *			of "path"
+ *  Errors: If there is no memory for the walk, the error is reported
+ *			against "path", as a failed opendir() would be.
+ */
+void start_walk(char *path, struct query *q)
+{
+	struct walk *w = malloc(sizeof *w + strlen(path) + 1);
+
+	if (w == NULL)
+	{
+		file_error(path);
+		return;
+	}
+	w->q = q;
+	w->state = WALK_OPEN;
+	w->dir = NULL;
+	w->start = NO;
+	strcpy(w->path, path);
+	w->below = ready;
+	ready = w;
+}
+
+/*
+ *	issue()
+ *	Purpose: fill "op" with the next call walk "w", on top of the ready
+ *			 stack, needs, and take "w" off the stack if that was its last
+ *	   Note: With OP_STAT, "w" moves on to its next entry not skipped.
+ */
+void issue(struct walk *w, struct async_op *op)
+{
+	op->w = w;
+	async_calls++;
+	if (w->state == WALK_STAT)
+	{
+		op->kind = OP_STAT;
+		op->i = w->next;
+		w->pending++;
+		op->full_path = start_path(&op->path, w->path) == -1 ? NULL
+						: construct_path(&op->path, w->entries.name[op->i]);
+
+		//on to the next entry to stat(), if any
+		do
+			w->next++;
+		while (w->next < w->entries.count
+				&& (w->m.skip[w->next / 64] >> (w->next % 64) & 1));
+		if (w->next < w->entries.count)
+			return;
+		w->state = WALK_WAIT;
+	}
+	else
+	{
+		op->kind = w->state == WALK_OPEN ? OP_OPEN : OP_CLOSE;
+		w->state = WALK_BUSY;
+	}
+	ready = w->below;
+}
+
+/*
+ * run_op()
+ * Purpose: make the call of an async_op, on a helper thread
+ */
+void run_op(struct job *job)
+{
+	struct async_op *op = (struct async_op *) job;
+	struct walk *w = op->w;
+
+	errno = 0;
+	switch (op->kind)
+	{
+		case OP_OPEN:
+			w->dir = fs->opendir(w->path);
+			break;
+		case OP_STAT:
+			if (op->full_path == NULL)
+				break;
+			op->rv = fs->stat(w->dir, op->i, op->full_path, &op->info);
+			if (op->rv == 0 && follow && S_ISLNK(op->info.st_mode))
+				follow_link(op->full_path, &op->info);
+			break;
+		case OP_CLOSE:
+			fs->closedir(w->dir);
+			break;
+	}
+	op->err = errno;
+}
+
+/*
+ *	op_done()
+ *	Purpose: handle the result of an async_op, moving its walk on
+ *	 Method: An opened walk reads its first batch; each stat()ed entry is
+ *			 handled as process_entry() would, through found_entry(); a
+ *			 walk whose batch is all back reads the next one; a closed
+ *			 walk is freed.
+ */
+void op_done(struct async_op *op)
+{
+	struct walk *w = op->w;
+	char *name;
+
+	errno = op->err;
+	switch (op->kind)
+	{
+		case OP_OPEN:
+			if (w->dir == NULL)
+			{
+				if (w->start)
+					process_file(w->path, w->q);	//may be a file instead
+				else
+					file_error(w->path);
+				free(w);
+				return;
+			}
+			local->count.dirs++;
+			w->entries.count = 0;
+			w->next = 0;
+			w->pending = 0;
+			next_batch(w);
+			return;
+
+		case OP_STAT:
+			w->pending--;
+			local->count.entries++;
+			name = w->entries.name[op->i];
+			if (op->full_path == NULL)
+				file_error(name);					//no memory for the path
+			else if (op->rv == -1)
+				file_error(op->full_path);
+			else
+				found_entry(op->full_path, name, entry_marks(&w->m, op->i),
+							w->q, &op->info);
+			if (w->state == WALK_WAIT && w->pending == 0)
+				next_batch(w);
+			return;
+
+		case OP_CLOSE:
+			free(w);
+			return;
+	}
+}
+
+/*
+ * next_batch()
+ * Purpose: read the next batch of walk "w", whose last is all handled,
+ *			and put it back on the ready stack to stat() it, or to close
+ *			it at the end
+ */
+void next_batch(struct walk *w)
+{
+	int n;
+
+	w->state = WALK_CLOSE;
+	while ((n = fs->readdir(w->dir, &w->entries)) > 0)
+	{
+		mark_batch(&w->entries, w->path, w->q, &w->m);
+		for (w->next = 0; w->next < n; w->next++)
+			if (! (w->m.skip[w->next / 64] >> (w->next % 64) & 1))
+				break;
+		if (w->next < n)
+		{
+			w->state = WALK_STAT;
+			break;
+		}
+	}
+	if (n == -1)
+		file_error(w->path);					//readdir() failed part way
+
+	w->below = ready;
+	ready = w;
+}
+
+/*
+ * recurse_directory()
+ * Purpose: check if the given directory entry is one we need to recurse
+ *   Input: marks, the MARK_* bits of the entry's name
+ * 			mode, the current mode/type of file
+ *  Return: NO, the file mode is not a directory. Or, the file is a directory
+ * 				but it is either the current, ".", or parent, "..", entry.
+ *			YES, the entry is a subdirectory that we should recursively search
+ */
+int recurse_directory(int marks, mode_t mode)
+{
+	//if the file isn't a directory, the current ".", or parent ".." dir
+	if (! S_ISDIR(mode) || (marks & (MARK_DOT | MARK_DOTDOT)))
+		return NO;
+
+	//all other cases, the file is a subdirectory to recursively search
+	return YES;
+}
+
+/*
+ * mark_batch()
+ * Purpose: find the ".", ".." and hidden entries of a batch, and those
+ *			that are to be skipped
+ *   Input: b, the batch, as read from the backend
+ *			dirname, the directory it was read from
+ *			q, the criteria, for -no-hidden
+ *			m, where to set a bit for each entry of each kind
+ *  Method: "." and ".." are skipped unless the directory is itself named
+ *			so, when 'find' prints it, and hidden entries with -no-hidden,
+ *			if all of --queries have it.
+ *
+ *			Every name is at least one byte and a NUL, so its first two
+ *			bytes can always be read, and its third whenever the second is
+ *			not the NUL. The three are compared with '.' and NUL without
+ *			a branch, and each result is shifted into its bitmask, so the
+ *			loop runs the same way for every name.
+ */
+void mark_batch(struct batch *b, char *dirname, struct query *q,
+				struct marks *m)
+{
+	unsigned long dot, dotdot, hidden;		//the bits of one word
+	unsigned long lead, end1, dots2, end2, bit;
+	unsigned long dot_mask = strcmp(dirname, ".") == 0 ? 0 : ~0UL;
+	unsigned long dotdot_mask = strcmp(dirname, "..") == 0 ? 0 : ~0UL;
+	unsigned long hidden_mask = q->hidden == '-' && ! mixed_hidden ? ~0UL : 0;
+	unsigned char *name;
+	int i, w;
+
+	for (w = 0, i = 0; w < MARK_WORDS; w++)
+	{
+		dot = dotdot = hidden = 0;
+		for (bit = 0; bit < 64 && i < b->count; bit++, i++)
+		{
+			name = (unsigned char *) b->name[i];
+			lead = name[0] == '.';
+			end1 = name[1] == '\0';
+			dots2 = name[1] == '.';
+			end2 = name[1 + ! end1] == '\0';	//name[1] again if it ends there
+
+			dot |= (lead & end1) << bit;
+			dotdot |= (lead & dots2 & end2) << bit;
+			hidden |= (lead & ! end1 & ! (dots2 & end2)) << bit;
+		}
+		m->dot[w] = dot;
+		m->dotdot[w] = dotdot;
+		m->hidden[w] = hidden;
+		m->skip[w] = (dot & dot_mask) | (dotdot & dotdot_mask)
+						| (hidden & hidden_mask);
+	}
+}
+
+/*
+ * entry_marks()
+ * Return: the MARK_* bits of entry "i" of a batch marked into "m"
+ */
+int entry_marks(struct marks *m, int i)
+{
+	return (m->dot[i / 64] >> (i % 64) & 1) * MARK_DOT
+			| (m->dotdot[i / 64] >> (i % 64) & 1) * MARK_DOTDOT
+			| (m->hidden[i / 64] >> (i % 64) & 1) * MARK_HIDDEN;
+}
+
+/*
+ * name_marks()
+ * Return: the MARK_* bits of one name, as mark_batch() would set them;
+ *		   for names that do not come in a batch
+ */
+int name_marks(char *name)
+{
+	if (name[0] != '.')
+		return 0;
+	if (name[1] == '\0')
+		return MARK_DOT;
+	if (name[1] == '.' && name[2] == '\0')
+		return MARK_DOTDOT;
+	return MARK_HIDDEN;
+}
+
+/*
+ *	first_visit()
+ *	Purpose: for -unique, tell whether a matching file is reached for the
+ *			 first time
+ *	  Input: info, the file's stat
+ *	 Return: YES, unless -unique was given and the file has been seen
+ *	   Note: Only files that can be reached twice are added to the visited
+ *			 set: those with several links, and with -follow any at all.
+ *			 Directories are left to the -follow check in process_entry().
+ */
+int first_visit(struct stat *info)
+{
+	if (! unique || S_ISDIR(info->st_mode))
+		return YES;
+	if (info->st_nlink < 2 && ! follow)
+		return YES;
+	return visited_add(info->st_dev, info->st_ino);
+}
+
+/*
+ *	follow_link()
+ *	Purpose: for -follow, replace the stat of a symbolic link with that of
+ *			 its target
+ *	  Input: path, the link
+ *			 info, its lstat(), overwritten if the target exists
+ *	   Note: A dangling link is left as a link, as 'find -L' does. Links
+ *			 are only followed on the live filesystem; a trace or
+ *			 synthetic tree has no targets to follow.
+ */
+void follow_link(char *path, struct stat *info)
+{
+	struct stat target;
+
+	if (fs == &posix_backend && stat(path, &target) == 0)
+		*info = target;
+}
+
+/*
+ *	get_option()
+ *	Purpose: process command line options
+ *	  Input: args, the array pointer to command-line arguments
+ *			 q, the criteria from main to store -name, -type and -size in
+ *	 Return: The number of arguments used: 2 for an option and its value,
+ *			 1 for a flag. Criteria are stored in "q"; the settings of the
+ *			 "--" options are file-scope.
+ *	 Errors: If there is an invalid option, missing value, or an option has
+ *			 already been declared, type_error() is called to output a
+ *			 message to stderr and exit with a non-zero status.
+ *			 See also, errors above for invalid input.
+ *	   Note: Each option that appears, other than a flag, must have a
+ *			 corresponding value. The order the options appear in does not
+ *			 matter, but they can only appear once.
+ */
+int get_option(char **args, struct query *q)
+{
+	char *option = *args++;				//store option, then point to next arg
+	char *value = *args;				//store value for option (if any)
+	char *end;
+
+	//the name option, not previously declared
+	if (strcmp(option, "-name") == 0 && (q->name == NULL))
+	{
+		if( value )											//option exists
+			q->name = value;
+		else
+			type_error(option, value);						//missing arg
+	}
+	//the type option, not previously declared
+	else if (strcmp(option, "-type") == 0 && q->type == 0)
+	{
+		if (value)											//option exists
+			q->type = get_type(value[0]);
+		else
+			type_error(option, value);						//missing arg
+	}
+	//the size option, not previously declared
+	else if (strcmp(option, "-size") == 0 && q->size_cmp == 0)
+	{
+		if (value)											//option exists
+			get_size(value, q);
+		else
+			type_error(option, value);						//missing arg
+	}
+	//trace the search to a file
+	else if (strcmp(option, "--record") == 0 && record_file == NULL)
+	{
+		if (value)
+			record_file = value;
+		else
+			type_error(option, value);
+	}
+	//hash names in the trace, a flag
+	else if (strcmp(option, "--record-hash") == 0 && record_hash == NO)
+	{
+		record_hash = YES;
+		return 1;
+	}
+	//search a recorded trace instead of the filesystem
+	else if (strcmp(option, "--replay") == 0 && replay_file == NULL)
+	{
+		if (value)
+			replay_file = value;
+		else
+			type_error(option, value);
+	}
+	//multiplier for recorded latencies, 0 for none
+	else if (strcmp(option, "--replay-scale") == 0 && replay_scale == 1.0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		replay_scale = strtod(value, &end);
+		if (*end != '\0' || end == value || replay_scale < 0)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//search a generated tree instead of the filesystem
+	else if (strcmp(option, "--synthetic") == 0 && synthetic_spec == NULL)
+	{
+		if (value)
+			synthetic_spec = value;
+		else
+			type_error(option, value);
+	}
+	//look inside zip and tar archives, a flag
+	else if (strcmp(option, "--archives") == 0 && search_archives == NO)
+	{
+		search_archives = YES;
+		return 1;
+	}
+	//search on a pool of worker threads
+	else if (strcmp(option, "--threads") == 0 && threads == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		threads = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || threads < 1 || threads > POOL_MAX)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//when to stat() a directory's entries in inode order, see backend.c
+	else if (strcmp(option, "--inode-order") == 0 && inode_order == NULL)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		inode_order = value;
+		if (strcmp(value, "auto") == 0)
+			posix_inode_order(INODE_AUTO);
+		else if (strcmp(value, "always") == 0)
+			posix_inode_order(INODE_ALWAYS);
+		else if (strcmp(value, "never") == 0)
+			posix_inode_order(INODE_NEVER);
+		else
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//output the N best matches by --by, at the end
+	else if (strcmp(option, "--top") == 0 && top_n == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		top_n = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || top_n < 1 || top_n > TOP_MAX)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	else if (strcmp(option, "--by") == 0 && top_by == NULL)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		top_by = value;
+		top_sign = *value == '-' ? -1 : 1;
+		value += *value == '-';
+		if (strcmp(value, "size") == 0 || strcmp(value, "mtime") == 0
+				|| strcmp(value, "atime") == 0)
+			top_field = *value;
+		else
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, top_by, option);
+			exit(1);
+		}
+	}
+	//output totals of the matches by KEY, and which
+	else if (strcmp(option, "--group-by") == 0 && group_by == NO)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		if (group_key(value) == -1)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+		group_by = YES;
+	}
+	else if (strcmp(option, "--agg") == 0 && agg_given == NO)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		if (group_aggs(value) == -1)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+		agg_given = YES;
+	}
+	//estimate the matches to within PCT percent, with at most N probes
+	else if (strcmp(option, "--estimate") == 0 && estimate_pct == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		estimate_pct = strtod(value, &end);
+		if (*end != '\0' || end == value || ! (estimate_pct > 0)
+				|| estimate_pct >= 100)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	else if (strcmp(option, "--probes") == 0 && estimate_probes == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		estimate_probes = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || estimate_probes < 1)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//write a name index of the tree, or search one instead of the tree
+	else if (strcmp(option, "--index-build") == 0 && index_build_file == NULL)
+	{
+		if (value)
+			index_build_file = value;
+		else
+			type_error(option, value);
+	}
+	else if (strcmp(option, "--index") == 0 && index_file == NULL)
+	{
+		if (value)
+			index_file = value;
+		else
+			type_error(option, value);
+	}
+	//write a locate database, in place of updatedb
+	else if (strcmp(option, "--updatedb") == 0 && updatedb_file == NULL)
+	{
+		if (value)
+			updatedb_file = value;
+		else
+			type_error(option, value);
+	}
+	//keep N backend calls outstanding from one thread
+	else if (strcmp(option, "--async") == 0 && async_ops == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		async_ops = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || async_ops < 1
+				|| async_ops > ASYNC_MAX)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//which queued directory a worker searches first, see sched.c
+	else if (strcmp(option, "--schedule") == 0 && schedule == NULL)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		schedule = value;
+		if ((policy = sched_policy(value)) == -1)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//weights per path prefix for --schedule, and where to save them
+	else if (strcmp(option, "--weights") == 0 && weights_file == NULL)
+	{
+		if (value)
+			weights_file = value;
+		else
+			type_error(option, value);
+	}
+	else if (strcmp(option, "--save-weights") == 0
+				&& save_weights_file == NULL)
+	{
+		if (value)
+			save_weights_file = value;
+		else
+			type_error(option, value);
+	}
+	//place the workers on NUMA nodes, a flag
+	else if (strcmp(option, "--numa") == 0 && numa == NO)
+	{
+		numa = YES;
+		return 1;
+	}
+	//files on filesystems of one type
+	else if (strcmp(option, "-fstype") == 0 && q->fstype == NULL)
+	{
+		if (value)
+			q->fstype = value;
+		else
+			type_error(option, value);
+	}
+	//do not search pseudo, or remote, filesystems, flags
+	else if (strcmp(option, "--skip-pseudo") == 0 && skip_pseudo == NO)
+	{
+		skip_pseudo = YES;
+		return 1;
+	}
+	else if (strcmp(option, "--local-only") == 0 && local_only == NO)
+	{
+		local_only = YES;
+		return 1;
+	}
+	//print the matches to a file instead of stdout
+	else if (strcmp(option, "-fprint") == 0 && q->out == 0)
+	{
+		if (value)
+			q->out = add_output(value);
+		else
+			type_error(option, value);
+	}
+	//a query per line of a file, all searched for at once
+	else if (strcmp(option, "--queries") == 0 && queries_file == NULL)
+	{
+		if (value)
+			queries_file = value;
+		else
+			type_error(option, value);
+	}
+	//a search per line of stdin, a flag
+	else if (strcmp(option, "--batch") == 0 && batch_mode == NO)
+	{
+		batch_mode = YES;
+		return 1;
+	}
+	//only hidden entries, or none (not searching hidden directories)
+	else if ((strcmp(option, "-hidden") == 0
+				|| strcmp(option, "-no-hidden") == 0) && q->hidden == 0)
+	{
+		q->hidden = option[1] == 'h' ? '+' : '-';
+		return 1;
+	}
+	//print each multiply-linked file once, a flag
+	else if (strcmp(option, "-unique") == 0 && unique == NO)
+	{
+		unique = YES;
+		return 1;
+	}
+	//follow symbolic links, a flag
+	else if (strcmp(option, "-follow") == 0 && follow == NO)
+	{
+		follow = YES;
+		return 1;
+	}
+	//bound the visited set to MB megabytes, approximately
+	else if (strcmp(option, "--visited-filter") == 0 && visited_mb == 0)
+	{
+		if (value == NULL)
+			type_error(option, value);
+		visited_mb = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || visited_mb < 1)
+		{
+			fprintf(stderr, "%s: invalid argument `%s' to `%s'\n",
+					progname, value, option);
+			exit(1);
+		}
+	}
+	//put the visited set and output buffers on huge pages, a flag
+	else if (strcmp(option, "--hugepages") == 0 && huge_enabled() == NO)
+	{
+		huge_mode(YES);
+		return 1;
+	}
+	//report counts on stderr at the end, a flag
+	else if (strcmp(option, "--stats") == 0 && show_stats == NO)
+	{
+		show_stats = YES;
+		return 1;
+	}
+	//either an unknown predicate, or is repeat of a known option
+	else
+	{
+		type_error(option, value);
+	}
+
+	return 2;
+}
+
+/*
+ *	get_path()
+ *	Purpose: Test the command line argument to see if it is a valid path.
+ *	  Input: args, the array of command line arguments
+ *			 path, variable to store the specified path in
+ *			 q, variable to use as placeholder for out-of-order options
+ *	 Return: The number of arguments used: 1 for the path, or, with
+ *			 --batch, all the options. Prints message to stderr and exit(1)
+ *			 on out of order options or invalid options.
+ *	 Method: If the argument does not begin with an option specifier "-",
+ *			 get_path() assumes it is a valid start path and assigns it to
+ *			 the path variable. Otherwise, it attempts to recreate the
+ *			 behavior in 'find' by processing args first and then outputting
+ *			 a "paths must precede expression" error, or general syntax
+ *			 error. Ex. 'find -name foobar .'
+ */
+int get_path(char **args, char **path, struct query *q)
+{
+	char **first = args;
+
+	if(*args[0] != '-')				//arg DOESN'T begin with option specifier
+		*path = *args++;			//set path to the value
+	else							//arg DOES begin with option specifier '-'
+	{
+		//process options and args first, a la 'find'
+		while(*args && *args[0] == '-')
+			args += get_option(args, q);
+
+		if(*args)						//assume remaining arg is start path
+		{
+			fprintf(stderr, "%s: paths must precede expression: ", progname);
+			fprintf(stderr, "%s\n", *args);
+			syntax_error();
+		}
+		else if (! batch_mode)			//otherwise, general syntax error
+		{
+			syntax_error();
+		}
+	}
+
+	return args - first;
+}
+
+/*
+ * get_type()
+ * Purpose: check to see if -type is supported, and if so, provide bitmask
+ *   Input: c, the char to check
+ *  Return: the bitmask associated with the -type specified. If -type is
+ *			not a valid option, print message to stderr and exit.
+ * Options: the following options are allowed, as per <sys/stat.h>, the
+ *			'find' command, and the homework spec: {b|c|d|f|l|p|s}. See
+ *			inline comments below for the types they represent.
+ */
+int get_type(char c)
+{
+	switch (c) {
+		case 'b':
+			return S_IFBLK;		//block special
+		case 'c':
+			return S_IFCHR;		//character special
+		case 'd':
+			return S_IFDIR;		//directory
+		case 'f':
+			return S_IFREG;		//regular file
+		case 'l':
+			return S_IFLNK;		//symbolic link
+		case 'p':
+			return S_IFIFO;		//FIFO
+		case 's':
+			return S_IFSOCK;	//socket
+		default:
+			fprintf(stderr, "%s: ", progname);
+            fprintf(stderr, "Unknown argument to -type: %c\n", c);
+			fail();
+	}
+}
+
+/*
+ *	get_size()
+ *	Purpose: parse the value of -size, as 'find' does: [+-]n[cwbkMG]
+ *	  Input: value, the argument to -size
+ *			 q, the criteria to store the comparison, count and unit in
+ *	 Errors: An empty count, a stray character, or an unknown unit is
+ *			 reported to stderr and pfind exits 1, see fail().
+ *	   Note: Without a unit, n counts 512-byte blocks. "+n" means more
+ *			 than n units, "-n" fewer than n; sizes are rounded up to
+ *			 whole units before comparing.
+ */
+void get_size(char *value, struct query *q)
+{
+	char *p = value;
+
+	q->size_cmp = (*p == '+' || *p == '-') ? *p++ : '=';
+	if (*p < '0' || *p > '9')
+	{
+		fprintf(stderr, "%s: invalid argument `%s' to `-size'\n",
+				progname, value);
+		fail();
+	}
+
+	for (q->size = 0; *p >= '0' && *p <= '9'; p++)
+		q->size = q->size * 10 + (*p - '0');
+
+	switch (*p) {
+		case 'c':  q->size_unit = 1;				p++; break;
+		case 'w':  q->size_unit = 2;				p++; break;
+		case 'k':  q->size_unit = 1024;				p++; break;
+		case 'M':  q->size_unit = 1024 * 1024;		p++; break;
+		case 'G':  q->size_unit = 1024 * 1024 * 1024;	p++; break;
+		case 'b':  q->size_unit = 512;				p++; break;
+		default:   q->size_unit = 512;				break;	//blocks
+	}
+
+	if (*p != '\0')
+	{
+		fprintf(stderr, "%s: invalid -size type `%s'\n", progname, p);
+		fail();
+	}
+}
+
+/*
+ *	set_backend()
+ *	Purpose: select the filesystem backend according to --synthetic,
+ *			 --replay and --record, once the options have been processed,
+ *			 and settle the number of --threads
+ *	  Input: path, the starting path, root of a synthetic tree and written
+ *			 into the trace header
+ *	 Errors: If the trace cannot be read or created, file_error() prints
+ *			 why and pfind exits 1. So does a malformed --synthetic spec.
+ *			 --record is refused with --threads and --async, as a trace
+ *			 must be written in walk order, and --async with --threads.
+ */
+void set_backend(char *path)
+{
+	//one worker per CPU, if --numa was given without --threads
+	if (numa && threads == 0)
+	{
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = threads < 1 ? 1 : threads > POOL_MAX ? POOL_MAX : threads;
+	}
+
+	//a trace lists each directory right after its entry, in walk order
+	if (record_file && (threads || async_ops))
+	{
+		fprintf(stderr, "%s: --record cannot be used with --threads or "
+				"--async\n", progname);
+		exit(1);
+	}
+	if (threads && async_ops)
+	{
+		fprintf(stderr, "%s: --async cannot be used with --threads or "
+				"--numa\n", progname);
+		exit(1);
+	}
+
+	if (synthetic_spec && (fs = synthetic_backend(path, synthetic_spec)) == NULL)
+	{
+		fprintf(stderr, "%s: invalid argument `%s' to `--synthetic'\n",
+				progname, synthetic_spec);
+		exit(1);
+	}
+
+	if (replay_file && (fs = replay_backend(replay_file, replay_scale)) == NULL)
+	{
+		file_error(replay_file);
+		exit(1);
+	}
+
+	if (record_file && (fs = record_backend(fs, record_file, path,
+											record_hash)) == NULL)
+	{
+		file_error(record_file);
+		exit(1);
+	}
+}
+
+/*
+ *	start_visited()
+ *	Purpose: create the visited set for -unique and -follow, exact or, with
+ *			 --visited-filter, a bounded filter. With -follow the starting
+ *			 directory goes in first, so a link back to it is not searched.
+ *	 Errors: If there is no memory for the set, pfind exits 1.
+ */
+void start_visited(char *path)
+{
+	struct stat info;
+
+	if (visited_init(visited_mb * 1024 * 1024) == -1)
+	{
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+
+	if (follow && fs == &posix_backend && stat(path, &info) == 0
+			&& S_ISDIR(info.st_mode))
+		visited_add(info.st_dev, info.st_ino);
+}
+
+/*
+ *	start_schedule()
+ *	Purpose: check --schedule, --weights and --save-weights, which work
+ *			 on the tasks of --threads, and read the --weights file
+ *	 Errors: If they are given without --threads, if --weights is given
+ *			 with a policy that does not use it, or if the file cannot be
+ *			 read, pfind exits 1.
+ */
+void start_schedule()
+{
+	if ((schedule || weights_file || save_weights_file) && threads == 0)
+	{
+		fprintf(stderr, "%s: --schedule, --weights and --save-weights "
+				"need --threads\n", progname);
+		exit(1);
+	}
+	if (weights_file && policy != SCHED_LARGEST && policy != SCHED_WEIGHTED)
+	{
+		fprintf(stderr, "%s: --weights needs --schedule largest or "
+				"weighted\n", progname);
+		exit(1);
+	}
+	if (weights_file && sched_load(weights_file) == -1)
+	{
+		file_error(weights_file);
+		exit(1);
+	}
+}
+
+/*
+ *	start_mounts()
+ *	Purpose: read the mount table for -fstype, --skip-pseudo and
+ *			 --local-only, which look at the real filesystem only
+ *	 Errors: If they are given with --replay, --synthetic or --record,
+ *			 pfind exits 1. Without a mount table, types are found with
+ *			 statfs() instead.
+ */
+void start_mounts(struct query *q)
+{
+	while (q && ! q->fstype)
+		q = q->next;
+	if (! q && ! skip_pseudo && ! local_only)
+		return;
+	if (fs != &posix_backend)
+	{
+		fprintf(stderr, "%s: -fstype, --skip-pseudo and --local-only "
+				"cannot be used with --replay, --synthetic or --record\n",
+				progname);
+		exit(1);
+	}
+	fs_mounts();
+}
+
+/*
+ *	start_locate()
+ *	Purpose: --updatedb, check that the search from "path" for query "q"
+ *			 is one a locate database can be written from, and read the
+ *			 last database for reuse
+ *	 Errors: A relative starting path, which locate could not use, or any
+ *			 predicate or -fprint, or a file that is not a locate
+ *			 database, is reported, and pfind exits 1.
+ */
+void start_locate(char *path, struct query *q)
+{
+	struct stat info;
+
+	if (*path != '/')
+	{
+		fprintf(stderr, "%s: --updatedb needs an absolute starting path\n",
+				progname);
+		exit(1);
+	}
+	if (q->name || q->type || q->size_cmp || q->hidden || q->fstype || q->out)
+	{
+		fprintf(stderr, "%s: --updatedb cannot be used with -name, -type, "
+				"-size, -hidden, -no-hidden, -fstype or -fprint\n", progname);
+		exit(1);
+	}
+	memset(&info, 0, sizeof info);
+	fs->stat(NULL, 0, path, &info);				//the search reports it
+	if (ldb_open(updatedb_file, path, &info) == -1)
+	{
+		if (errno == EINVAL)
+			fprintf(stderr, "%s: `%s': not a locate database, or damaged\n",
+					progname, updatedb_file);
+		else
+			file_error(updatedb_file);
+		exit(1);
+	}
+}
+
+/*
+ *	run_batch()
+ *	Purpose: --batch, answer many searches in one process: a job per line
+ *			 of stdin, "ROOT [predicates]", split as a --queries line is
+ *	  Input: q, the criteria from the command line, which must be empty
+ *	 Output: each job's matches, then an empty line, written out before
+ *			 the next job is read, so a caller can wait for each answer
+ *	 Method: The options on the command line hold for every job. What
+ *			 pfind sets up once is kept from job to job: the workers of
+ *			 --threads, held by pool_start(), with their path and output
+ *			 buffers and the directories they keep for reuse; the helpers
+ *			 of --async; the mount table and each thread's cache of
+ *			 filesystem types. Only the visited set of -unique and
+ *			 -follow starts afresh for each job.
+ *	 Errors: A job that is not valid is reported on stderr, answered with
+ *			 no matches, and the next job read.
+ */
+void run_batch(struct query *q)
+{
+	struct pool_config cfg = { threads, numa, policy != SCHED_DEPTH,
+								start_worker, finish_worker };
+	char *line = NULL, *words[QUERY_WORDS + 1];
+	size_t size = 0;
+	struct query job;
+	jmp_buf failed;
+	int i, n;
+
+	if (q->name || q->type || q->size_cmp || q->hidden || q->fstype || q->out
+			|| queries_file || record_file || replay_file || synthetic_spec)
+	{
+		fprintf(stderr, "%s: --batch cannot be used with predicates, "
+				"-fprint, --queries, --record, --replay or --synthetic\n",
+				progname);
+		exit(1);
+	}
+	set_backend(NULL);							//settles --threads
+	start_schedule();
+	fs_mounts();								//for any job's -fstype
+	if (huge_enabled() && ! threads)
+		huge_stdout();
+	if (threads)
+		pool_start(&cfg);
+	else if (async_ops && helper_start(async_ops, posix_release) == -1)
+	{
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+
+	run_start = show_stats ? now_ns() : 0;
+	while (getline(&line, &size, stdin) != -1)
+	{
+		if (line[strspn(line, " \t")] == '#'
+				|| (n = split_line(line, words, QUERY_WORDS)) == 0)
+			continue;
+
+		memset(&job, 0, sizeof job);
+		job_failed = &failed;
+		if (setjmp(failed) == 0)
+		{
+			if (n == -1)
+			{
+				fprintf(stderr, "%s: unmatched quote, or more than %d words "
+						"in a job\n", progname, QUERY_WORDS);
+				fail();
+			}
+			words[n] = NULL;
+			for (i = 1; i < n; i += get_option(words + i, &job))
+				if (! is_predicate(words[i]))
+				{
+					fprintf(stderr, "%s: `%s' is not allowed in a job\n",
+							progname, words[i]);
+					fail();
+				}
+			job_failed = NULL;
+
+			if (unique || follow)
+				start_visited(words[0]);
+			search(words[0], &job);
+			if (top_n)
+				print_top(&job);
+			else if (group_by)
+				print_groups(&job);
+			if (unique || follow)
+			{
+				warn_overflows();
+				visited_free();
+			}
+		}
+		job_failed = NULL;
+
+		putchar('\n');							//the end of the answer
+		fflush(stdout);
+	}
+	run_time = show_stats ? now_ns() - run_start : 0;
+	free(line);
+
+	if (threads)
+		pool_stop();
+	else if (async_ops)
+		helper_stop();
+	release_chunks();
+}
+
+/*
+ *	start_totals()
+ *	Purpose: check that --top, --group-by and --estimate, which output at
+ *			 the end instead of as matches are found, are asked for
+ *			 sensibly
+ *	 Errors: --by without --top, --agg without --group-by, the two
+ *			 together, or either with the many outputs of --queries;
+ *			 --probes without --estimate, or --estimate with anything
+ *			 else that changes what is output or how the tree is walked;
+ *			 --index-build with the other outputs, or --index with anything
+ *			 that needs the tree itself; --updatedb with any other output,
+ *			 or with what would add entries locate's walk would not;
+ *			 pfind exits 1.
+ */
+void start_totals()
+{
+	char *error = NULL;
+
+	if (top_by && ! top_n)
+		error = "--by needs --top";
+	else if (agg_given && ! group_by)
+		error = "--agg needs --group-by";
+	else if (top_n && group_by)
+		error = "--top cannot be used with --group-by";
+	else if ((top_n || group_by) && queries_file)
+		error = "--top and --group-by cannot be used with --queries";
+	else if (estimate_probes && ! estimate_pct)
+		error = "--probes needs --estimate";
+	else if (estimate_pct && (top_n || group_by || queries_file
+				|| batch_mode || threads || numa || async_ops || unique
+				|| follow || record_file))
+		error = "--estimate cannot be used with --top, --group-by, "
+				"--queries, --batch, --threads, --numa, --async, -unique, "
+				"-follow or --record";
+	else if (index_build_file && (top_n || group_by || estimate_pct
+				|| queries_file || batch_mode || index_file))
+		error = "--index-build cannot be used with --top, --group-by, "
+				"--estimate, --queries, --batch or --index";
+	else if (index_file && (top_n || group_by || estimate_pct || queries_file
+				|| batch_mode || threads || numa || async_ops || unique
+				|| follow || search_archives || record_file || replay_file
+				|| synthetic_spec))
+		error = "--index cannot be used with --top, --group-by, --estimate, "
+				"--queries, --batch, --threads, --numa, --async, -unique, "
+				"-follow, --archives, --record, --replay or --synthetic";
+	else if (updatedb_file && (top_n || group_by || estimate_pct
+				|| queries_file || batch_mode || index_build_file
+				|| index_file || search_archives || unique || follow))
+		error = "--updatedb cannot be used with --top, --group-by, "
+				"--estimate, --queries, --batch, --index-build, --index, "
+				"--archives, -unique or -follow";
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", progname, error);
+		exit(1);
+	}
+}
+
+/*
+ * warn_overflows()
+ * Purpose: say if the --visited-filter filled up, so that files may have
+ *			been output twice
+ */
+void warn_overflows()
+{
+	if (visited_overflows() > 0)
+		fprintf(stderr, "%s: visited filter full %ld times, some files may "
+				"have been output twice\n", progname, visited_overflows());
+}
+
+/*
+ *	load_queries()
+ *	Purpose: read a --queries file, a query per line
+ *	  Input: file, the file
+ *			 q, the criteria from the command line, which must be empty
+ *	 Return: the first query, each linked to the next
+ *	 Method: A line is split into words as the shell would split it, and
+ *			 the words handed to get_option() as if from the command line;
+ *			 only the predicates and -fprint are allowed. The lines are
+ *			 kept, as the queries point into them. Blank lines and '#'
+ *			 comments are skipped.
+ *	 Errors: If the file cannot be read, or a line is not a query, or
+ *			 there are none, pfind exits 1.
+ */
+struct query *load_queries(char *file, struct query *q)
+{
+	FILE *fp;
+	char *line = NULL, *words[QUERY_WORDS + 1];
+	size_t size = 0;
+	struct query *first = NULL, **tail = &first;
+	int lineno = 0, nq = 0, hides = 0, i, n;
+
+	if (q->name || q->type || q->size_cmp || q->hidden || q->fstype || q->out)
+	{
+		fprintf(stderr, "%s: --queries cannot be used with -name, -type, "
+				"-size, -hidden, -no-hidden, -fstype or -fprint\n", progname);
+		exit(1);
+	}
+	if ((fp = fopen(file, "r")) == NULL)
+	{
+		file_error(file);
+		exit(1);
+	}
+
+	while (getline(&line, &size, fp) != -1)
+	{
+		lineno++;
+		if (line[strspn(line, " \t")] == '#'
+				|| (n = split_line(line, words, QUERY_WORDS)) == 0)
+			continue;
+		if (n == -1)
+		{
+			fprintf(stderr, "%s: `%s', line %d: unmatched quote, or more "
+					"than %d words\n", progname, file, lineno, QUERY_WORDS);
+			exit(1);
+		}
+		if ((q = calloc(1, sizeof *q)) == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			exit(1);
+		}
+
+		words[n] = NULL;
+		for (i = 0; i < n; i += get_option(words + i, q))
+		{
+			if (! is_predicate(words[i]) && strcmp(words[i], "-fprint"))
+			{
+				fprintf(stderr, "%s: `%s', line %d: `%s' is not allowed in "
+						"a query\n", progname, file, lineno, words[i]);
+				exit(1);
+			}
+		}
+
+		hides += q->hidden == '-';
+		nq++;
+		*tail = q;
+		tail = &q->next;
+		q->line = line;							//the query points into it
+		line = NULL;
+		size = 0;
+	}
+	free(line);
+	if (ferror(fp))
+	{
+		file_error(file);
+		exit(1);
+	}
+	fclose(fp);
+
+	if (first == NULL)
+	{
+		fprintf(stderr, "%s: `%s': no queries\n", progname, file);
+		exit(1);
+	}
+	mixed_hidden = hides > 0 && hides < nq;
+	return first;
+}
+
+/*
+ * split_line()
+ * Purpose: split "line" into words in place, as the shell would: words
+ *			are separated by blanks, '...' and "..." quote what is in
+ *			them, and a backslash, outside '...', the character after it
+ *  Return: the number of words, at most "max", put in "words"; or -1 if
+ *			a quote is not closed, or there are more
+ */
+int split_line(char *line, char **words, int max)
+{
+	char *in = line, *out;
+	int n = 0, quote;
+
+	for (;;)
+	{
+		in += strspn(in, " \t\r\n");
+		if (*in == '\0')
+			return n;
+		if (n == max)
+			return -1;
+
+		words[n++] = out = in;
+		for (quote = 0; *in != '\0'; in++)
+		{
+			if (quote == 0 && strchr(" \t\r\n", *in))
+				break;
+			if (*in == quote)
+				quote = 0;
+			else if (quote == 0 && (*in == '\'' || *in == '"'))
+				quote = *in;
+			else if (*in == '\\' && quote != '\'' && in[1] != '\0')
+				*out++ = *++in;
+			else
+				*out++ = *in;
+		}
+		if (quote)
+			return -1;
+		if (*in != '\0')
+			in++;								//past the blank
+		*out = '\0';
+	}
+}
+
+/*
+ * add_output()
+ * Purpose: open "file" for -fprint, emptying it, unless it is open for
+ *			another query already
+ *  Return: its number, for struct query "out"
+ *  Errors: If it cannot be opened, pfind exits 1.
+ */
+int add_output(char *file)
+{
+	FILE **files;
+	char **names;
+	int i;
+
+	for (i = 1; i < noutputs; i++)
+		if (strcmp(output_files[i], file) == 0)
+			return i;
+
+	if ((files = realloc(outputs, (noutputs + 1) * sizeof *files)) != NULL)
+		outputs = files;
+	if ((names = realloc(output_files, (noutputs + 1) * sizeof *names)))
+		output_files = names;
+	if (files == NULL || names == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+	outputs[0] = NULL;							//stdout, see output_file()
+	output_files[0] = NULL;
+
+	if ((outputs[noutputs] = fopen(file, "w")) == NULL)
+	{
+		file_error(file);
+		exit(1);
+	}
+	output_files[noutputs] = file;
+	return noutputs++;
+}
+
+/*
+ * output_file()
+ * Return: the file output number "i" is written to
+ */
+FILE *output_file(int i)
+{
+	return i == 0 ? stdout : outputs[i];
+}
+
+/*
+ * close_outputs()
+ * Purpose: close the -fprint files, once the search is over
+ *  Return: 0, or -1 if one could not be written, as file_error() reports
+ */
+int close_outputs()
+{
+	int i, rv = 0;
+
+	for (i = 1; i < noutputs; i++)
+		if (fclose(outputs[i]) == EOF)
+		{
+			file_error(output_files[i]);
+			rv = -1;
+		}
+	free(outputs);
+	free(output_files);
+	outputs = NULL;
+	output_files = NULL;
+	return rv;
+}
+
+/*
+ * free_queries()
+ * Purpose: release the queries from load_queries(), and their lines
+ */
+void free_queries(struct query *q)
+{
+	struct query *next;
+
+	for (; q; q = next)
+	{
+		next = q->next;
+		free(q->line);
+		free(q);
+	}
+}
+
+/*
+ *	path_buffer()
+ *	Purpose: get the path buffer for the directory about to be read, at
+ *			 the current depth, and start it with "dirname/"
+ *	  Input: dirname, the directory
+ *	 Return: the buffer, or NULL with errno set if there is no memory
+ *	 Method: Buffers come from the worker state, one per depth, and are
+ *			 only allocated or grown when the search goes deeper, or meets
+ *			 a longer path, than it has before.
+ */
+struct pathbuf *path_buffer(char *dirname)
+{
+	struct worker_state *ws = local;
+	struct pathbuf *pb, **paths;
+
+	//the buffers of shallower levels are in use, so they must not move
+	if (ws->depth == ws->levels)
+	{
+		paths = realloc(ws->paths, (ws->levels + 1) * sizeof *paths);
+		if (paths == NULL)
+			return NULL;
+		ws->paths = paths;
+		if ((paths[ws->levels] = calloc(1, sizeof **paths)) == NULL)
+			return NULL;
+		ws->levels++;
+	}
+
+	pb = ws->paths[ws->depth];
+	return start_path(pb, dirname) == -1 ? NULL : pb;
+}
+
+/*
+ * start_path()
+ * Purpose: start path buffer "pb" with "dirname/", for construct_path()
+ *  Return: 0, or -1 with errno set if there is no memory
+ */
+int start_path(struct pathbuf *pb, char *dirname)
+{
+	size_t len = strlen(dirname);
+
+	if (reserve_path(pb, len + 2) == -1)
+		return -1;
+
+	pb->dirname = dirname;
+	memcpy(pb->buf, dirname, len);
+	if (len == 0 || dirname[len - 1] != '/')
+		pb->buf[len++] = '/';
+	pb->prefix = len;
+	return 0;
+}
+
+/*
+ * huge_stdout()
+ * Purpose: for --hugepages without --threads, give stdout a buffer of a
+ *			huge page, unless it is a terminal, where lines should appear
+ *			as they are found
+ */
+void huge_stdout()
+{
+	char *buf;
+
+	if (isatty(1) || (buf = huge_alloc(HUGE_PAGE)) == NULL)
+		return;
+	setvbuf(stdout, buf, _IOFBF, HUGE_PAGE);
+}
+
+/*
+ *	construct_path()
+ *	Purpose: concatenate a parent and child into a full path name
+ *	  Input: dir, the path buffer holding the parent, from path_buffer()
+ *			 child, name of the last entry read by readdir()
+ *	 Return: the full path, in "dir" until the next call; NULL with errno
+ *			 set if the buffer could not grow to hold it
+ *   Method: "parent/" is already in the buffer, so only the child is
+ *			 copied in after it. The "." entry of a search started at "."
+ *			 (or ".." at "..") is just the parent, as 'find' prints it.
+ */
+char * construct_path(struct pathbuf *dir, char *child)
+{
+	size_t len;
+
+	if ((strcmp(child, ".") == 0 || strcmp(child, "..") == 0)
+			&& strcmp(dir->dirname, child) == 0)
+		return dir->dirname;
+
+	len = strlen(child);
+	if (reserve_path(dir, dir->prefix + len + 1) == -1)
+		return NULL;
+	memcpy(dir->buf + dir->prefix, child, len + 1);
+	return dir->buf;
+}
+
+/*
+ * reserve_path()
+ * Purpose: make sure a path buffer holds at least "size" bytes, keeping
+ *			what is in it
+ *  Return: 0, or -1 with errno set if there is no memory
+ */
+int reserve_path(struct pathbuf *pb, size_t size)
+{
+	size_t n = pb->size ? pb->size : PATH_INIT;
+	char *buf;
+
+	if (size <= pb->size)
+		return 0;
+	while (n < size)
+		n *= 2;
+	if ((buf = realloc(pb->buf, n)) == NULL)
+		return -1;
+	pb->buf = buf;
+	pb->size = n;
+	return 0;
+}
+
+/*
+ *	file_error()
+ *	Purpose: Helper function to display error message.
+ *	  Input: path, the full path of the file there was an error with
+ *	 Return: Prints an error message with program name, the full path,
+ *			 and the error message set by errno. After printing, the
+ *			 function returns to continue to search through any remaining
+ *			 files.
+ */
+void file_error(char *path)
+{
+	//example -- "./pfind: `/tmp/pft.IO8Et0': Permission denied"
+	local->count.errors++;
+	fprintf(stderr, "%s: `%s': %s\n", progname, path, strerror(errno));
+	return;
+}
+
+/*
+ *	syntax_error()
+ *	Purpose: Helper function to display error message and exit.
+ *	 Return: This function is called when a syntax error occurs. It
+ *			 displays the message and exits with value of 1.
+ */
+void syntax_error()
+{
+	fprintf(stderr, "usage: pfind starting_path ");
+	fprintf(stderr, "[-name filename-or-pattern] ");
+	fprintf(stderr, "[-type {f|d|b|c|p|l|s}] [-size [+-]n[cwbkMG]]\n");
+	fprintf(stderr, "       [-hidden | -no-hidden] [-fstype type] ");
+	fprintf(stderr, "[--skip-pseudo] [--local-only] [--archives]\n       ");
+	fprintf(stderr, "[--record trace-file [--record-hash]]\n       ");
+	fprintf(stderr, "[--replay trace-file [--replay-scale factor]]\n");
+	fprintf(stderr, "       [--synthetic depth,fanout,files] ");
+	fprintf(stderr, "[--threads n] [--numa] [--async n] [--stats]\n");
+	fprintf(stderr, "       [-unique] [-follow] [--visited-filter mb] ");
+	fprintf(stderr, "[--hugepages]\n");
+	fprintf(stderr, "       [--inode-order {auto|always|never}]\n");
+	fprintf(stderr, "       [--schedule {depth|shallow|largest|weighted}] ");
+	fprintf(stderr, "[--weights file] [--save-weights file]\n");
+	fprintf(stderr, "       [-fprint file] [--queries file] ");
+	fprintf(stderr, "[--top n [--by [-]{size|mtime|atime}]]\n");
+	fprintf(stderr, "       [--group-by {ext|owner|depth|age} ");
+	fprintf(stderr, "[--agg count,sum(size),max(mtime),...]]\n");
+	fprintf(stderr, "       [--estimate percent [--probes n]] ");
+	fprintf(stderr, "[--index-build file | --index file]\n");
+	fprintf(stderr, "       [--updatedb file]\n");
+	fprintf(stderr, "   or: pfind --batch [options] < jobs\n");
+	exit(1);
+}
 
 /*
  *	type_error()
  *	Purpose: Helper function to display error message for command-line options
  *	  Input: opt, the "-option" flag entered on the command line
  *			 value, the value proceeding the "-option" flag
- *	 Return: Appropriate error message printed to stderr, then exit(1).
+ *	 Return: Appropriate error message printed to stderr, then fail().
  *  Example: "./pfind: missing argument to `-name'"
  */
 void type_error(char *opt, char *value)
@@ -487,8 +3632,8 @@ void type_error(char *opt, char *value)
 	//output program name
 	fprintf(stderr, "%s: ", progname);
 
-	//one of two accepted options, but previously declared/missing arg
-	if(strcmp(opt, "-name") == 0 || strcmp(opt, "-type") == 0)
+	//an accepted option, but previously declared/missing arg
+	if(is_option(opt))
 	{
 		if(value)
 			fprintf(stderr, "option already declared: `%s'\n", opt);
@@ -498,5 +3643,78 @@ void type_error(char *opt, char *value)
 	else
 		fprintf(stderr, "unknown predicate `%s'\n", opt);
 
+	fail();
+}
+
+/*
+ *	fail()
+ *	Purpose: give up after an error in the options: pfind exits 1, but a
+ *			 --batch job that is not valid is given up on alone
+ */
+void fail()
+{
+	if (job_failed)
+		longjmp(*job_failed, 1);
+	exit(1);
+}
+
+/*
+ *	index_error()
+ *	Purpose: report the --index "file" that could not be read, as not an
+ *			 index if errno is EINVAL, and exit 1
+ */
+void index_error(char *file)
+{
+	if (errno == EINVAL)
+		fprintf(stderr, "%s: `%s': not a pfind index, or damaged\n",
+				progname, file);
+	else
+		file_error(file);
 	exit(1);
 }
+
+/*
+ *	is_option()
+ *	Purpose: Helper function for type_error(), to tell a known option
+ *			 from an unknown predicate
+ *	 Return: YES if "opt" is one of the options get_option() accepts
+ */
+int is_option(char *opt)
+{
+	static char *options[] = {
+		"-name", "-type", "--record", "--record-hash", "--replay",
+		"-size", "--replay-scale", "--synthetic", "--archives", "--threads",
+		"--numa", "--stats", "-unique", "-follow", "--visited-filter",
+		"--hugepages", "-hidden", "-no-hidden", "--inode-order", "--async",
+		"--schedule", "--weights", "--save-weights", "-fstype",
+		"--skip-pseudo", "--local-only", "-fprint", "--queries", "--batch",
+		"--top", "--by", "--group-by", "--agg", "--estimate", "--probes",
+		"--index-build", "--index", "--updatedb", NULL
+	};
+	int i;
+
+	for (i = 0; options[i] != NULL; i++)
+		if (strcmp(opt, options[i]) == 0)
+			return YES;
+
+	return NO;
+}
+
+/*
+ *	is_predicate()
+ *	Return: YES if "opt" is one of the options that go in a query, as a
+ *			line of --queries or a --batch job has it
+ */
+int is_predicate(char *opt)
+{
+	static char *predicates[] = {
+		"-name", "-type", "-size", "-hidden", "-no-hidden", "-fstype", NULL
+	};
+	int i;
+
+	for (i = 0; predicates[i] != NULL; i++)
+		if (strcmp(opt, predicates[i]) == 0)
+			return YES;
+
+	return NO;
+}
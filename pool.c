@@ -0,0 +1,648 @@
+/*
+ * ==========================
+ *   FILE: ./pool.c
+ * ==========================
+ * Purpose: A work-stealing pool of worker threads for the parallel walker.
+ *
+ * Outline: pool_run() starts the workers, hands the first task to worker
+ *		0 and returns once every task, including all the tasks submitted
+ *		by tasks, has finished. A task is a function and its argument.
+ *
+ *		Each worker has its own deque. A worker pushes and pops at the
+ *		tail, so it goes depth-first through the work it created itself,
+ *		while idle workers steal from the head, taking the oldest, and so
+ *		usually the largest, pieces of work.
+ *
+ * Priorities: with "ordered" set, each worker keeps a binary max-heap of
+ *		tasks by priority instead, in the same ring; the owner and thieves
+ *		alike take the top. The order is then only per worker: a worker
+ *		runs its own best task before a better one queued elsewhere, but
+ *		idle workers always take the best task they find.
+ *
+ * NUMA: with "numa" set, the workers are divided into contiguous groups,
+ *		one group per NUMA node (from /sys/devices/system/node), and each
+ *		worker is pinned to the CPUs of its node before it allocates
+ *		anything. Under the default first-touch policy its deque, and
+ *		whatever its start() hook allocates, then come from its own node.
+ *		A worker steals from the workers of its node before it tries the
+ *		workers of other nodes, so tasks and the buffers they touch cross
+ *		sockets only when a whole node has run dry.
+ *
+ * Layout: a worker's state is cache-line aligned and split by who writes
+ *		it: the deque, which thieves lock too; the counters, written by the
+ *		owner alone on every task; and the fields fixed at start-up. The
+ *		shared counters below sit on lines of their own, away from the
+ *		read-mostly globals. Counters are only summed by pool_stats(),
+ *		after the run, so no worker ever writes to a line another reads
+ *		per task, beyond the deque it is stealing from.
+ *
+ * Termination: "pending" counts tasks submitted but not yet finished, and
+ *		"queued" those still sitting in a deque. A worker that finds
+ *		nothing to steal sleeps until a task is queued, and all workers
+ *		leave once "pending" falls to zero.
+ *
+ * Holding: pool_start() starts the workers for many pool_run()s, as for
+ *		pfind --batch. Between runs they sleep, as they would waiting for
+ *		a task, instead of leaving; pool_run() only queues its first task
+ *		and waits for "pending" to fall to zero, and pool_stop() makes
+ *		them leave. Their deques, and whatever the start() hook gave them,
+ *		are kept from run to run.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pool.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define MAX_NODES	64
+#define DEQUE_MIN	256				//initial deque size, a power of two
+
+struct task {
+	pool_fn fn;
+	void *arg;
+	long prio;						//with "ordered", higher runs first
+};
+
+struct worker {
+	//the deque, shared with thieves
+	pthread_mutex_t lock;			//guards the deque
+	struct task *ring;				//"size" slots
+	long size;
+	long head, tail;				//steal at head, push and pop at tail
+
+	//written by the owner alone
+	struct pool_stats stats __attribute__((aligned(CACHE_LINE)));
+
+	//fixed once the worker starts
+	int id __attribute__((aligned(CACHE_LINE)));
+	int node;						//NUMA node the worker runs on
+	int *victims;					//other workers, in stealing order
+};
+
+//a counter alone on its cache line
+struct padded {
+	long n;
+} __attribute__((aligned(CACHE_LINE)));
+
+static void *worker_main(void *);
+static struct worker *new_worker(int);
+static void run(struct worker *);
+static void enqueue(struct worker *, struct task *);
+static int pop(struct worker *, struct task *);
+static int steal(struct worker *, struct task *);
+static void heap_up(struct worker *);
+static void heap_take(struct worker *, struct task *);
+static void wait_for_work();
+static void start_workers(struct pool_config *);
+static void join_workers();
+static void find_nodes();
+static int parse_cpulist(char *, cpu_set_t *);
+static void *xmalloc(size_t);
+
+/* FILE-SCOPE VARIABLES */
+static struct pool_config *config;
+static struct worker *workers[POOL_MAX];
+static int nworkers;
+static __thread int self = -1;		//index of the calling worker
+
+static struct padded pending;		//tasks submitted, not yet finished
+static struct padded queued;		//tasks waiting in a deque
+static struct padded idle;			//workers asleep in wait_for_work()
+static struct pool_stats totals;	//of the last run, for pool_stats()
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_barrier_t ready;		//every worker exists before any steals
+static pthread_t tids[POOL_MAX];
+
+static int holding;					//YES from pool_start() to pool_stop()
+static int stopping;				//YES once pool_stop() is called
+
+static int nnodes;					//NUMA nodes with CPUs we may use
+static cpu_set_t node_cpus[MAX_NODES];
+
+/*
+ *	pool_run()
+ *	Purpose: run "fn(arg)", and every task it submits, on a pool of workers
+ *	  Input: cfg, the number of workers, their placement and hooks; not
+ *			 looked at while the pool is held, see pool_start()
+ *			 fn, arg, the first task
+ *	 Return: once all tasks have finished and, unless the pool is held,
+ *			 the workers have exited
+ *	 Errors: If a thread cannot be created, pfind cannot search at all, so
+ *			 the error is printed and the program exits 1.
+ */
+void pool_run(struct pool_config *cfg, pool_fn fn, void *arg)
+{
+	struct task first = { fn, arg, 0 };
+
+	__atomic_store_n(&pending.n, 1, __ATOMIC_SEQ_CST);	//the first task
+	if (holding)
+	{
+		enqueue(workers[0], &first);
+		pthread_mutex_lock(&idle_lock);
+		while (__atomic_load_n(&pending.n, __ATOMIC_SEQ_CST) != 0)
+			pthread_cond_wait(&done_cond, &idle_lock);
+		pthread_mutex_unlock(&idle_lock);
+		return;
+	}
+
+	start_workers(cfg);
+	enqueue(workers[0], &first);
+	join_workers();
+}
+
+/*
+ *	pool_start()
+ *	Purpose: start a pool of workers that stays for every pool_run() until
+ *			 pool_stop(), so that a run costs no thread creation
+ *	  Input: cfg, as for pool_run(); it must last until pool_stop()
+ *	   Note: The start() hook runs once per worker, here, and finish()
+ *			 once, in pool_stop(); pool_stats() then covers all the runs.
+ */
+void pool_start(struct pool_config *cfg)
+{
+	holding = YES;
+	stopping = NO;
+	pending.n = 0;
+	start_workers(cfg);
+}
+
+/*
+ * pool_stop()
+ * Purpose: make the workers of pool_start() leave, once the last run is
+ *			over, and wait for them
+ */
+void pool_stop()
+{
+	pthread_mutex_lock(&idle_lock);
+	__atomic_store_n(&stopping, YES, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+
+	join_workers();
+	holding = NO;
+}
+
+/*
+ * start_workers()
+ * Purpose: create the workers of "cfg" and wait until each has its deque
+ */
+static void start_workers(struct pool_config *cfg)
+{
+	int i, err;
+
+	config = cfg;
+	nworkers = cfg->threads < 1 ? 1 : cfg->threads > POOL_MAX ? POOL_MAX
+				: cfg->threads;
+	if (cfg->numa)
+		find_nodes();
+	else
+		nnodes = 1;
+
+	pthread_barrier_init(&ready, NULL, nworkers + 1);
+	for (i = 0; i < nworkers; i++)
+	{
+		if ((err = pthread_create(&tids[i], NULL, worker_main,
+									(void *) (long) i)))
+		{
+			fprintf(stderr, "pool: cannot create thread: %s\n", strerror(err));
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&ready);
+}
+
+/*
+ * join_workers()
+ * Purpose: wait for the workers to leave, sum their counters into
+ *			"totals" and free them
+ */
+static void join_workers()
+{
+	int i;
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&ready);
+
+	memset(&totals, 0, sizeof totals);
+	for (i = 0; i < nworkers; i++)
+	{
+		totals.tasks += workers[i]->stats.tasks;
+		totals.steals += workers[i]->stats.steals;
+		totals.failed_steals += workers[i]->stats.failed_steals;
+		totals.sleeps += workers[i]->stats.sleeps;
+
+		pthread_mutex_destroy(&workers[i]->lock);
+		free(workers[i]->ring);
+		free(workers[i]->victims);
+		free(workers[i]);
+		workers[i] = NULL;
+	}
+}
+
+/*
+ *	pool_submit()
+ *	Purpose: queue "fn(arg)" to run on some worker
+ *	   Note: A worker queues on its own deque; "arg" belongs to the task.
+ */
+void pool_submit(pool_fn fn, void *arg)
+{
+	pool_submit_at(fn, arg, 0);
+}
+
+/*
+ * pool_submit_at()
+ * Purpose: queue "fn(arg)" with priority "prio", which only counts when
+ *			the pool is "ordered"
+ */
+void pool_submit_at(pool_fn fn, void *arg, long prio)
+{
+	struct task t = { fn, arg, prio };
+
+	__atomic_add_fetch(&pending.n, 1, __ATOMIC_SEQ_CST);
+	enqueue(workers[self < 0 ? 0 : self], &t);
+}
+
+/*
+ * pool_self()
+ * Return: the index of the calling worker, 0 to threads-1, or -1 if the
+ *		   caller is not a worker
+ */
+int pool_self()
+{
+	return self;
+}
+
+/*
+ * pool_stats()
+ * Purpose: copy out the counters of the last pool_run(), summed over its
+ *			workers
+ */
+void pool_stats(struct pool_stats *out)
+{
+	*out = totals;
+}
+
+/*
+ * pool_node()
+ * Return: the NUMA node worker "id" is placed on; 0 without placement
+ */
+int pool_node(int id)
+{
+	return (long) id * nnodes / nworkers;
+}
+
+static void *worker_main(void *arg)
+{
+	int id = (long) arg;
+	int node = pool_node(id);
+
+	//pin first, so that everything the worker allocates is node-local
+	if (config->numa && nnodes > 1)
+		pthread_setaffinity_np(pthread_self(), sizeof node_cpus[node],
+								&node_cpus[node]);
+
+	self = id;
+	workers[id] = new_worker(id);
+	if (config->start)
+		config->start(id);
+	pthread_barrier_wait(&ready);
+
+	run(workers[id]);
+
+	if (config->finish)
+		config->finish(id);
+	return NULL;
+}
+
+/*
+ * new_worker()
+ * Purpose: allocate a worker and its deque, and work out its victims:
+ *			the workers of its own node, then the others, each list
+ *			starting just after "id" so that thieves spread out
+ */
+static struct worker *new_worker(int id)
+{
+	struct worker *w = xmalloc(sizeof *w);
+	int i, n = 0, v;
+
+	memset(w, 0, sizeof *w);
+	pthread_mutex_init(&w->lock, NULL);
+	w->size = DEQUE_MIN;
+	w->ring = xmalloc(w->size * sizeof *w->ring);
+	w->head = w->tail = 0;
+	w->id = id;
+	w->node = pool_node(id);
+	w->victims = xmalloc(nworkers * sizeof *w->victims);
+
+	for (i = 1; i < nworkers; i++)
+		if (pool_node(v = (id + i) % nworkers) == w->node)
+			w->victims[n++] = v;
+	for (i = 1; i < nworkers; i++)
+		if (pool_node(v = (id + i) % nworkers) != w->node)
+			w->victims[n++] = v;
+	return w;
+}
+
+/*
+ * run()
+ * Purpose: the worker loop -- run local tasks, steal when out of them,
+ *			sleep when there is nothing to steal, leave when all is done;
+ *			in a held pool, when pool_stop() says so
+ */
+static void run(struct worker *w)
+{
+	struct task t;
+
+	for (;;)
+	{
+		if (pop(w, &t) || steal(w, &t))
+		{
+			t.fn(t.arg);
+			w->stats.tasks++;
+			if (__atomic_sub_fetch(&pending.n, 1, __ATOMIC_SEQ_CST) == 0)
+			{
+				pthread_mutex_lock(&idle_lock);		//wake everyone to leave
+				pthread_cond_broadcast(&idle_cond);
+				pthread_cond_broadcast(&done_cond);	//and a held pool_run()
+				pthread_mutex_unlock(&idle_lock);
+			}
+		}
+		else if (__atomic_load_n(&pending.n, __ATOMIC_SEQ_CST) == 0
+					&& (! holding
+						|| __atomic_load_n(&stopping, __ATOMIC_SEQ_CST)))
+			return;
+		else
+		{
+			w->stats.sleeps++;
+			wait_for_work();
+		}
+	}
+}
+
+/*
+ * enqueue()
+ * Purpose: push a task on the tail of "w", growing the deque if full, and
+ *			wake a sleeping worker to steal it; with "ordered", sift it up
+ *			into place in the heap
+ *   Note: "queued" is raised before "idle" is read, and wait_for_work()
+ *			raises "idle" before reading "queued", so one of the two always
+ *			sees the other and no wakeup is lost.
+ */
+static void enqueue(struct worker *w, struct task *t)
+{
+	struct task *ring;
+	long i;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail - w->head == w->size)
+	{
+		ring = xmalloc(2 * w->size * sizeof *ring);
+		for (i = w->head; i < w->tail; i++)
+			ring[i & (2 * w->size - 1)] = w->ring[i & (w->size - 1)];
+		free(w->ring);
+		w->ring = ring;
+		w->size *= 2;
+	}
+	w->ring[w->tail & (w->size - 1)] = *t;
+	__atomic_store_n(&w->tail, w->tail + 1, __ATOMIC_RELEASE);
+	if (config->ordered)
+		heap_up(w);
+	pthread_mutex_unlock(&w->lock);
+
+	__atomic_add_fetch(&queued.n, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&idle.n, __ATOMIC_SEQ_CST) > 0)
+	{
+		pthread_mutex_lock(&idle_lock);
+		pthread_cond_signal(&idle_cond);
+		pthread_mutex_unlock(&idle_lock);
+	}
+}
+
+/*
+ * pop()
+ * Purpose: take the newest task from the worker's own deque, or its best
+ *			with "ordered"
+ *  Return: YES with the task in "t", or NO if the deque is empty
+ */
+static int pop(struct worker *w, struct task *t)
+{
+	int found = NO;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail > w->head && config->ordered)
+	{
+		heap_take(w, t);
+		found = YES;
+	}
+	else if (w->tail > w->head)
+	{
+		*t = w->ring[(w->tail - 1) & (w->size - 1)];
+		__atomic_store_n(&w->tail, w->tail - 1, __ATOMIC_RELEASE);
+		found = YES;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if (found)
+		__atomic_sub_fetch(&queued.n, 1, __ATOMIC_SEQ_CST);
+	return found;
+}
+
+/*
+ * steal()
+ * Purpose: take the oldest task of the first victim that has one, or
+ *			its best with "ordered"
+ *  Return: YES with the task in "t", or NO if every deque looked empty
+ *  Method: an unlocked look at head and tail skips empty deques without
+ *			touching their locks, which may sit on another node
+ */
+static int steal(struct worker *w, struct task *t)
+{
+	struct worker *v;
+	int i, found = NO;
+
+	for (i = 0; i < nworkers - 1 && ! found; i++)
+	{
+		v = workers[w->victims[i]];
+		if (__atomic_load_n(&v->tail, __ATOMIC_ACQUIRE)
+				== __atomic_load_n(&v->head, __ATOMIC_ACQUIRE))
+			continue;
+
+		pthread_mutex_lock(&v->lock);
+		if (v->tail > v->head && config->ordered)
+		{
+			heap_take(v, t);
+			found = YES;
+		}
+		else if (v->tail > v->head)
+		{
+			*t = v->ring[v->head & (v->size - 1)];
+			__atomic_store_n(&v->head, v->head + 1, __ATOMIC_RELEASE);
+			found = YES;
+		}
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	if (found)
+	{
+		w->stats.steals++;
+		__atomic_sub_fetch(&queued.n, 1, __ATOMIC_SEQ_CST);
+	}
+	else
+		w->stats.failed_steals++;
+	return found;
+}
+
+/*
+ * heap_up()
+ * Purpose: move the task just added at the tail of "w" up the heap to its
+ *			place; "w" is locked, and with "ordered" its head stays 0
+ */
+static void heap_up(struct worker *w)
+{
+	struct task *ring = w->ring, t;
+	long i = w->tail - 1, parent;
+
+	for (; i > 0 && ring[parent = (i - 1) / 2].prio < ring[i].prio; i = parent)
+	{
+		t = ring[i];
+		ring[i] = ring[parent];
+		ring[parent] = t;
+	}
+}
+
+/*
+ * heap_take()
+ * Purpose: remove the top of the heap of "w", which is locked and not
+ *			empty, into "t"
+ */
+static void heap_take(struct worker *w, struct task *t)
+{
+	struct task *ring = w->ring, tmp;
+	long n = w->tail - 1, i = 0, c;
+
+	*t = ring[0];
+	ring[0] = ring[n];
+	__atomic_store_n(&w->tail, n, __ATOMIC_RELEASE);
+
+	for (; (c = 2 * i + 1) < n; i = c)
+	{
+		if (c + 1 < n && ring[c + 1].prio > ring[c].prio)
+			c++;
+		if (ring[c].prio <= ring[i].prio)
+			break;
+		tmp = ring[i];
+		ring[i] = ring[c];
+		ring[c] = tmp;
+	}
+}
+
+/*
+ * wait_for_work()
+ * Purpose: sleep until a task is queued or all tasks have finished; in a
+ *			held pool, until a task is queued or pool_stop() is called
+ */
+static void wait_for_work()
+{
+	pthread_mutex_lock(&idle_lock);
+	__atomic_add_fetch(&idle.n, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&queued.n, __ATOMIC_SEQ_CST) == 0
+			&& (__atomic_load_n(&pending.n, __ATOMIC_SEQ_CST) != 0
+				|| (holding && ! stopping)))
+		pthread_cond_wait(&idle_cond, &idle_lock);
+	__atomic_sub_fetch(&idle.n, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+/*
+ * find_nodes()
+ * Purpose: read the CPUs of each NUMA node, keeping only those we are
+ *			allowed to run on, into node_cpus[]
+ *    Note: Without /sys (or with one node) all CPUs form a single node,
+ *			and placement does nothing.
+ */
+static void find_nodes()
+{
+	cpu_set_t allowed, cpus;
+	char path[64], list[4096];
+	FILE *fp;
+	int n;
+
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof allowed, &allowed);
+
+	nnodes = 0;
+	for (n = 0; n < 1024 && nnodes < MAX_NODES; n++)
+	{
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", n);
+		if ((fp = fopen(path, "r")) == NULL)
+			continue;							//node numbers may have gaps
+		if (fgets(list, sizeof list, fp) && parse_cpulist(list, &cpus) == 0)
+		{
+			CPU_AND(&cpus, &cpus, &allowed);
+			if (CPU_COUNT(&cpus) > 0)			//skip memory-only nodes
+				node_cpus[nnodes++] = cpus;
+		}
+		fclose(fp);
+	}
+
+	if (nnodes == 0)
+	{
+		nnodes = 1;
+		node_cpus[0] = allowed;
+	}
+}
+
+/*
+ * parse_cpulist()
+ * Purpose: parse a list such as "0-3,8-11" into a cpu set
+ *  Return: 0, or -1 if the list is malformed
+ */
+static int parse_cpulist(char *list, cpu_set_t *cpus)
+{
+	char *p = list;
+	long lo, hi;
+
+	CPU_ZERO(cpus);
+	while (*p && *p != '\n')
+	{
+		lo = hi = strtol(p, &p, 10);
+		if (*p == '-')
+			hi = strtol(p + 1, &p, 10);
+		if (lo < 0 || hi < lo)
+			return -1;
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, cpus);
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * xmalloc()
+ * Purpose: allocate the pool's own structures, which it cannot do
+ *			without, each starting on a cache line of its own; exits if
+ *			memory runs out
+ */
+static void *xmalloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, CACHE_LINE, size) != 0)
+	{
+		perror("pool");
+		exit(1);
+	}
+	return p;
+}
@@ -0,0 +1,42 @@
+/*
+ * ==========================
+ *   FILE: ./pool.h
+ * ==========================
+ * Purpose: A work-stealing pool of worker threads, see pool.c.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+/* CONSTANTS */
+#define POOL_MAX	256				//most workers a pool may have
+#define CACHE_LINE	64				//per-worker state is padded to this
+
+typedef void (*pool_fn)(void *);
+
+struct pool_config {
+	int threads;					//number of workers
+	int numa;						//YES: place workers per NUMA node
+	int ordered;					//YES: highest priority first, not LIFO
+	void (*start)(int);				//run by each worker before any task
+	void (*finish)(int);			//run by each worker after its last task
+};
+
+//what the workers did, summed over all of them
+struct pool_stats {
+	long tasks;						//tasks run
+	long steals;					//tasks taken from another worker
+	long failed_steals;				//passes over all victims finding none
+	long sleeps;					//times a worker went idle
+};
+
+void pool_run(struct pool_config *, pool_fn, void *);
+void pool_start(struct pool_config *);
+void pool_stop();
+void pool_submit(pool_fn, void *);
+void pool_submit_at(pool_fn, void *, long);
+int pool_self();
+int pool_node(int);
+void pool_stats(struct pool_stats *);
+
+#endif
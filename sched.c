@@ -0,0 +1,362 @@
+/*
+ * ==========================
+ *   FILE: ./sched.c
+ * ==========================
+ * Purpose: Priorities for the directory tasks of --threads, so that the
+ *		pool (with "ordered" set) runs the most promising ones first.
+ *
+ * Outline: sched_priority() gives a subdirectory its priority, by policy:
+ *
+ *		shallow	 -- the least deep first, so the top of the tree is spread
+ *					over the workers before any of them goes deep
+ *		largest	 -- the largest subtree first, so that the long one does
+ *					not start last. The size is the one recorded for the
+ *					directory by an earlier --save-weights run, if the
+ *					--weights file has it, or else a guess from its stat():
+ *					its size in bytes and its number of subdirectories.
+ *		weighted -- the weight of the longest path prefix in the --weights
+ *					file that the directory is in, 0 if none
+ *
+ *		The last two break ties by depth, deepest first, so that among
+ *		equals the search stays depth-first and the queues stay short.
+ *
+ * Weights: a --weights file has a line "WEIGHT PATH" per directory, the
+ *		path written as pfind prints it; blank lines and '#' comments are
+ *		skipped. The lines are kept sorted, and a prefix is looked up by
+ *		trying the path and then each of its parents in turn, so a prefix
+ *		matches whole components only.
+ *
+ *		sched_dir() records each directory searched and its parent, and
+ *		sched_save() writes a weights file of the entries below each, so
+ *		that the next run can use the sizes this one saw.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include "sched.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define DEPTH_SLOTS		1024		//depths told apart in a tie
+#define WEIGHT_MAX		(LONG_MAX / DEPTH_SLOTS)
+#define DIRENT_GUESS	32			//bytes of a directory per entry
+#define SUBDIR_GUESS	64			//entries guessed per subdirectory
+#define SAVE_MIN		256			//smaller subtrees are not saved
+
+//a line of the --weights file
+struct weight {
+	char *path;
+	long weight;
+};
+
+//a directory searched, for --save-weights
+struct sched_dir {
+	struct sched_dir *parent;		//the directory it was found in, or NULL
+	struct sched_dir *next;			//on the list of all
+	long seq;						//order recorded, after its parent's
+	long entries;					//in the directory itself
+	long subtree;					//in it and below, from sched_save()
+	char path[];
+};
+
+static long find(char *, size_t);
+static size_t parent(char *, size_t);
+static long guess(struct stat *);
+static int by_path(const void *, const void *);
+static int by_seq_down(const void *, const void *);
+static int by_dir_path(const void *, const void *);
+
+/* FILE-SCOPE VARIABLES */
+static struct weight *weights;		//sorted by path
+static long nweights;
+static struct sched_dir *dirs;		//every directory recorded
+static long ndirs;
+
+/*
+ *	sched_policy()
+ *	Purpose: tell a --schedule policy by name
+ *	 Return: SCHED_*, or -1 if "name" is none of them
+ */
+int sched_policy(char *name)
+{
+	static char *names[] = { "depth", "shallow", "largest", "weighted" };
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ *	sched_load()
+ *	Purpose: read a --weights file
+ *	 Return: 0, or -1 with errno set if it cannot be read, or EINVAL if a
+ *			 line is not "WEIGHT PATH"
+ */
+int sched_load(char *file)
+{
+	FILE *fp = fopen(file, "r");
+	char *line = NULL, *path;
+	size_t size = 0, room = 0, len;
+	struct weight *w;
+	long n;
+	int failed = NO;
+
+	if (fp == NULL)
+		return -1;
+
+	while (getline(&line, &size, fp) != -1)
+	{
+		len = strcspn(line, "\n");
+		line[len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		n = strtol(line, &path, 10);
+		if (path == line || *path != ' ' || n < 0 || path[1] == '\0')
+		{
+			free(line);
+			fclose(fp);
+			errno = EINVAL;
+			return -1;
+		}
+		for (len = strlen(++path); len > 1 && path[len - 1] == '/'; )
+			path[--len] = '\0';					//as pfind prints it
+
+		if (nweights == (long) room)
+		{
+			room = room ? 2 * room : 64;
+			if ((w = realloc(weights, room * sizeof *w)) == NULL)
+				failed = YES;
+			else
+				weights = w;
+		}
+		if (failed || (weights[nweights].path = strdup(path)) == NULL)
+		{
+			failed = YES;						//errno is ENOMEM
+			break;
+		}
+		weights[nweights++].weight = n > WEIGHT_MAX ? WEIGHT_MAX : n;
+	}
+	failed = failed || ferror(fp);
+	free(line);
+	fclose(fp);
+	if (failed)
+		return -1;
+
+	qsort(weights, nweights, sizeof *weights, by_path);
+	return 0;
+}
+
+/*
+ *	sched_priority()
+ *	Purpose: the priority of the subdirectory "path" under "policy"
+ *	  Input: depth, its depth below the starting path
+ *			 info, its stat(), for a guess at its size
+ *	 Return: the priority, higher to run first
+ */
+long sched_priority(int policy, char *path, int depth, struct stat *info)
+{
+	size_t len = strlen(path);
+	long w = -1;
+
+	if (policy == SCHED_SHALLOW)
+		return -depth;
+
+	if (policy == SCHED_LARGEST && (w = find(path, len)) < 0)
+		w = guess(info);
+
+	//the longest prefix: "path", then each parent in turn
+	while (policy == SCHED_WEIGHTED && w < 0 && len > 0)
+	{
+		w = find(path, len);
+		len = parent(path, len);
+	}
+
+	return (w < 0 ? 0 : w) * DEPTH_SLOTS
+			+ (depth < DEPTH_SLOTS ? depth : DEPTH_SLOTS - 1);
+}
+
+/*
+ *	sched_dir()
+ *	Purpose: record a directory about to be searched, for sched_save()
+ *	  Input: parent, the record of the directory it was found in, or NULL
+ *			 path, the directory
+ *	 Return: its record, or NULL if there is no memory; it is then left
+ *			 out of the totals
+ *	   Note: Any thread may record directories at once.
+ */
+struct sched_dir *sched_dir(struct sched_dir *parent, char *path)
+{
+	struct sched_dir *d = malloc(sizeof *d + strlen(path) + 1);
+
+	if (d == NULL)
+		return NULL;
+	d->parent = parent;
+	d->seq = __atomic_fetch_add(&ndirs, 1, __ATOMIC_RELAXED);
+	d->entries = d->subtree = 0;
+	strcpy(d->path, path);
+
+	d->next = __atomic_load_n(&dirs, __ATOMIC_RELAXED);
+	while (! __atomic_compare_exchange_n(&dirs, &d->next, d, NO,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	return d;
+}
+
+/*
+ * sched_entries()
+ * Purpose: count "n" more entries in the directory of "d", if any; the
+ *			chunks of a huge directory count theirs from other threads
+ */
+void sched_entries(struct sched_dir *d, long n)
+{
+	if (d)
+		__atomic_add_fetch(&d->entries, n, __ATOMIC_RELAXED);
+}
+
+/*
+ *	sched_save()
+ *	Purpose: write a --weights file of the entries in and below each
+ *			 directory recorded, for the next run's "largest" policy
+ *	 Return: 0, or -1 with errno set
+ *	 Method: A directory is recorded after the one it was found in, so
+ *			 going through them newest first adds every subtree into its
+ *			 parent's before the parent is added in turn. Only the
+ *			 starting directory and those with SAVE_MIN entries or more
+ *			 are written; the rest are guessed well enough.
+ *	   Note: No thread may be recording directories.
+ */
+int sched_save(char *file)
+{
+	struct sched_dir **all, *d;
+	FILE *fp;
+	long i, n = 0;
+
+	if ((all = malloc((ndirs ? ndirs : 1) * sizeof *all)) == NULL)
+		return -1;
+	for (d = dirs; d; d = d->next)
+		all[n++] = d;
+
+	qsort(all, n, sizeof *all, by_seq_down);
+	for (i = 0; i < n; i++)
+	{
+		all[i]->subtree += all[i]->entries;
+		if (all[i]->parent)
+			all[i]->parent->subtree += all[i]->subtree;
+	}
+	qsort(all, n, sizeof *all, by_dir_path);
+
+	if ((fp = fopen(file, "w")) == NULL)
+	{
+		free(all);
+		return -1;
+	}
+	fprintf(fp, "# pfind --save-weights: entries in and below each "
+			"directory\n");
+	for (i = 0; i < n; i++)
+		if (all[i]->parent == NULL || all[i]->subtree >= SAVE_MIN)
+			fprintf(fp, "%ld %s\n", all[i]->subtree, all[i]->path);
+	free(all);
+	return fclose(fp) == EOF ? -1 : 0;
+}
+
+/*
+ * sched_free()
+ * Purpose: release the weights and the directories recorded
+ */
+void sched_free()
+{
+	struct sched_dir *d;
+
+	while (nweights > 0)
+		free(weights[--nweights].path);
+	free(weights);
+	weights = NULL;
+
+	while ((d = dirs) != NULL)
+	{
+		dirs = d->next;
+		free(d);
+	}
+	ndirs = 0;
+}
+
+/*
+ * find()
+ * Return: the weight of the first "len" bytes of "path", or -1 if there
+ *		   is no such line
+ */
+static long find(char *path, size_t len)
+{
+	long lo = 0, hi = nweights - 1, mid;
+	int c;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		c = strncmp(path, weights[mid].path, len);
+		if (c == 0 && weights[mid].path[len] != '\0')
+			c = -1;								//a longer path
+		if (c == 0)
+			return weights[mid].weight;
+		if (c < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+/*
+ * parent()
+ * Return: the length of the parent of the first "len" bytes of "path",
+ *		   "/" for "/name", or 0 if it has none
+ */
+static size_t parent(char *path, size_t len)
+{
+	size_t n = len;
+
+	while (n > 0 && path[n - 1] != '/')
+		n--;
+	if (n == 0 || len == 1)
+		return 0;								//"name", or "/" itself
+	return n == 1 ? 1 : n - 1;
+}
+
+/*
+ * guess()
+ * Return: a guess at the entries below a directory from its stat(): its
+ *		   size in bytes, and its links, one from each subdirectory
+ */
+static long guess(struct stat *info)
+{
+	long subdirs = info->st_nlink > 2 ? (long) info->st_nlink - 2 : 0;
+
+	return info->st_size / DIRENT_GUESS + subdirs * SUBDIR_GUESS;
+}
+
+static int by_path(const void *a, const void *b)
+{
+	return strcmp(((const struct weight *) a)->path,
+					((const struct weight *) b)->path);
+}
+
+static int by_seq_down(const void *a, const void *b)
+{
+	long x = (*(struct sched_dir * const *) a)->seq;
+	long y = (*(struct sched_dir * const *) b)->seq;
+
+	return (x < y) - (x > y);
+}
+
+static int by_dir_path(const void *a, const void *b)
+{
+	return strcmp((*(struct sched_dir * const *) a)->path,
+					(*(struct sched_dir * const *) b)->path);
+}
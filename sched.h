@@ -0,0 +1,29 @@
+/*
+ * ==========================
+ *   FILE: ./sched.h
+ * ==========================
+ * Purpose: Which directory task --threads runs first, see sched.c.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <sys/stat.h>
+
+/* CONSTANTS */
+#define SCHED_DEPTH		0			//the pool's own LIFO order, unordered
+#define SCHED_SHALLOW	1			//smallest depth first
+#define SCHED_LARGEST	2			//largest (recorded or guessed) subtree
+#define SCHED_WEIGHTED	3			//highest --weights weight first
+
+struct sched_dir;					//a directory searched, for saving
+
+int sched_policy(char *);
+int sched_load(char *);
+long sched_priority(int, char *, int, struct stat *);
+struct sched_dir *sched_dir(struct sched_dir *, char *);
+void sched_entries(struct sched_dir *, long);
+int sched_save(char *);
+void sched_free();
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * ==========================
+ *   FILE: ./topn.c
+ * ==========================
+ * Purpose: Keep the N best of a stream of matches by a key, for --top,
+ *		so that the largest or newest files are found without printing
+ *		every match to sort them elsewhere.
+ *
+ * Outline: each thread offers its own matches to its own top_heap, a
+ *		binary min-heap of at most N, so no lock is taken per match. The
+ *		worst match kept is on top: a new one that is no better is turned
+ *		down by its key alone, before its path is even copied, which is
+ *		what nearly every match comes to once the heap is full. At the
+ *		end the heaps are merged into one by top_merge() and sorted by
+ *		top_sort(), so memory stays N matches per thread.
+ *
+ *		Of two matches with the same key the one whose path sorts first
+ *		is better, so the N kept do not depend on the order the matches
+ *		came in, nor on how they were spread over threads.
+ *
+ * Memory: an item keeps its path buffer when another path replaces it,
+ *		and the path offered is built in the heap's scratch buffer and
+ *		swapped in, not copied, so a full heap allocates only when a path
+ *		is longer than any before it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "topn.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define PATH_MIN	64				//first size of a path buffer
+
+static int better(long long, char *, struct top_item *);
+static void sift_up(struct top_heap *, int);
+static void sift_down(struct top_heap *, int);
+static int reserve(char **, size_t *, size_t);
+static int by_rank(const void *, const void *);
+
+/*
+ *	top_offer()
+ *	Purpose: offer a match to heap "h", which keeps it if it is among the
+ *			 "n" best offered so far
+ *	  Input: n, the matches to keep; only looked at on the first offer
+ *			 key, the match's key, higher being better
+ *			 path, the match, and member, an archive member in it or NULL,
+ *			 for "path!/member"
+ *	 Return: 0, or -1 with errno set if there is no memory; the match is
+ *			 then left out
+ */
+int top_offer(struct top_heap *h, int n, long long key, char *path,
+				char *member)
+{
+	size_t plen, mlen, swap_size;
+	struct top_item *it;
+	char *swap;
+	int full;
+
+	if (h->items == NULL)
+	{
+		if ((h->items = calloc(n, sizeof *h->items)) == NULL)
+			return -1;
+		h->n = n;
+	}
+	full = h->count == h->n;
+	if (full && key < h->items[0].key)
+		return 0;								//the usual case
+
+	plen = strlen(path);
+	mlen = member ? strlen(member) + 2 : 0;
+	if (reserve(&h->scratch, &h->scratch_size, plen + mlen + 1) == -1)
+		return -1;
+	memcpy(h->scratch, path, plen + 1);
+	if (member)
+	{
+		memcpy(h->scratch + plen, "!/", 2);
+		memcpy(h->scratch + plen + 2, member, mlen - 1);
+	}
+
+	if (full && ! better(key, h->scratch, &h->items[0]))
+		return 0;
+
+	//the worst kept, at the top, or a free slot at the bottom
+	it = full ? &h->items[0] : &h->items[h->count++];
+	swap = it->path;
+	swap_size = it->size;
+	it->key = key;
+	it->path = h->scratch;
+	it->size = h->scratch_size;
+	h->scratch = swap;
+	h->scratch_size = swap_size;
+
+	if (full)
+		sift_down(h, 0);
+	else
+		sift_up(h, it - h->items);
+	return 0;
+}
+
+/*
+ *	top_merge()
+ *	Purpose: offer everything "from" keeps to "into", and empty "from"
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+int top_merge(struct top_heap *into, struct top_heap *from)
+{
+	int i, rv = 0;
+
+	for (i = 0; i < from->count; i++)
+		if (top_offer(into, from->n, from->items[i].key,
+						from->items[i].path, NULL) == -1)
+			rv = -1;
+	top_clear(from);
+	return rv;
+}
+
+/*
+ * top_sort()
+ * Purpose: sort what "h" keeps best first, for output; it is no longer
+ *			a heap, so top_clear() it before offering more
+ */
+void top_sort(struct top_heap *h)
+{
+	qsort(h->items, h->count, sizeof *h->items, by_rank);
+}
+
+/*
+ * top_clear()
+ * Purpose: empty "h", keeping its buffers for the next matches
+ */
+void top_clear(struct top_heap *h)
+{
+	h->count = 0;
+}
+
+/*
+ * top_free()
+ * Purpose: release what "h" holds, leaving it empty
+ */
+void top_free(struct top_heap *h)
+{
+	int i;
+
+	for (i = 0; h->items && i < h->n; i++)
+		free(h->items[i].path);
+	free(h->items);
+	free(h->scratch);
+	memset(h, 0, sizeof *h);
+}
+
+/*
+ * better()
+ * Return: YES if the match "key", "path" ranks above item "it": a higher
+ *		   key, or the same key and a path that sorts first
+ */
+static int better(long long key, char *path, struct top_item *it)
+{
+	if (key != it->key)
+		return key > it->key;
+	return strcmp(path, it->path) < 0;
+}
+
+/*
+ * sift_up()
+ * Purpose: move item "i" of "h" up the heap while it is worse than its
+ *			parent
+ */
+static void sift_up(struct top_heap *h, int i)
+{
+	struct top_item *items = h->items, t;
+	int parent;
+
+	for (; i > 0; i = parent)
+	{
+		parent = (i - 1) / 2;
+		if (! better(items[parent].key, items[parent].path, &items[i]))
+			break;
+		t = items[i];
+		items[i] = items[parent];
+		items[parent] = t;
+	}
+}
+
+/*
+ * sift_down()
+ * Purpose: move item "i" of "h" down the heap while a child is worse
+ */
+static void sift_down(struct top_heap *h, int i)
+{
+	struct top_item *items = h->items, t;
+	int c;
+
+	for (; (c = 2 * i + 1) < h->count; i = c)
+	{
+		if (c + 1 < h->count
+				&& better(items[c].key, items[c].path, &items[c + 1]))
+			c++;								//the worse child
+		if (! better(items[i].key, items[i].path, &items[c]))
+			break;
+		t = items[i];
+		items[i] = items[c];
+		items[c] = t;
+	}
+}
+
+/*
+ * reserve()
+ * Purpose: make sure buffer "*buf" of "*size" bytes holds at least
+ *			"need", growing it by doubling
+ *  Return: 0, or -1 with errno set if there is no memory
+ */
+static int reserve(char **buf, size_t *size, size_t need)
+{
+	size_t n = *size ? *size : PATH_MIN;
+	char *p;
+
+	if (need <= *size)
+		return 0;
+	while (n < need)
+		n *= 2;
+	if ((p = realloc(*buf, n)) == NULL)
+		return -1;
+	*buf = p;
+	*size = n;
+	return 0;
+}
+
+static int by_rank(const void *a, const void *b)
+{
+	const struct top_item *x = a, *y = b;
+
+	if (better(x->key, x->path, (struct top_item *) y))
+		return -1;
+	return better(y->key, y->path, (struct top_item *) x);
+}
@@ -0,0 +1,33 @@
+/*
+ * ==========================
+ *   FILE: ./topn.h
+ * ==========================
+ * Purpose: The N best matches by a key, for --top, see topn.c.
+ */
+
+#ifndef TOPN_H
+#define TOPN_H
+
+//a match kept, its path its own
+struct top_item {
+	long long key;					//higher is better
+	char *path;						//"size" bytes
+	size_t size;
+};
+
+//the best "n" matches offered so far, a heap with the worst on top
+struct top_heap {
+	int n;							//kept at most, 0 until the first offer
+	int count;						//kept now
+	struct top_item *items;			//"n" of them
+	char *scratch;					//a path being offered, "scratch_size"
+	size_t scratch_size;
+};
+
+int top_offer(struct top_heap *, int, long long, char *, char *);
+int top_merge(struct top_heap *, struct top_heap *);
+void top_sort(struct top_heap *);
+void top_clear(struct top_heap *);
+void top_free(struct top_heap *);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * ==========================
+ *   FILE: ./trace.c
+ * ==========================
+ * Purpose: Record the directory structure and syscall latencies seen by a
+ *		search, and replay a recorded trace as if it were a filesystem.
+ *
+ * Outline: record_backend() wraps another backend (normally posix_backend)
+ *		and appends one line to the trace for every opendir() and stat()
+ *		made through it. replay_backend() reads such a trace back into a
+ *		tree of struct mnode and serves the walker from it with memfs.c,
+ *		which simulates each recorded latency (scaled) so that traversal
+ *		changes can be timed offline against a copy of a production tree.
+ *
+ * Format: a text file, one record per line:
+ *
+ *		#pfind-trace 1 <root path>
+ *		D <latency ns> <errno>
+ *		E <depth> <mode> <dev> <ino> <nlink> <uid> <gid> <size> <mtime>
+ *		  <atime> <ctime> <latency ns> <errno> <name>
+ *
+ *		"E" is an entry that was stat()ed, at <depth> directories below the
+ *		start (depth 0 is the starting path itself). "D" is an opendir() of
+ *		the most recent entry, or of the starting path if there is none yet.
+ *		The name runs to the end of the line with '\' and newline escaped
+ *		as "\\" and "\n". With name hashing, every name other than "." and
+ *		".." is replaced by a hash of its stem, keeping a leading '.' and a
+ *		short extension so that -name patterns like "*.log" still work.
+ *		The starting path in the header is never hashed, so the trace can
+ *		be replayed with the command line it was recorded with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "backend.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define MAX_EXT		8				//longest extension kept when hashing
+#define MAX_DEPTH	4096			//deepest replayable tree
+
+/* RECORDING */
+struct rec_dir {
+	void *dir;						//handle from the wrapped backend
+	struct batch *batch;			//batch last filled by readdir()
+	int depth;
+};
+
+static void *rec_opendir(char *);
+static int rec_readdir(void *, struct batch *);
+static int rec_stat(void *, int, char *, struct stat *);
+static void rec_closedir(void *);
+static void write_name(char *, int);
+static void hash_name(char *, char *);
+
+/* REPLAY */
+static void unescape(char *);
+static long now_ns();
+
+/* FILE-SCOPE VARIABLES */
+static struct backend *inner;		//backend being recorded
+static FILE *trace;					//trace being written
+static int hash_names;
+static int depth;					//directories open right now
+
+
+static struct backend recorder = {
+	rec_opendir, rec_readdir, rec_stat, rec_closedir
+};
+
+/*
+ *	record_backend()
+ *	Purpose: start recording the calls made through "be" to "file"
+ *	  Input: be, the backend to wrap
+ *			 file, the trace file to create
+ *			 start, the starting path of the search
+ *			 hash, YES to hash names for privacy
+ *	 Return: the recording backend, or NULL with errno set if "file"
+ *			 could not be created
+ */
+struct backend *record_backend(struct backend *be, char *file, char *start,
+								int hash)
+{
+	if ((trace = fopen(file, "w")) == NULL)
+		return NULL;
+
+	inner = be;
+	hash_names = hash;
+	fprintf(trace, "#pfind-trace 1 ");
+	write_name(start, NO);
+	return &recorder;
+}
+
+/*
+ * record_finish()
+ * Purpose: flush and close the trace
+ *  Return: 0, or -1 with errno set if the trace could not be written
+ */
+int record_finish()
+{
+	if (trace == NULL)
+		return 0;
+	if (ferror(trace) | fclose(trace))
+		return -1;
+	trace = NULL;
+	return 0;
+}
+
+static void *rec_opendir(char *path)
+{
+	struct rec_dir *rd;
+	long start = now_ns();
+	void *dir = inner->opendir(path);
+	int err = errno;
+
+	fprintf(trace, "D %ld %d\n", now_ns() - start, dir ? 0 : err);
+	if (dir == NULL)
+	{
+		errno = err;
+		return NULL;
+	}
+
+	if ((rd = malloc(sizeof *rd)) == NULL)
+	{
+		inner->closedir(dir);
+		errno = ENOMEM;
+		return NULL;
+	}
+	rd->dir = dir;
+	rd->batch = NULL;
+	rd->depth = ++depth;
+	return rd;
+}
+
+static int rec_readdir(void *dir, struct batch *b)
+{
+	struct rec_dir *rd = dir;
+
+	rd->batch = b;
+	return inner->readdir(rd->dir, b);
+}
+
+static int rec_stat(void *dir, int i, char *path, struct stat *info)
+{
+	struct rec_dir *rd = dir;
+	int saved = errno;
+	long start = now_ns();
+	int rv = inner->stat(rd ? rd->dir : NULL, i, path, info);
+	int err = rv == -1 ? errno : 0;
+	struct stat none;
+
+	if (rv == -1)
+	{
+		memset(&none, 0, sizeof none);
+		info = &none;
+	}
+
+	fprintf(trace, "E %d %o %lu %lu %lu %u %u %lld %lld %lld %lld %ld %d ",
+			rd ? rd->depth : 0, (unsigned) info->st_mode,
+			(unsigned long) info->st_dev, (unsigned long) info->st_ino,
+			(unsigned long) info->st_nlink, info->st_uid, info->st_gid,
+			(long long) info->st_size, (long long) info->st_mtime,
+			(long long) info->st_atime, (long long) info->st_ctime,
+			now_ns() - start, err);
+	write_name(rd ? rd->batch->name[i] : path, hash_names);
+
+	errno = rv == -1 ? err : saved;
+	return rv;
+}
+
+static void rec_closedir(void *dir)
+{
+	struct rec_dir *rd = dir;
+
+	inner->closedir(rd->dir);
+	free(rd);
+	depth--;
+}
+
+/*
+ *	write_name()
+ *	Purpose: write "name" and a newline to the trace, escaped, and hashed
+ *			 first if "hash" is YES
+ */
+static void write_name(char *name, int hash)
+{
+	char hashed[64];
+	char *p;
+
+	if (hash && strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+	{
+		hash_name(name, hashed);
+		name = hashed;
+	}
+
+	for (p = name; *p; p++)
+	{
+		if (*p == '\\')
+			fputs("\\\\", trace);
+		else if (*p == '\n')
+			fputs("\\n", trace);
+		else
+			putc(*p, trace);
+	}
+	putc('\n', trace);
+}
+
+/*
+ *	hash_name()
+ *	Purpose: replace a name by a 64-bit FNV-1a hash of it, in hex, keeping
+ *			 a leading '.' and an extension of up to MAX_EXT characters
+ *	 Output: "out" must hold at least 1 + 16 + 1 + MAX_EXT + 1 chars
+ */
+static void hash_name(char *name, char *out)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	char *ext = strrchr(name, '.');
+	char *p;
+
+	for (p = name; *p; p++)
+		h = (h ^ (unsigned char) *p) * 1099511628211ULL;
+
+	if (ext == name || ext == NULL || strlen(ext) > MAX_EXT + 1)
+		ext = "";
+	sprintf(out, "%s%016llx%s", name[0] == '.' ? "." : "", h, ext);
+}
+
+/*
+ *	replay_backend()
+ *	Purpose: load a trace written by record_backend() for replaying
+ *	  Input: file, the trace to read
+ *			 latency_scale, multiplier for the recorded latencies; 0
+ *			 replays as fast as possible
+ *	 Return: the replay backend, or NULL with errno set if the trace could
+ *			 not be read. A malformed trace sets errno to EINVAL.
+ */
+struct backend *replay_backend(char *file, double latency_scale)
+{
+	FILE *fp = fopen(file, "r");
+	struct mnode **stack;			//open directories, by depth
+	struct mnode *root = NULL;		//the starting path
+	struct mnode *last = NULL;		//target of the next "D" record
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	unsigned mode, uid, gid;
+	unsigned long dev, ino, nlink;
+	long long size, mtime, atime, ctime;
+	long lat;
+	int d, err, pos, bad = NO;
+
+	if (fp == NULL)
+		return NULL;
+	stack = calloc(MAX_DEPTH, sizeof *stack);
+
+	while (!bad && stack && (len = getline(&line, &cap, fp)) > 0)
+	{
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (root == NULL)					//header names the root
+		{
+			if (strncmp(line, "#pfind-trace 1 ", 15) != 0)
+				bad = YES;
+			else
+			{
+				unescape(line + 15);
+				last = stack[0] = root = mem_node(NULL, line + 15);
+			}
+		}
+		else if (line[0] == 'D')
+		{
+			if (sscanf(line, "D %ld %d", &lat, &err) != 2)
+				bad = YES;
+			else
+			{
+				last->opened = YES;
+				last->dir_ns = lat;
+				last->dir_err = err;
+			}
+		}
+		else if (sscanf(line, "E %d %o %lu %lu %lu %u %u %lld %lld %lld %lld "
+						"%ld %d %n", &d, &mode, &dev, &ino, &nlink,
+						&uid, &gid, &size, &mtime,
+						&atime, &ctime, &lat, &err, &pos) != 13
+				 || d < 0 || d >= MAX_DEPTH || (d > 0 && stack[d - 1] == NULL))
+		{
+			bad = YES;
+		}
+		else
+		{
+			unescape(line + pos);
+			last = d ? mem_node(stack[d - 1], line + pos) : root;
+			stack[d] = last;
+			if (d + 1 < MAX_DEPTH)
+				stack[d + 1] = NULL;
+			last->info.st_mode = mode;
+			last->info.st_dev = dev;
+			last->info.st_ino = ino;
+			last->info.st_nlink = nlink;
+			last->info.st_uid = uid;
+			last->info.st_gid = gid;
+			last->info.st_size = size;
+			last->info.st_mtime = mtime;
+			last->info.st_atime = atime;
+			last->info.st_ctime = ctime;
+			last->stat_ns = lat;
+			last->stat_err = err;
+		}
+	}
+
+	free(line);
+	free(stack);
+	fclose(fp);
+	if (bad || root == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return mem_backend(root, latency_scale);
+}
+
+/*
+ * unescape()
+ * Purpose: undo the escaping done by write_name(), in place
+ */
+static void unescape(char *s)
+{
+	char *out = s;
+
+	for (; *s; s++)
+	{
+		if (*s == '\\' && s[1] == 'n')
+			*out++ = '\n', s++;
+		else if (*s == '\\' && s[1] == '\\')
+			*out++ = '\\', s++;
+		else
+			*out++ = *s;
+	}
+	*out = '\0';
+}
+
+/*
+ * now_ns()
+ * Return: monotonic time in nanoseconds
+ */
+static long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
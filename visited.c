@@ -0,0 +1,357 @@
+/*
+ * ==========================
+ *   FILE: ./visited.c
+ * ==========================
+ * Purpose: Remember which (device, inode) pairs the search has seen, for
+ *		-unique and -follow, from any number of workers at once.
+ *
+ * Outline: visited_add() adds a pair and says whether it was new. There
+ *		are two ways to hold the set, chosen by visited_init():
+ *
+ *		exact	-- a lock-free open-addressing hash set of 16-byte slots,
+ *				   which grows without stopping its users
+ *		filter	-- a cuckoo filter of a fixed size, for when the set would
+ *				   not fit in memory. It may, rarely, call a new pair old
+ *				   (about 1 in 8000 when full), and once it overflows, may
+ *				   call an old one new.
+ *
+ * Exact set: a slot holds ino+1 and dev+1, so that zero means empty (key)
+ *		or not yet written (dev). A pair is added by claiming an empty
+ *		slot with a compare-and-swap on its key word and then storing its
+ *		dev; anyone finding the key waits for the dev before comparing.
+ *		Probing is linear and never goes further than PROBE_LIMIT slots.
+ *
+ *		A table that has no room within PROBE_LIMIT gets a successor
+ *		twice its size. The thread that created it migrates the old
+ *		table: it turns every empty slot into a tombstone, so that nothing
+ *		more can be claimed there, and copies every key across. Meanwhile
+ *		the other threads carry on: a probe that meets a tombstone, or
+ *		runs out of slots, continues in the next table. Keys are never
+ *		removed, and a key's probe sequence never holds an empty slot or
+ *		tombstone ahead of it, so a pair is found wherever it was first
+ *		added. Old tables are kept until visited_free(), as a thread may
+ *		still be probing one; they add at most the size of the last.
+ *
+ * Memory: the tables and the filter come from huge_alloc(), so that with
+ *		--hugepages their random accesses do not each miss in the TLB.
+ *
+ * Filter: buckets of four 16-bit fingerprints, one 64-bit word each, so a
+ *		fingerprint is placed with a single compare-and-swap. A pair may
+ *		go in either of two buckets; when both are full, fingerprints are
+ *		kicked along to their other bucket, up to MAX_KICKS times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "visited.h"
+#include "hugemem.h"
+
+/* CONSTANTS */
+#define NO	0
+#define YES	1
+#define INITIAL_SLOTS	(1 << 16)
+#define PROBE_LIMIT		64
+#define TOMB			(~0UL)			//slot closed by a migration
+#define MAX_KICKS		500
+
+struct slot {
+	unsigned long key;				//ino+1, 0 if empty, or TOMB
+	unsigned long dev;				//dev+1, 0 until written
+};
+
+struct table {
+	struct slot *slots;
+	unsigned long mask;				//number of slots - 1
+	struct table *next;				//larger successor, once grown
+	int migrated;					//all keys have been copied to next
+};
+
+static int add(struct table *, unsigned long, unsigned long, unsigned long);
+static void grow(struct table *);
+static struct table *new_table(unsigned long);
+static int filter_add(unsigned long);
+static int place(unsigned long, unsigned);
+static unsigned long mix(unsigned long);
+
+/* FILE-SCOPE VARIABLES */
+static struct table *head;			//oldest table not yet migrated
+static struct table *first;			//oldest table of all, for freeing
+
+static unsigned long *buckets;		//the filter, or NULL for the exact set
+static unsigned long nbuckets;		//a power of two
+static long overflows;				//fingerprints the filter had to drop
+
+/*
+ *	visited_init()
+ *	Purpose: start an empty set
+ *	  Input: filter_bytes, 0 for the exact set, or the memory the filter
+ *			 may use, rounded down to a power of two
+ *	 Return: 0, or -1 with errno set if there is no memory
+ */
+int visited_init(size_t filter_bytes)
+{
+	if (filter_bytes == 0)
+	{
+		head = first = new_table(INITIAL_SLOTS);
+		return head ? 0 : -1;
+	}
+
+	for (nbuckets = 1; nbuckets * 2 * sizeof *buckets <= filter_bytes; )
+		nbuckets *= 2;
+	buckets = huge_alloc(nbuckets * sizeof *buckets);
+	return buckets ? 0 : -1;
+}
+
+/*
+ *	visited_add()
+ *	Purpose: add a (device, inode) pair to the set
+ *	 Return: YES if it was not in the set before, NO if it was
+ *	   Note: If two threads add the same pair at once, exactly one is
+ *			 told YES (in the exact set).
+ */
+int visited_add(dev_t dev, ino_t ino)
+{
+	unsigned long h = mix(ino * 0x9e3779b97f4a7c15UL ^ mix(dev));
+	struct table *t;
+
+	if (buckets)
+		return filter_add(h);
+
+	t = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	return add(t, h, (unsigned long) ino + 1, (unsigned long) dev + 1);
+}
+
+/*
+ * visited_overflows()
+ * Return: the number of times the filter was too full to place a pair;
+ *		   after the first, -unique may print a file twice
+ */
+long visited_overflows()
+{
+	return overflows;
+}
+
+/*
+ * visited_free()
+ * Purpose: release the set; no thread may be using it
+ */
+void visited_free()
+{
+	struct table *t;
+
+	while ((t = first) != NULL)
+	{
+		first = t->next;
+		huge_free(t->slots, (t->mask + 1) * sizeof *t->slots);
+		free(t);
+	}
+	head = NULL;
+	huge_free(buckets, nbuckets * sizeof *buckets);
+	buckets = NULL;
+	overflows = 0;
+}
+
+/*
+ * add()
+ * Purpose: add "key"/"dev" with hash "h" to table "t", or to a later
+ *			table if there is no room in "t"
+ *  Return: YES if it was new, NO if it was found
+ */
+static int add(struct table *t, unsigned long h, unsigned long key,
+				unsigned long dev)
+{
+	struct slot *s;
+	unsigned long k, d, i, n;
+
+	if (key == 0 || key == TOMB)			//ino ~0 or ~1, not real inodes
+		key = TOMB - 1;
+
+	for (; ; t = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE))
+	{
+		for (i = h, n = 0; n < PROBE_LIMIT; i++, n++)
+		{
+			s = &t->slots[i & t->mask];
+			k = __atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+
+			if (k == 0)
+			{
+				if (__atomic_compare_exchange_n(&s->key, &k, key, NO,
+							__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				{
+					__atomic_store_n(&s->dev, dev, __ATOMIC_RELEASE);
+					return YES;
+				}
+				//lost the slot; "k" now holds what took it
+			}
+			if (k == TOMB)
+				break;						//being migrated, go on
+			if (k != key)
+				continue;
+
+			while ((d = __atomic_load_n(&s->dev, __ATOMIC_ACQUIRE)) == 0)
+				;							//claimed a moment ago
+			if (d == dev)
+				return NO;
+		}
+
+		if (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) == NULL)
+			grow(t);
+	}
+}
+
+/*
+ * grow()
+ * Purpose: give "t" a successor of twice the size, and, if this thread
+ *			is the one that installed it, migrate "t" into it
+ */
+static void grow(struct table *t)
+{
+	struct table *next = new_table(2 * (t->mask + 1));
+	struct table *expected = NULL;
+	struct slot *s;
+	unsigned long i, k, d;
+
+	if (next == NULL)						//cannot go on, nor be exact
+	{
+		perror("visited");
+		exit(1);
+	}
+	if (! __atomic_compare_exchange_n(&t->next, &expected, next, NO,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		huge_free(next->slots, (next->mask + 1) * sizeof *next->slots);
+		free(next);							//another thread got there first
+		return;
+	}
+
+	for (i = 0; i <= t->mask; i++)
+	{
+		s = &t->slots[i];
+		k = 0;
+		if (__atomic_compare_exchange_n(&s->key, &k, TOMB, NO,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+		while ((d = __atomic_load_n(&s->dev, __ATOMIC_ACQUIRE)) == 0)
+			;
+		add(next, mix((k - 1) * 0x9e3779b97f4a7c15UL ^ mix(d - 1)), k, d);
+	}
+	__atomic_store_n(&t->migrated, YES, __ATOMIC_RELEASE);
+
+	//let new searches start past every fully migrated table
+	while (__atomic_load_n(&(t = __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+								->migrated, __ATOMIC_ACQUIRE))
+		__atomic_compare_exchange_n(&head, &t, t->next, NO,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * new_table()
+ * Return: an empty table of "size" slots, or NULL if out of memory
+ */
+static struct table *new_table(unsigned long size)
+{
+	struct table *t = calloc(1, sizeof *t);
+
+	if (t && (t->slots = huge_alloc(size * sizeof *t->slots)) == NULL)
+	{
+		free(t);
+		t = NULL;
+	}
+	if (t)
+		t->mask = size - 1;
+	return t;
+}
+
+/*
+ * filter_add()
+ * Purpose: add the fingerprint of hash "h" to the filter
+ *  Return: NO if the fingerprint is in either of its buckets, else YES
+ */
+static int filter_add(unsigned long h)
+{
+	unsigned fp = (h >> 48) ? (h >> 48) : 1;		//0 marks an empty lane
+	unsigned long b1 = h & (nbuckets - 1);
+	unsigned long b2 = (b1 ^ mix(fp)) & (nbuckets - 1);
+	unsigned long word, evicted;
+	unsigned long b;
+	int lane, kick;
+
+	for (b = b1; ; b = b2)
+	{
+		word = __atomic_load_n(&buckets[b], __ATOMIC_ACQUIRE);
+		for (lane = 0; lane < 4; lane++)
+			if (((word >> (16 * lane)) & 0xffff) == fp)
+				return NO;
+		if (b == b2)
+			break;
+	}
+
+	if (place(b1, fp) || place(b2, fp))
+		return YES;
+
+	//both full: kick a random fingerprint on to its other bucket
+	for (b = (h >> 32) & 1 ? b1 : b2, kick = 0; kick < MAX_KICKS; kick++)
+	{
+		lane = (h >> (kick % 32)) & 3;
+		word = __atomic_load_n(&buckets[b], __ATOMIC_ACQUIRE);
+		evicted = (word >> (16 * lane)) & 0xffff;
+		if (evicted == 0)
+		{
+			if (place(b, fp))
+				return YES;
+			continue;
+		}
+		if (! __atomic_compare_exchange_n(&buckets[b], &word,
+					(word & ~(0xffffUL << (16 * lane)))
+					| ((unsigned long) fp << (16 * lane)), NO,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+
+		fp = evicted;
+		b = (b ^ mix(fp)) & (nbuckets - 1);
+		if (place(b, fp))
+			return YES;
+	}
+
+	__atomic_add_fetch(&overflows, 1, __ATOMIC_RELAXED);	//"fp" is lost
+	return YES;
+}
+
+/*
+ * place()
+ * Purpose: put "fp" in an empty lane of bucket "b"
+ *  Return: YES, or NO if the bucket is full
+ */
+static int place(unsigned long b, unsigned fp)
+{
+	unsigned long word = __atomic_load_n(&buckets[b], __ATOMIC_ACQUIRE);
+	int lane;
+
+	for (lane = 0; lane < 4; lane++)
+	{
+		if ((word >> (16 * lane)) & 0xffff)
+			continue;
+		if (__atomic_compare_exchange_n(&buckets[b], &word,
+					word | ((unsigned long) fp << (16 * lane)), NO,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return YES;
+		lane = -1;							//"word" was reloaded, rescan
+	}
+	return NO;
+}
+
+/*
+ * mix()
+ * Return: "x" with its bits well mixed (the murmur3 finalizer)
+ */
+static unsigned long mix(unsigned long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb93c185a8b53UL;
+	x ^= x >> 33;
+	return x;
+}
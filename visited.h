@@ -0,0 +1,18 @@
+/*
+ * ==========================
+ *   FILE: ./visited.h
+ * ==========================
+ * Purpose: A concurrent set of (device, inode) pairs, see visited.c.
+ */
+
+#ifndef VISITED_H
+#define VISITED_H
+
+#include <sys/types.h>
+
+int visited_init(size_t);
+int visited_add(dev_t, ino_t);
+long visited_overflows();
+void visited_free();
+
+#endif